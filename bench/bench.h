@@ -0,0 +1,57 @@
+/*
+ * bench.h - Benchmark helpers.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* Seconds since some fixed point */
+static inline double bench_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Repeatable pseudo random bytes, the same on every host */
+static inline void bench_fill(uint8_t *data, size_t size, uint32_t seed)
+{
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+/* Read back what was written to a temporary file, NUL terminated */
+static inline char *bench_slurp(FILE *file, size_t *size)
+{
+	*size = ftell(file);
+	char *text = malloc(*size + 1);
+	rewind(file);
+	if (!text || fread(text, 1, *size, file) != *size) {
+		fprintf(stderr, "Can't read the temporary file.\n");
+		exit(EXIT_FAILURE);
+	}
+	text[*size] = 0;
+	return text;
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,71 @@
+/*
+ * bench_ihex.c - Intel hex parser benchmark.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "ihex.h"
+
+#define IMAGE_SIZE (8 * 1024 * 1024)
+#define RUNS	   10
+
+/* Parse an 8 MiB image written by write_hex_file and report the hex
+ * text throughput of read_hex_file */
+int main(void)
+{
+	uint8_t *image = malloc(IMAGE_SIZE);
+	uint8_t *data = malloc(IMAGE_SIZE);
+	FILE *file = tmpfile();
+	if (!image || !data || !file) {
+		fprintf(stderr, "Can't set up the benchmark.\n");
+		return EXIT_FAILURE;
+	}
+	bench_fill(image, IMAGE_SIZE, 1);
+	if (write_hex_file(file, image, 0, IMAGE_SIZE, 16, 1))
+		return EXIT_FAILURE;
+
+	size_t length;
+	char *text = bench_slurp(file, &length);
+	fclose(file);
+
+	double best = 0;
+	for (int run = 0; run < RUNS; run++) {
+		size_t size = IMAGE_SIZE;
+		double start = bench_now();
+		if (read_hex_file((uint8_t *)text, data, 0, &size, NULL) !=
+		    INTEL_HEX_FORMAT) {
+			fprintf(stderr, "Parse error.\n");
+			return EXIT_FAILURE;
+		}
+		double time = bench_now() - start;
+		if (!run || time < best)
+			best = time;
+	}
+	if (memcmp(image, data, IMAGE_SIZE)) {
+		fprintf(stderr, "The data read back differs.\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("ihex: parsed %zu bytes of hex in %.2f ms, %.0f MB/s\n",
+	       length, best * 1000, length / best / 1e6);
+	free(text);
+	free(image);
+	free(data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/*
+ * bench_jedec.c - JED file parser and writer benchmark.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "jedec.h"
+
+#define RUNS 10
+
+/* Synthetic CPLD fuse maps, a small and a large one */
+static const uint32_t fuse_counts[] = { 65000, 800000 };
+
+static int bench_map(uint32_t qf)
+{
+	jedec_t map = { .device_name = "BENCH", .QP = 100, .QF = qf };
+	size_t size = JEDEC_FUSES_SIZE(qf);
+	double write_time = 0, read_time = 0;
+	size_t length = 0;
+
+	map.fuses = malloc(size);
+	if (!map.fuses)
+		return EXIT_FAILURE;
+	bench_fill(map.fuses, size, qf);
+	if (qf & 7)
+		map.fuses[size - 1] &= 0xff >> (8 - (qf & 7));
+
+	for (int run = 0; run < RUNS; run++) {
+		FILE *file = tmpfile();
+		if (!file)
+			return EXIT_FAILURE;
+		double start = bench_now();
+		if (write_jedec_file(file, &map))
+			return EXIT_FAILURE;
+		double time = bench_now() - start;
+		if (!run || time < write_time)
+			write_time = time;
+
+		char *text = bench_slurp(file, &length);
+		fclose(file);
+
+		jedec_t jedec;
+		memset(&jedec, 0, sizeof(jedec));
+		start = bench_now();
+		if (read_jedec_file(text, length, &jedec))
+			return EXIT_FAILURE;
+		time = bench_now() - start;
+		if (!run || time < read_time)
+			read_time = time;
+
+		if (jedec.QF != qf || memcmp(jedec.fuses, map.fuses, size) ||
+		    jedec.calc_file_checksum != jedec.decl_file_checksum ||
+		    jedec.fuse_checksum != jedec.C) {
+			fprintf(stderr, "The fuses read back differ.\n");
+			return EXIT_FAILURE;
+		}
+		free(jedec.fuses);
+		free(text);
+	}
+
+	printf("jedec: %u fuses, %zu bytes, parse %.2f ms %.0f MB/s, "
+	       "write %.2f ms %.0f MB/s\n",
+	       qf, length, read_time * 1000, length / read_time / 1e6,
+	       write_time * 1000, length / write_time / 1e6);
+	free(map.fuses);
+	return EXIT_SUCCESS;
+}
+
+/* Write each map with write_jedec_file, parse it back with
+ * read_jedec_file and report the best times of both */
+int main(void)
+{
+	for (size_t i = 0; i < sizeof(fuse_counts) / sizeof(fuse_counts[0]);
+	     i++) {
+		if (bench_map(fuse_counts[i]))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+/*
+ * bench_prom.c - PROM pin mapping benchmark.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "minipro.h"
+#include "bitbang.h"
+
+#define BYTES 0x1000000
+#define RUNS 5
+
+/* A DIP24 PROM with 11 address and 8 data lines */
+static uint8_t addr_bus[] = { 8, 7, 6, 5, 4, 3, 2, 1, 23, 22, 19, 0 };
+static uint8_t data_bus[] = { 9, 10, 11, 13, 14, 15, 16, 17, 0 };
+
+static uint8_t zif[40];
+static volatile uint32_t sink;
+
+/* What prom_read() does per byte with the plain pin lists */
+static double run_lists(void)
+{
+	uint32_t sum = 0;
+	double start = bench_now();
+	for (uint32_t i = 0; i < BYTES; i++) {
+		set_bits(zif, addr_bus, i, 24);
+		sum += get_bits(zif, data_bus, 24);
+	}
+	sink = sum;
+	return bench_now() - start;
+}
+
+/* The same with the compiled pin lists */
+static double run_compiled(const bb_pins_t *addr, const bb_pins_t *data)
+{
+	uint32_t sum = 0;
+	double start = bench_now();
+	for (uint32_t i = 0; i < BYTES; i++) {
+		bb_set_bits(zif, addr, i);
+		sum += bb_get_bits(zif, data);
+	}
+	sink = sum;
+	return bench_now() - start;
+}
+
+/* Set a PROM address and read its data bus for every byte, with the
+ * pin lists mapped per call and compiled once, and report the best time
+ * per byte of both */
+int main(void)
+{
+	bb_pins_t addr, data;
+	double lists = 0, compiled = 0;
+
+	bb_compile_pins(&addr, addr_bus, 24);
+	bb_compile_pins(&data, data_bus, 24);
+
+	for (int run = 0; run < RUNS; run++) {
+		double time = run_lists();
+		if (!run || time < lists)
+			lists = time;
+		time = run_compiled(&addr, &data);
+		if (!run || time < compiled)
+			compiled = time;
+	}
+
+	printf("prom: pin lists %.1f ns/byte, compiled %.1f ns/byte\n",
+	       lists / BYTES * 1e9, compiled / BYTES * 1e9);
+	return EXIT_SUCCESS;
+}
@@ -21,10 +21,15 @@
 #include <unistd.h>
 #include <time.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #include "database.h"
 #include "minipro.h"
 #include "bitbang.h"
 #include "prom.h"
+#include "serial.h"
 #include "usb.h"
 
 static inline uint8_t PIN(uint8_t pin, uint8_t count)
@@ -78,11 +83,305 @@ uint32_t get_bits(uint8_t *zif, uint8_t *pins, uint8_t package)
 	return value;
 }
 
+/* Compile a zero terminated pin list of a package */
+void bb_compile_pins(bb_pins_t *compiled, uint8_t *pins, uint8_t package)
+{
+	compiled->count = 0;
+	for (; pins && *pins && compiled->count < 32; pins++)
+		compiled->index[compiled->count++] = PIN(*pins, package) - 1;
+}
+
+/* Like set_bits() */
+void bb_set_bits(uint8_t *zif, const bb_pins_t *pins, uint32_t value)
+{
+	for (int bit = 0; bit < pins->count; bit++, value >>= 1)
+		zif[pins->index[bit]] = value & 0x01;
+}
+
+/* Like get_bits() */
+uint32_t bb_get_bits(const uint8_t *zif, const bb_pins_t *pins)
+{
+	uint32_t value = 0;
+	for (int bit = 0; bit < pins->count; bit++)
+		value |= (uint32_t)(zif[pins->index[bit]] != 0) << bit;
+	return value;
+}
+
+/* Like set_io_pins() */
+void bb_set_pins(uint8_t *zif, const bb_pins_t *pins, uint8_t value)
+{
+	for (int bit = 0; bit < pins->count; bit++)
+		zif[pins->index[bit]] = value;
+}
+
+/* Grow an array of size elements to hold one more */
+static int grow(void **array, size_t *size, size_t count, size_t element)
+{
+	if (count < *size)
+		return EXIT_SUCCESS;
+	size_t new_size = *size ? *size * 2 : 256;
+	void *p = realloc(*array, new_size * element);
+	if (!p) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	*array = p;
+	*size = new_size;
+	return EXIT_SUCCESS;
+}
+
+/* Append an operation of the given type */
+static zif_op_t *queue_add(zif_queue_t *queue, uint8_t type)
+{
+	if (grow((void **)&queue->ops, &queue->size, queue->count,
+		 sizeof(zif_op_t)))
+		return NULL;
+	zif_op_t *op = &queue->ops[queue->count++];
+	op->type = type;
+	return op;
+}
+
+int zif_queue_set(zif_queue_t *queue, uint8_t *zif)
+{
+	zif_op_t *op = queue_add(queue, ZIF_OP_SET);
+	if (!op)
+		return EXIT_FAILURE;
+	memcpy(op->zif, zif, 40);
+	return EXIT_SUCCESS;
+}
+
+int zif_queue_read(zif_queue_t *queue)
+{
+	return queue_add(queue, ZIF_OP_READ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int zif_queue_delay(zif_queue_t *queue, uint32_t delay)
+{
+	zif_op_t *op = queue_add(queue, ZIF_OP_DELAY);
+	if (!op)
+		return EXIT_FAILURE;
+	op->delay = delay;
+	return EXIT_SUCCESS;
+}
+
+int zif_queue_direction(zif_queue_t *queue, uint8_t *zif)
+{
+	zif_op_t *op = queue_add(queue, ZIF_OP_DIRECTION);
+	if (!op)
+		return EXIT_FAILURE;
+	memcpy(op->zif, zif, 40);
+	return EXIT_SUCCESS;
+}
+
+/* Run the pin states and reads from first to last as one batch */
+static int run_batch(minipro_handle_t *handle, zif_queue_t *queue,
+		     size_t first, size_t last)
+{
+	zif_queue_t batch = { .ops = queue->ops + first,
+			      .count = last - first,
+			      .size = last - first,
+			      .results = queue->results + queue->result_count,
+			      .result_size = queue->result_size -
+					     queue->result_count };
+	size_t i;
+
+	if (handle->minipro_run_zif_queue) {
+		if (handle->minipro_run_zif_queue(handle, &batch))
+			return EXIT_FAILURE;
+		queue->result_count += batch.result_count;
+		return EXIT_SUCCESS;
+	}
+
+	/* One round trip per operation */
+	for (i = 0; i < batch.count; i++) {
+		zif_op_t *op = &batch.ops[i];
+		if (op->type == ZIF_OP_READ ?
+			    minipro_get_zif_state(
+				    handle,
+				    queue->results[queue->result_count++]) :
+			    minipro_set_zif_state(handle, op->zif))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Run the queued operations, the programmer backend pipelines them if
+ * it can */
+int zif_queue_run(minipro_handle_t *handle, zif_queue_t *queue)
+{
+	size_t i, first, reads = 0;
+	for (i = 0; i < queue->count; i++)
+		reads += queue->ops[i].type == ZIF_OP_READ;
+	queue->result_count = 0;
+	if (reads > queue->result_size) {
+		void *p = realloc(queue->results, reads * 40);
+		if (!p) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
+		queue->results = p;
+		queue->result_size = reads;
+	}
+
+	for (first = i = 0; i <= queue->count; i++) {
+		zif_op_t *op = i < queue->count ? &queue->ops[i] : NULL;
+		if (op && (op->type == ZIF_OP_SET || op->type == ZIF_OP_READ))
+			continue;
+		if (i > first && run_batch(handle, queue, first, i))
+			return EXIT_FAILURE;
+		first = i + 1;
+		if (!op)
+			break;
+		if (op->type == ZIF_OP_DELAY) {
+			usleep(op->delay);
+			continue;
+		}
+		if (minipro_set_zif_direction(handle, op->zif))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Empty the queue for the next block, the memory is kept */
+void zif_queue_clear(zif_queue_t *queue)
+{
+	queue->count = 0;
+	queue->result_count = 0;
+}
+
+void zif_queue_free(zif_queue_t *queue)
+{
+	free(queue->ops);
+	free(queue->results);
+	memset(queue, 0, sizeof(*queue));
+}
+
+/* Add a zeroed message to the batch */
+bb_msg_t *bb_batch_add(bb_batch_t *batch)
+{
+	if (grow((void **)&batch->msgs, &batch->size, batch->count,
+		 sizeof(bb_msg_t)))
+		return NULL;
+	bb_msg_t *msg = &batch->msgs[batch->count++];
+	memset(msg, 0, sizeof(*msg));
+	return msg;
+}
+
+typedef struct bb_pipeline {
+	int pending; /* Messages being sent */
+	int status;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} bb_pipeline_t;
+
+/* Called from the USB event thread */
+static void bb_send_done(int status, void *user_data)
+{
+	bb_pipeline_t *pipeline = user_data;
+#ifndef _WIN32
+	pthread_mutex_lock(&pipeline->lock);
+#endif
+	pipeline->pending--;
+	if (status)
+		pipeline->status = status;
+#ifndef _WIN32
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->lock);
+#endif
+}
+
+/* Wait until at most max messages are being sent */
+static int bb_wait(bb_pipeline_t *pipeline, int max)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&pipeline->lock);
+	while (pipeline->pending > max)
+		pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+	pthread_mutex_unlock(&pipeline->lock);
+#endif
+	return pipeline->status;
+}
+
+static int bb_full(bb_pipeline_t *pipeline)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&pipeline->lock);
+	int full = pipeline->pending >= BB_PIPELINE_DEPTH;
+	pthread_mutex_unlock(&pipeline->lock);
+	return full;
+#else
+	return pipeline->pending >= BB_PIPELINE_DEPTH;
+#endif
+}
+
+/*
+ * Send all messages of the batch with up to BB_PIPELINE_DEPTH of them
+ * in flight and store the replies in order. The replies are read while
+ * the next messages are queued, so the programmer never waits on a
+ * reply the host has not asked for yet.
+ */
+int bb_batch_send(minipro_handle_t *handle, bb_batch_t *batch,
+		  uint8_t (*replies)[48])
+{
+	bb_pipeline_t pipeline;
+	size_t sent, unread = 0, n = 0;
+	int ret = EXIT_SUCCESS;
+
+	memset(&pipeline, 0, sizeof(pipeline));
+#ifndef _WIN32
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.cond, NULL);
+#endif
+	for (sent = 0; sent < batch->count && !ret; sent++) {
+		/* Read the replies due first if the window is full */
+		while (bb_full(&pipeline) && unread && !ret) {
+			ret = msg_recv(handle->usb_handle, replies[n++], 48);
+			unread--;
+		}
+		if (ret || bb_wait(&pipeline, BB_PIPELINE_DEPTH - 1)) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		bb_msg_t *msg = &batch->msgs[sent];
+#ifndef _WIN32
+		pthread_mutex_lock(&pipeline.lock);
+#endif
+		pipeline.pending++;
+#ifndef _WIN32
+		pthread_mutex_unlock(&pipeline.lock);
+#endif
+		if (msg_send_async(handle->usb_handle, msg->data, msg->length,
+				   bb_send_done, &pipeline, NULL)) {
+			pipeline.pending--;
+			ret = EXIT_FAILURE;
+			break;
+		}
+		unread += msg->reply;
+	}
+	while (unread-- && !ret)
+		ret = msg_recv(handle->usb_handle, replies[n++], 48);
+
+	if (bb_wait(&pipeline, 0))
+		ret = EXIT_FAILURE;
+#ifndef _WIN32
+	pthread_cond_destroy(&pipeline.cond);
+	pthread_mutex_destroy(&pipeline.lock);
+#endif
+	return ret;
+}
+
 int bb_begin_transaction(minipro_handle_t *handle)
 {
 	switch (handle->device->protocol_id) {
 	case CP_PROM:
 		return prom_init(handle);
+	case CP_SPI:
+	case CP_I2C:
+	case CP_MICROWIRE:
+		return serial_init(handle);
 	default:
 		fprintf(stderr, "Unimplemented bb_begin_transaction\n");
 		return EXIT_FAILURE;
@@ -94,6 +393,10 @@ int bb_end_transaction(minipro_handle_t *handle)
 	switch (handle->device->protocol_id) {
 	case CP_PROM:
 		return prom_terminate(handle);
+	case CP_SPI:
+	case CP_I2C:
+	case CP_MICROWIRE:
+		return serial_terminate(handle);
 	default:
 		fprintf(stderr, "Unimplemented bb_end_transaction\n");
 		return EXIT_FAILURE;
@@ -106,6 +409,10 @@ int bb_read_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 	switch (handle->device->protocol_id) {
 	case CP_PROM:
 		return prom_read(handle, addr, buf, len);
+	case CP_SPI:
+	case CP_I2C:
+	case CP_MICROWIRE:
+		return serial_read(handle, addr, buf, len);
 	default:
 		fprintf(stderr, "Unimplemented read_block\n");
 		return EXIT_FAILURE;
@@ -115,8 +422,15 @@ int bb_read_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 int bb_write_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 		   uint8_t *buf, size_t len)
 {
-	fprintf(stderr, "Unimplemented write_block\n");
-	return EXIT_FAILURE;
+	switch (handle->device->protocol_id) {
+	case CP_SPI:
+	case CP_I2C:
+	case CP_MICROWIRE:
+		return serial_write(handle, addr, buf, len);
+	default:
+		fprintf(stderr, "Unimplemented write_block\n");
+		return EXIT_FAILURE;
+	}
 }
 
 int bb_read_fuses(minipro_handle_t *handle, uint8_t type, size_t length,
@@ -139,17 +453,22 @@ int bb_read_calibration(minipro_handle_t *handle, uint8_t *buffer, size_t len)
 	return EXIT_FAILURE;
 }
 
-int bb_get_chip_id(minipro_handle_t *handle, uint32_t *device_id)
+int bb_get_chip_id(minipro_handle_t *handle, uint8_t *type,
+		   uint32_t *device_id)
 {
-	fprintf(stderr, "Unimplemented bb_get_chip_id\n");
-	return EXIT_FAILURE;
+	switch (handle->device->protocol_id) {
+	case CP_SPI:
+		return serial_get_chip_id(handle, type, device_id);
+	default:
+		fprintf(stderr, "Unimplemented bb_get_chip_id\n");
+		return EXIT_FAILURE;
+	}
 }
 
 int bb_spi_autodetect(minipro_handle_t *handle, uint8_t type,
 		      uint32_t *device_id)
 {
-	fprintf(stderr, "Unimplemented bb_spi_autodetect\n");
-	return EXIT_FAILURE;
+	return serial_autodetect(handle, type, device_id);
 }
 
 int bb_protect_off(minipro_handle_t *handle)
@@ -166,8 +485,14 @@ int bb_protect_on(minipro_handle_t *handle)
 
 int bb_erase(minipro_handle_t *handle)
 {
-	fprintf(stderr, "Unimplemented bb_erase\n");
-	return EXIT_FAILURE;
+	switch (handle->device->protocol_id) {
+	case CP_SPI:
+	case CP_MICROWIRE:
+		return serial_erase(handle);
+	default:
+		fprintf(stderr, "Unimplemented bb_erase\n");
+		return EXIT_FAILURE;
+	}
 }
 
 int bb_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer, uint8_t row,
@@ -32,7 +32,7 @@ int bb_write_block(minipro_handle_t *, uint8_t, uint32_t, uint8_t *, size_t);
 int bb_read_fuses(minipro_handle_t *, uint8_t, size_t, uint8_t, uint8_t *);
 int bb_write_fuses(minipro_handle_t *, uint8_t, size_t, uint8_t, uint8_t *);
 int bb_read_calibration(minipro_handle_t *, uint8_t *, size_t);
-int bb_get_chip_id(minipro_handle_t *, uint32_t *);
+int bb_get_chip_id(minipro_handle_t *, uint8_t *, uint32_t *);
 int bb_spi_autodetect(minipro_handle_t *, uint8_t, uint32_t *);
 int bb_protect_off(minipro_handle_t *);
 int bb_protect_on(minipro_handle_t *);
@@ -46,4 +46,84 @@ void set_pwr_pins(pin_driver_t *, uint8_t *, uint8_t, uint8_t, uint8_t);
 void set_bits(uint8_t *, uint8_t *, uint32_t, uint8_t);
 uint32_t get_bits(uint8_t *, uint8_t *, uint8_t);
 
+/*
+ * A pin list compiled for one package. set_bits() and get_bits() walk
+ * a zero terminated list and map every package pin to the ZIF socket on
+ * each call. A compiled list keeps the ZIF index of each bit, so setting
+ * an address or reading a data bus is one indexed access per bit.
+ */
+typedef struct bb_pins {
+	uint8_t count;
+	uint8_t index[32]; /* ZIF index of each bit, lsb first */
+} bb_pins_t;
+
+void bb_compile_pins(bb_pins_t *, uint8_t *, uint8_t);
+void bb_set_bits(uint8_t *, const bb_pins_t *, uint32_t);
+uint32_t bb_get_bits(const uint8_t *, const bb_pins_t *);
+void bb_set_pins(uint8_t *, const bb_pins_t *, uint8_t);
+
+/* Messages kept in flight by bb_batch_send(). Every transfer completes
+ * before the next one is started on Windows. */
+#ifdef _WIN32
+#define BB_PIPELINE_DEPTH 1
+#else
+#define BB_PIPELINE_DEPTH 16
+#endif
+
+enum zif_op_type {
+	ZIF_OP_SET, /* Set the ZIF pin state */
+	ZIF_OP_READ, /* Read back all pins */
+	ZIF_OP_DELAY, /* Wait delay microseconds */
+	ZIF_OP_DIRECTION /* Set the pin directions */
+};
+
+typedef struct zif_op {
+	uint8_t type;
+	uint8_t zif[40];
+	uint32_t delay;
+} zif_op_t;
+
+/*
+ * A script of ZIF operations. All the states of a block are queued
+ * first and zif_queue_run() then sends them back to back, so a bitbang
+ * read costs USB bandwidth instead of a round trip per pin change.
+ * The pins read are in results, one entry per read in queue order.
+ * Pin direction changes and delays are run in order between the
+ * batches of pin states, the backends only see ZIF_OP_SET and
+ * ZIF_OP_READ.
+ */
+typedef struct zif_queue {
+	zif_op_t *ops;
+	size_t count;
+	size_t size;
+	uint8_t (*results)[40];
+	size_t result_count;
+	size_t result_size;
+} zif_queue_t;
+
+int zif_queue_set(zif_queue_t *, uint8_t *);
+int zif_queue_read(zif_queue_t *);
+int zif_queue_delay(zif_queue_t *, uint32_t);
+int zif_queue_direction(zif_queue_t *, uint8_t *);
+int zif_queue_run(minipro_handle_t *, zif_queue_t *);
+void zif_queue_clear(zif_queue_t *);
+void zif_queue_free(zif_queue_t *);
+
+/* Programmer messages of a zif_queue_t, reply is set for the messages
+ * which return the pin states */
+typedef struct bb_msg {
+	uint8_t data[48];
+	uint8_t length;
+	uint8_t reply;
+} bb_msg_t;
+
+typedef struct bb_batch {
+	bb_msg_t *msgs;
+	size_t count;
+	size_t size;
+} bb_batch_t;
+
+bb_msg_t *bb_batch_add(bb_batch_t *);
+int bb_batch_send(minipro_handle_t *, bb_batch_t *, uint8_t (*)[48]);
+
 #endif
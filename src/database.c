@@ -140,6 +140,7 @@ typedef struct state_machine_d {
 	uint32_t logic_count;
 	uint32_t logic_custom_count;
 	uint8_t load_vectors;
+	logic_list_t *logic_list;
 } state_machine_d_t;
 
 /* State machine structure used by sax profile parser callback function
@@ -598,6 +599,44 @@ static int load_device(db_data_t *db_data, const char *xml_device, size_t size,
 	return ret;
 }
 
+/* Add a logic device with the wanted pin count to the list */
+static int add_logic_device(state_machine_d_t *sm, const char *xml_device,
+			    size_t size, Memblock *mb_name)
+{
+	logic_list_t *list = sm->logic_list;
+	device_t device;
+	memset(&device, 0, sizeof(device));
+	sm->load_vectors = 0;
+	if (load_device(sm->db_data, xml_device, size, &device,
+			LOGIC_DATABASE))
+		return EXIT_FAILURE;
+	if (device.package_details.pin_count != sm->db_data->pin_count)
+		return EXIT_SUCCESS;
+
+	device_t *devices = realloc(list->devices,
+				    (list->count + 1) * sizeof(device_t));
+	if (!devices)
+		return ERRMEM;
+	list->devices = devices;
+	char **names = realloc(list->names, (list->count + 1) * sizeof(char *));
+	if (!names)
+		return ERRMEM;
+	list->names = names;
+	names[list->count] = strndup(mb_name->b, mb_name->z);
+	if (!names[list->count])
+		return ERRMEM;
+
+	/* The first name of the list */
+	size_t length = strcspn(names[list->count], ",");
+	if (length >= NAME_LEN)
+		length = NAME_LEN - 1;
+	memcpy(device.name, names[list->count], length);
+	devices[list->count] = device;
+	sm->device = &devices[list->count++];
+	sm->load_vectors = 1;
+	return EXIT_SUCCESS;
+}
+
 /* Compare a device by protocol ID/device ID or protocol ID/package
  */
 static int compare_device(const char *xml_device, size_t size,
@@ -1144,6 +1183,14 @@ static int device_callback(int type, const char *tag, size_t taglen,
 				break;
 			}
 
+			/* Collect logic devices by pin count */
+			if (sm->logic_list) {
+				if (sm->db_version != LOGIC_DATABASE)
+					return XML_OK;
+				return add_logic_device(sm, tag, taglen,
+							&mb_name);
+			}
+
 			/* Filter only devices from the desired database */
 			if (sm->count_only ||
 			    sm->db_data->version != sm->db_version)
@@ -1583,6 +1630,46 @@ int list_devices(db_data_t *db_data)
 	return EXIT_SUCCESS;
 }
 
+/* Get all logic devices with db_data->pin_count pins and their test
+ * vectors */
+logic_list_t *get_logic_devices(db_data_t *db_data)
+{
+	logic_list_t *list = calloc(1, sizeof(logic_list_t));
+	if (!list) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	/* Initialize state machine structure */
+	state_machine_d_t sm;
+	memset(&sm, 0, sizeof(sm));
+	sm.db_version = -1;
+	sm.custom = -1;
+	sm.logic_list = list;
+	sm.db_data = db_data;
+	db_data->version = LOGIC_DATABASE;
+
+	if (parse_xml_file(&sm, LOGICIC_NAME, db_data->logicic_path)) {
+		free_logic_devices(list);
+		return NULL;
+	}
+	return list;
+}
+
+void free_logic_devices(logic_list_t *list)
+{
+	size_t i;
+	if (!list)
+		return;
+	for (i = 0; i < list->count; i++) {
+		free(list->names[i]);
+		free(list->devices[i].vectors);
+	}
+	free(list->names);
+	free(list->devices);
+	free(list);
+}
+
 /* Print database chip count */
 int print_chip_count(db_data_t *db_data)
 {
@@ -149,10 +149,19 @@ typedef struct db_data {
 	uint32_t *count;
 } db_data_t;
 
+/* All logic ICs with a given pin count, see get_logic_devices() */
+typedef struct logic_list {
+	size_t count;
+	char **names; /* Comma separated part numbers of each device */
+	device_t *devices;
+} logic_list_t;
+
 pin_map_t *get_pin_map(db_data_t *);
 int get_algorithm(device_t *, const char *, uint8_t, uint8_t, size_t);
 int print_chip_count(db_data_t *);
 int list_devices(db_data_t *);
 device_t *get_device_by_name(db_data_t *);
 const char *get_device_from_id(db_data_t *);
+logic_list_t *get_logic_devices(db_data_t *);
+void free_logic_devices(logic_list_t *);
 #endif
@@ -0,0 +1,144 @@
+/*
+ * elf.c - Functions for dealing with ELF files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "minipro.h"
+
+#define EI_CLASS    4
+#define EI_DATA	    5
+#define ELFCLASS32  1
+#define ELFCLASS64  2
+#define ELFDATA2LSB 1
+#define ELFDATA2MSB 2
+#define PT_LOAD	    1
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Offsets of the fields we need in the ELF32/ELF64 headers */
+typedef struct {
+	size_t header_size;
+	size_t phoff, phoff_size;
+	size_t phentsize, phnum;
+	size_t ph_size;
+	size_t p_offset, p_paddr, p_filesz, word_size;
+} elf_layout_t;
+
+static const elf_layout_t elf32 = { 52, 0x1c, 4, 0x2a, 0x2c,
+				    32, 0x04, 0x0c, 0x10, 4 };
+static const elf_layout_t elf64 = { 64, 0x20, 8, 0x36, 0x38,
+				    56, 0x08, 0x18, 0x20, 8 };
+
+int is_elf(const uint8_t *buffer, size_t length)
+{
+	return length >= 4 && !memcmp(buffer, "\177ELF", 4);
+}
+
+/* Load the PT_LOAD segments of an ELF image at their physical address.
+ * Only data at base..base + size is loaded, relative to base.
+ * The loaded address ranges are added to extents if not NULL. */
+int read_elf_file(uint8_t *image, size_t length, uint8_t *data, uint32_t base,
+		  size_t size, extents_t *extents)
+{
+	const elf_layout_t *elf;
+	uint8_t endian;
+	size_t i;
+
+	if (!is_elf(image, length) || length < elf32.header_size)
+		return NOT_ELF;
+	switch (image[EI_CLASS]) {
+	case ELFCLASS32:
+		elf = &elf32;
+		break;
+	case ELFCLASS64:
+		elf = &elf64;
+		break;
+	default:
+		fprintf(stderr, "Unsupported ELF class %u.\n", image[EI_CLASS]);
+		return EXIT_FAILURE;
+	}
+	switch (image[EI_DATA]) {
+	case ELFDATA2LSB:
+		endian = MP_LITTLE_ENDIAN;
+		break;
+	case ELFDATA2MSB:
+		endian = MP_BIG_ENDIAN;
+		break;
+	default:
+		fprintf(stderr, "Unsupported ELF data encoding %u.\n",
+			image[EI_DATA]);
+		return EXIT_FAILURE;
+	}
+
+	if (length < elf->header_size) {
+		fprintf(stderr, "Truncated ELF header.\n");
+		return EXIT_FAILURE;
+	}
+
+	uint64_t phoff = load_int(&image[elf->phoff], elf->phoff_size, endian);
+	size_t phentsize = load_int(&image[elf->phentsize], 2, endian);
+	size_t phnum = load_int(&image[elf->phnum], 2, endian);
+	if (phentsize < elf->ph_size || phoff > length ||
+	    phnum > (length - phoff) / phentsize) {
+		fprintf(stderr, "Bad ELF program header table.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		uint8_t *ph = &image[phoff + i * phentsize];
+		if (load_int(ph, 4, endian) != PT_LOAD)
+			continue;
+		uint64_t offset =
+			load_int(&ph[elf->p_offset], elf->word_size, endian);
+		uint64_t paddr =
+			load_int(&ph[elf->p_paddr], elf->word_size, endian);
+		uint64_t filesz =
+			load_int(&ph[elf->p_filesz], elf->word_size, endian);
+
+		/* Nothing to program for .bss like segments */
+		if (!filesz)
+			continue;
+		if (offset > length || filesz > length - offset) {
+			fprintf(stderr, "ELF segment %zu is truncated.\n", i);
+			return EXIT_FAILURE;
+		}
+
+		/* Clip the segment to the load window */
+		uint64_t first = MAX(paddr, base);
+		uint64_t last = MIN(paddr + filesz, (uint64_t)base + size);
+		if (first >= last) {
+			fprintf(stderr,
+				"Warning: ELF segment at 0x%08" PRIX64
+				" is outside of the memory, ignored.\n",
+				paddr);
+			continue;
+		}
+		memcpy(&data[first - base], &image[offset + first - paddr],
+		       last - first);
+		if (extents &&
+		    extents_add(extents, first - base, last - first)) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
+	}
+	return ELF_FORMAT;
+}
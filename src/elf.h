@@ -0,0 +1,32 @@
+/*
+ * elf.h - Functions for dealing with ELF files declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef ELF_H_
+#define ELF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "extent.h"
+
+#define ELF_FORMAT 0
+#define NOT_ELF	   -1
+
+int is_elf(const uint8_t *buffer, size_t length);
+int read_elf_file(uint8_t *image, size_t length, uint8_t *data, uint32_t base,
+		  size_t size, extents_t *extents);
+
+#endif
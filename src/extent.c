@@ -0,0 +1,109 @@
+/*
+ * extent.c - Sparse image extent list.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "extent.h"
+
+/* Index of the first extent ending at or after address */
+static size_t find_extent(const extents_t *extents, uint64_t address)
+{
+	size_t low = 0, high = extents->count;
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		const extent_t *e = &extents->list[mid];
+		if ((uint64_t)e->start + e->length < address)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Add an address range, merging it with its neighbours */
+int extents_add(extents_t *extents, uint32_t start, uint32_t length)
+{
+	if (!length)
+		return EXIT_SUCCESS;
+
+	uint64_t end = (uint64_t)start + length;
+	extent_t *last = extents->count ?
+				 &extents->list[extents->count - 1] :
+				 NULL;
+
+	/* Records are usually in address order, extend the last extent */
+	if (last && start >= last->start &&
+	    start <= (uint64_t)last->start + last->length) {
+		if (end > (uint64_t)last->start + last->length)
+			last->length = end - last->start;
+		return EXIT_SUCCESS;
+	}
+
+	/* Merge with all the extents touching the new range */
+	size_t first = find_extent(extents, start);
+	size_t i = first;
+	while (i < extents->count && extents->list[i].start <= end) {
+		extent_t *e = &extents->list[i];
+		if (e->start < start)
+			start = e->start;
+		if ((uint64_t)e->start + e->length > end)
+			end = (uint64_t)e->start + e->length;
+		i++;
+	}
+	length = end - start;
+
+	if (i > first) {
+		/* Replace the merged extents with a single one */
+		extents->list[first].start = start;
+		extents->list[first].length = length;
+		memmove(&extents->list[first + 1], &extents->list[i],
+			(extents->count - i) * sizeof(extent_t));
+		extents->count -= i - first - 1;
+		return EXIT_SUCCESS;
+	}
+
+	if (extents->count == extents->capacity) {
+		size_t capacity = extents->capacity ? extents->capacity * 2 : 16;
+		extent_t *list =
+			realloc(extents->list, capacity * sizeof(extent_t));
+		if (!list)
+			return EXIT_FAILURE;
+		extents->list = list;
+		extents->capacity = capacity;
+	}
+	memmove(&extents->list[first + 1], &extents->list[first],
+		(extents->count - first) * sizeof(extent_t));
+	extents->list[first].start = start;
+	extents->list[first].length = length;
+	extents->count++;
+	return EXIT_SUCCESS;
+}
+
+/* Check if any byte of start..start + length holds file data */
+int extents_overlap(const extents_t *extents, uint32_t start, size_t length)
+{
+	size_t i = find_extent(extents, (uint64_t)start + 1);
+	return i < extents->count &&
+	       extents->list[i].start < (uint64_t)start + length;
+}
+
+void extents_free(extents_t *extents)
+{
+	free(extents->list);
+	memset(extents, 0, sizeof(extents_t));
+}
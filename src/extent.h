@@ -0,0 +1,44 @@
+/*
+ * extent.h - Sparse image extent list declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef EXTENT_H_
+#define EXTENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct extent {
+	uint32_t start;
+	uint32_t length;
+} extent_t;
+
+/*
+ * The address ranges of an image which hold file data, sorted by
+ * address. Overlapping and adjacent ranges are merged so the list
+ * stays as short as the image layout allows.
+ */
+typedef struct extents {
+	extent_t *list;
+	size_t count;
+	size_t capacity;
+} extents_t;
+
+int extents_add(extents_t *extents, uint32_t start, uint32_t length);
+int extents_overlap(const extents_t *extents, uint32_t start, size_t length);
+void extents_free(extents_t *extents);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * gzio.c - Compressed file streams.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "gzio.h"
+
+/* Write the inflated data out, more calls are needed while the output
+ * buffer fills up */
+static int inflate_chunk(z_stream *stream, uint8_t *buffer, FILE *out)
+{
+	int ret;
+	do {
+		stream->next_out = buffer;
+		stream->avail_out = GZIO_CHUNK_SIZE;
+		ret = inflate(stream, Z_NO_FLUSH);
+		if (ret == Z_BUF_ERROR)
+			ret = Z_OK; /* Nothing left to do */
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			fprintf(stderr, "Bad gzip data.\n");
+			return ret;
+		}
+		size_t n = GZIO_CHUNK_SIZE - stream->avail_out;
+		if (n && fwrite(buffer, 1, n, out) != n) {
+			perror("Decompression error");
+			return Z_ERRNO;
+		}
+	} while (!stream->avail_out && ret == Z_OK);
+	return ret;
+}
+
+/* Decompress the prefix and the rest of the file into out */
+static int inflate_stream(gzio_t *gz, FILE *out)
+{
+	int ret = Z_OK, status = EXIT_FAILURE;
+	z_stream stream = { .next_in = gz->prefix,
+			    .avail_in = gz->prefix_length };
+	uint8_t *in = malloc(GZIO_CHUNK_SIZE);
+	uint8_t *buffer = malloc(GZIO_CHUNK_SIZE);
+	if (!in || !buffer) {
+		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+	if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+		fprintf(stderr, "Decompression error.\n");
+		goto cleanup;
+	}
+
+	for (;;) {
+		if (!stream.avail_in) {
+			stream.next_in = in;
+			stream.avail_in =
+				fread(in, 1, GZIO_CHUNK_SIZE, gz->file);
+			if (ferror(gz->file)) {
+				perror("File read error");
+				break;
+			}
+			if (!stream.avail_in) {
+				if (ret == Z_STREAM_END)
+					status = EXIT_SUCCESS;
+				else
+					fprintf(stderr,
+						"Unexpected end of gzip data.\n");
+				break;
+			}
+		}
+		/* Concatenated gzip members */
+		if (ret == Z_STREAM_END)
+			inflateReset(&stream);
+		ret = inflate_chunk(&stream, buffer, out);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+	}
+	inflateEnd(&stream);
+
+cleanup:
+	free(in);
+	free(buffer);
+	return status;
+}
+
+/* Compress everything from in into the file.
+ * On a file error the input is still drained so the writer never blocks. */
+static int deflate_stream(gzio_t *gz, FILE *in)
+{
+	int flush, status = EXIT_FAILURE;
+	z_stream stream = { 0 };
+	uint8_t *buffer = malloc(GZIO_CHUNK_SIZE);
+	uint8_t *out = malloc(GZIO_CHUNK_SIZE);
+	if (!buffer || !out) {
+		fprintf(stderr, "Out of memory!\n");
+		goto drain;
+	}
+	if (deflateInit2(&stream, gz->level, Z_DEFLATED, MAX_WBITS + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		fprintf(stderr, "Compression error.\n");
+		goto drain;
+	}
+
+	do {
+		stream.next_in = buffer;
+		stream.avail_in = fread(buffer, 1, GZIO_CHUNK_SIZE, in);
+		flush = stream.avail_in < GZIO_CHUNK_SIZE ? Z_FINISH :
+							    Z_NO_FLUSH;
+		do {
+			stream.next_out = out;
+			stream.avail_out = GZIO_CHUNK_SIZE;
+			deflate(&stream, flush);
+			size_t n = GZIO_CHUNK_SIZE - stream.avail_out;
+			if (n && fwrite(out, 1, n, gz->file) != n) {
+				perror("File write error");
+				deflateEnd(&stream);
+				goto drain;
+			}
+		} while (!stream.avail_out);
+	} while (flush != Z_FINISH);
+	deflateEnd(&stream);
+	free(buffer);
+	free(out);
+	return EXIT_SUCCESS;
+
+drain:
+	free(buffer);
+	free(out);
+	char discard[256];
+	while (fread(discard, 1, sizeof(discard), in))
+		;
+	return status;
+}
+
+static gzio_t *gzio_new(FILE *file, int writing)
+{
+	gzio_t *gz = calloc(1, sizeof(gzio_t));
+	if (!gz) {
+		fprintf(stderr, "Out of memory!\n");
+		if (file != stdin && file != stdout)
+			fclose(file);
+		return NULL;
+	}
+	gz->file = file;
+	gz->writing = writing;
+	return gz;
+}
+
+static void gzio_free(gzio_t *gz)
+{
+	if (gz->file != stdin && gz->file != stdout)
+		fclose(gz->file);
+	free(gz->prefix);
+	free(gz);
+}
+
+#ifndef _WIN32
+static void *inflate_thread(void *arg)
+{
+	gzio_t *gz = arg;
+	gz->status = inflate_stream(gz, gz->pipe);
+	fclose(gz->pipe); /* The reader gets EOF */
+	return NULL;
+}
+
+static void *deflate_thread(void *arg)
+{
+	gzio_t *gz = arg;
+	gz->status = deflate_stream(gz, gz->pipe);
+	fclose(gz->pipe);
+	return NULL;
+}
+
+/* Connect the caller and the worker thread with a pipe */
+static int start_thread(gzio_t *gz)
+{
+	int fd[2];
+	if (pipe(fd)) {
+		perror("Can't create pipe");
+		return EXIT_FAILURE;
+	}
+	gz->stream = fdopen(fd[gz->writing], gz->writing ? "wb" : "rb");
+	gz->pipe = fdopen(fd[!gz->writing], gz->writing ? "rb" : "wb");
+	if (!gz->stream || !gz->pipe) {
+		perror("Can't create pipe");
+		if (gz->stream)
+			fclose(gz->stream);
+		else
+			close(fd[gz->writing]);
+		if (gz->pipe)
+			fclose(gz->pipe);
+		else
+			close(fd[!gz->writing]);
+		return EXIT_FAILURE;
+	}
+	if (pthread_create(&gz->thread, NULL,
+			   gz->writing ? deflate_thread : inflate_thread, gz)) {
+		fprintf(stderr, "Can't create the compression thread.\n");
+		fclose(gz->stream);
+		fclose(gz->pipe);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
+gzio_t *gzio_open_read(FILE *file, const uint8_t *prefix, size_t length)
+{
+	gzio_t *gz = gzio_new(file, 0);
+	if (!gz)
+		return NULL;
+	gz->prefix = malloc(length);
+	if (!gz->prefix) {
+		fprintf(stderr, "Out of memory!\n");
+		gzio_free(gz);
+		return NULL;
+	}
+	memcpy(gz->prefix, prefix, length);
+	gz->prefix_length = length;
+
+#ifndef _WIN32
+	if (start_thread(gz)) {
+		gzio_free(gz);
+		return NULL;
+	}
+#else
+	/* Decompress the whole file up front */
+	gz->stream = tmpfile();
+	if (!gz->stream) {
+		perror("Can't create temporary file");
+		gzio_free(gz);
+		return NULL;
+	}
+	gz->status = inflate_stream(gz, gz->stream);
+	gz->finished = 1;
+	rewind(gz->stream);
+#endif
+	return gz;
+}
+
+gzio_t *gzio_open_write(FILE *file, int level)
+{
+	gzio_t *gz = gzio_new(file, 1);
+	if (!gz)
+		return NULL;
+	gz->level = level ? level : Z_DEFAULT_COMPRESSION;
+
+#ifndef _WIN32
+	if (start_thread(gz)) {
+		gzio_free(gz);
+		return NULL;
+	}
+#else
+	/* Compressed when the stream is closed */
+	gz->stream = tmpfile();
+	if (!gz->stream) {
+		perror("Can't create temporary file");
+		gzio_free(gz);
+		return NULL;
+	}
+#endif
+	return gz;
+}
+
+/* Wait for the worker. A writer stream is flushed and closed first, a
+ * reader stream must have been read up to EOF. */
+int gzio_finish(gzio_t *gz)
+{
+	if (gz->finished)
+		return gz->status;
+	gz->finished = 1;
+
+#ifndef _WIN32
+	if (gz->writing) {
+		fclose(gz->stream);
+		gz->stream = NULL;
+	}
+	pthread_join(gz->thread, NULL);
+#else
+	rewind(gz->stream);
+	gz->status = deflate_stream(gz, gz->stream);
+	fclose(gz->stream);
+	gz->stream = NULL;
+#endif
+	return gz->status;
+}
+
+int gzio_close(gzio_t *gz)
+{
+	if (!gz)
+		return EXIT_SUCCESS;
+
+	/* Let the worker run to its end */
+	if (!gz->writing && !gz->finished) {
+		char discard[256];
+		while (fread(discard, 1, sizeof(discard), gz->stream))
+			;
+	}
+	int ret = gzio_finish(gz);
+	if (gz->stream)
+		fclose(gz->stream);
+
+	if (gz->writing && (fflush(gz->file) || ferror(gz->file))) {
+		if (!ret)
+			perror("File write error");
+		ret = EXIT_FAILURE;
+	}
+	gzio_free(gz);
+	return ret;
+}
@@ -0,0 +1,68 @@
+/*
+ * gzio.h - Compressed file streams declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef GZIO_H_
+#define GZIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define GZIO_CHUNK_SIZE 65536
+
+typedef struct gzio {
+	FILE *file; /* Compressed side */
+	FILE *stream; /* Uncompressed side */
+	FILE *pipe; /* Worker end of the pipe */
+	int writing;
+	int level;
+	uint8_t *prefix; /* Compressed data already read from file */
+	size_t prefix_length;
+	int status;
+	int finished;
+#ifndef _WIN32
+	pthread_t thread;
+#endif
+} gzio_t;
+
+/*
+ * A gzio stream puts gzip compression between a file and the plain
+ * stdio stream the file formats are read from or written to. The
+ * (de)compression runs on its own thread and the two sides are joined
+ * by a pipe, so it overlaps with the programmer I/O. Windows builds
+ * have no worker thread and go through a temporary file instead.
+ *
+ * The gzio stream owns the file and closes it unless it is stdin or
+ * stdout. A level of 0 selects the zlib default. gzio_close() returns
+ * the compression result, a failure is reported to stderr.
+ */
+gzio_t *gzio_open_read(FILE *file, const uint8_t *prefix, size_t length);
+gzio_t *gzio_open_write(FILE *file, int level);
+int gzio_finish(gzio_t *gz);
+int gzio_close(gzio_t *gz);
+
+static inline int is_gzip(const uint8_t *buffer, size_t length)
+{
+	return length >= 3 && buffer[0] == 0x1f && buffer[1] == 0x8b &&
+	       buffer[2] == 8;
+}
+
+#endif
@@ -23,7 +23,9 @@
 #include "ihex.h"
 
 #define MIN_RECORD_SIZE 11
+#define MAX_LINE_SIZE	(MIN_RECORD_SIZE + 255 * 2 + 2)
 #define ROW_SIZE	16
+#define OUT_BUFFER_SIZE 16384
 
 typedef enum {
 	IHEX_DATA = 0,
@@ -46,230 +48,362 @@ typedef struct {
 	uint16_t address;
 	uint8_t count;
 	Rectype type;
-	Result result;
 	uint8_t data[255];
 } record_t;
 
-/* Convert an ascii hex character */
-static uint8_t hex(const char hex)
+/* Hex digit values plus one, zero for anything else.
+ * hex_lut[c] - 1 is the digit value or 0xff for a bad character. */
+static const uint8_t hex_lut[256] = {
+	['0'] = 1,  ['1'] = 2,	['2'] = 3,  ['3'] = 4,	['4'] = 5,  ['5'] = 6,
+	['6'] = 7,  ['7'] = 8,	['8'] = 9,  ['9'] = 10, ['A'] = 11, ['B'] = 12,
+	['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16, ['a'] = 11, ['b'] = 12,
+	['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+/* Decode a pair of hex digits, returns -1 on a bad character */
+static inline int hex_byte(const uint8_t *p)
 {
-	if (hex >= '0' && hex <= '9')
-		return hex - '0';
-	else if (hex >= 'A' && hex <= 'F')
-		return hex - 'A' + 10;
-	else if (hex >= 'a' && hex <= 'f')
-		return hex - 'a' + 10;
-	else
-		return 0xff;
+	uint8_t h = hex_lut[p[0]] - 1;
+	uint8_t l = hex_lut[p[1]] - 1;
+	if ((h | l) > 0x0f)
+		return -1;
+	return (h << 4) | l;
 }
 
-/* Parse a record */
-static record_t parse_record(uint8_t *record)
+/* A short or broken record, the line ended too early or not */
+static Result bad_chars(const uint8_t *p)
 {
-	record_t rec;
-	size_t i;
+	return (*p == '\r' || *p == '\n' || !*p || p[1] == '\r' ||
+		p[1] == '\n' || !p[1]) ?
+		       BAD_COUNT :
+		       BAD_FORMAT;
+}
+
+/* Parse the record header: count, address and type */
+static Result parse_header(const uint8_t *record, record_t *rec)
+{
+	int count, address_h, address_l, type;
+
 	/* Check for start code */
-	if (record[0] != ':') {
-		rec.result = BAD_FORMAT;
-		return rec;
-	}
+	if (record[0] != ':')
+		return BAD_FORMAT;
 
-	/* Check for valid characters */
-	for (i = 1; record[i] != '\r' && record[i] != '\n'; i++) {
-		if (hex(record[i]) > 0x0F) {
-			rec.result = BAD_FORMAT;
-			return rec;
-		}
-	}
+	if ((count = hex_byte(&record[1])) < 0 ||
+	    (address_h = hex_byte(&record[3])) < 0 ||
+	    (address_l = hex_byte(&record[5])) < 0 ||
+	    (type = hex_byte(&record[7])) < 0)
+		return BAD_FORMAT;
 
-	/* Get the count field */
-	rec.count = (hex(record[1]) << 4) | hex(record[2]);
-	if (i < rec.count * 2 + MIN_RECORD_SIZE) {
-		rec.result = BAD_COUNT;
-		return rec;
-	}
+	rec->count = count;
+	rec->address = (address_h << 8) | address_l;
+	rec->type = type;
+	if (rec->type > IHEX_SLA)
+		return BAD_RECORD;
+	return NO_ERROR;
+}
 
-	/* Get the record address */
-	rec.address = (hex(record[3]) << 12) | (hex(record[4]) << 8) |
-		      (hex(record[5]) << 4) | hex(record[6]);
+/* Decode the data bytes straight into dest and check the checksum.
+ * All the record bytes including the checksum must add up to zero. */
+static Result parse_data(const uint8_t *record, record_t *rec, uint8_t *dest)
+{
+	const uint8_t *p = &record[9];
+	uint8_t checksum = rec->count + (rec->address >> 8) +
+			   (rec->address & 0xFF) + rec->type;
+	size_t i;
+	int value;
 
-	/* Get the record type */
-	rec.type = (hex(record[7]) << 4) | hex(record[8]);
-	if (rec.type > IHEX_SLA) {
-		rec.result = BAD_RECORD;
-		return rec;
+	for (i = 0; i < rec->count; i++, p += 2) {
+		if ((value = hex_byte(p)) < 0)
+			return bad_chars(p);
+		dest[i] = value;
+		checksum += value;
 	}
+	if ((value = hex_byte(p)) < 0)
+		return bad_chars(p);
+	if ((uint8_t)(checksum + value))
+		return BAD_CKECKSUM;
+	return NO_ERROR;
+}
 
-	/* Calculate checksum and copy data bytes */
-	uint8_t checksum_c = rec.count + (rec.address >> 8) +
-			     (rec.address & 0xFF) + rec.type;
-	for (i = 0; i < rec.count; i++) {
-		rec.data[i] = (hex(record[i * 2 + 9]) << 4) |
-			      hex(record[i * 2 + 10]);
-		checksum_c += rec.data[i];
-	}
-	checksum_c = ~checksum_c + 1;
-	uint8_t checksum_f = (hex(record[rec.count * 2 + 9]) << 4) |
-			     hex(record[rec.count * 2 + 10]);
-	if (checksum_c != checksum_f) {
-		rec.result = BAD_CKECKSUM;
-		return rec;
-	}
-	rec.result = NO_ERROR;
-	return rec;
+/* Output is collected here and written with large fwrite calls */
+typedef struct {
+	FILE *file;
+	size_t length;
+	int error;
+	char buffer[OUT_BUFFER_SIZE];
+} output_t;
+
+static void flush_output(output_t *out)
+{
+	if (out->length &&
+	    fwrite(out->buffer, 1, out->length, out->file) != out->length)
+		out->error = 1;
+	out->length = 0;
+}
+
+/* Encode a byte as two hex digits */
+static inline char *put_byte(char *p, uint8_t value)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	p[0] = digits[value >> 4];
+	p[1] = digits[value & 0x0f];
+	return p + 2;
 }
 
 /* Write a record */
-static int write_record(FILE *file, record_t *record)
+static void write_record(output_t *out, record_t *record)
 {
 	uint8_t checksum = record->count + (uint8_t)record->address +
 			   (uint8_t)(record->address >> 8) + record->type;
-	uint8_t *pData = record->data;
-	fprintf(file, ":%02X%04X%02X", record->count, record->address,
-		record->type);
-	while (record->count--) {
-		fprintf(file, "%02X", *pData);
-		checksum += *pData;
-		pData++;
+	size_t i;
+
+	if (out->length + MAX_LINE_SIZE > OUT_BUFFER_SIZE)
+		flush_output(out);
+	char *p = &out->buffer[out->length];
+	*p++ = ':';
+	p = put_byte(p, record->count);
+	p = put_byte(p, record->address >> 8);
+	p = put_byte(p, record->address);
+	p = put_byte(p, record->type);
+	for (i = 0; i < record->count; i++) {
+		p = put_byte(p, record->data[i]);
+		checksum += record->data[i];
 	}
-	checksum = ~checksum + 1;
-	fprintf(file, "%02X\r\n", checksum);
-	return EXIT_SUCCESS;
+	p = put_byte(p, ~checksum + 1);
+	*p++ = '\r';
+	*p++ = '\n';
+	out->length = p - out->buffer;
+}
+
+/* Copy the part of a record which falls inside the
+ * base..base + size window */
+static int copy_record(record_t *rec, uint32_t address, uint8_t *data,
+		       uint32_t base, size_t size, extents_t *extents)
+{
+	size_t first = address < base ? base - address : 0;
+	if (first >= rec->count || address + first - base >= size)
+		return EXIT_SUCCESS;
+	size_t count = rec->count - first;
+	if (address + first - base + count > size)
+		count = size - (address + first - base);
+	memcpy(&data[address + first - base], &rec->data[first], count);
+	return extents ? extents_add(extents, address + first - base, count) :
+			 EXIT_SUCCESS;
+}
+
+void ihex_reader_init(ihex_reader_t *reader, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents)
+{
+	memset(reader, 0, sizeof(ihex_reader_t));
+	reader->data = data;
+	reader->base = base;
+	reader->size = size;
+	reader->extents = extents;
 }
 
-/* Read an Intel hex file */
-int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size)
+/* Check if a record looks like Intel hex without loading anything */
+int ihex_probe(const uint8_t *record)
 {
-	uint32_t line = 0, uba = 0;
 	record_t rec;
-	uint8_t eof = 0;
+	if (parse_header(record, &rec) != NO_ERROR ||
+	    parse_data(record, &rec, rec.data) != NO_ERROR)
+		return NOT_IHEX;
+	return INTEL_HEX_FORMAT;
+}
 
-	size_t chip_size = *size;
-	while (buffer) {
-		/* Skip empty lines */
-		line++;
-		if (*buffer == '\r' || *buffer == '\n') {
-			buffer++;
-			continue;
+/* Parse one record. record points to the start code and the record
+ * must be followed by a line end or a null character. */
+int ihex_reader_record(ihex_reader_t *reader, const uint8_t *record)
+{
+	record_t rec;
+	Result result;
+
+	reader->line++;
+	reader->last_count = 0;
+	result = parse_header(record, &rec);
+	if (result == NO_ERROR) {
+		/* Data records inside the window are decoded in place */
+		uint8_t *dest = rec.data;
+		uint32_t address = reader->uba + rec.address;
+		if (rec.type == IHEX_DATA && !reader->eof &&
+		    address >= reader->base &&
+		    address - reader->base + rec.count <= reader->size)
+			dest = &reader->data[address - reader->base];
+		result = parse_data(record, &rec, dest);
+		reader->length = rec.count * 2 + MIN_RECORD_SIZE;
+		if (result == NO_ERROR && rec.type == IHEX_DATA) {
+			reader->last_address = (int64_t)address - reader->base;
+			reader->last_count = rec.count;
+		}
+		if (result == NO_ERROR && dest != rec.data) {
+			if (reader->extents &&
+			    extents_add(reader->extents, address - reader->base,
+					rec.count)) {
+				fprintf(stderr, "Out of memory!\n");
+				return EXIT_FAILURE;
+			}
+			return EXIT_SUCCESS;
 		}
+	}
 
-		rec = parse_record(buffer);
-		switch (rec.result) {
-		case BAD_FORMAT:
-			return NOT_IHEX;
-		case BAD_RECORD:
-			fprintf(stderr, "Error on line %u: bad record type.\n",
-				line);
-			return EXIT_FAILURE;
-		case BAD_COUNT:
-			fprintf(stderr, "Error on line %u: bad count.\n", line);
-			return EXIT_FAILURE;
-		case BAD_CKECKSUM:
-			fprintf(stderr, "Error on line %u: bad checksum.\n",
+	uint32_t line = reader->line;
+	switch (result) {
+	case BAD_FORMAT:
+		return NOT_IHEX;
+	case BAD_RECORD:
+		fprintf(stderr, "Error on line %u: bad record type.\n", line);
+		return EXIT_FAILURE;
+	case BAD_COUNT:
+		fprintf(stderr, "Error on line %u: bad count.\n", line);
+		return EXIT_FAILURE;
+	case BAD_CKECKSUM:
+		fprintf(stderr, "Error on line %u: bad checksum.\n", line);
+		return EXIT_FAILURE;
+	default:
+		if (rec.type != IHEX_EOF && reader->eof) {
+			fprintf(stderr,
+				"Error on line %u: wrong record after end of file .\n",
 				line);
-			return EXIT_FAILURE;
-		default:
-			if (rec.type != IHEX_EOF && eof) {
-				fprintf(stderr,
-					"Error on line %u: wrong record after end of file .\n",
-					line);
+		}
+		switch (rec.type) {
+		case IHEX_DATA:
+			/* Data outside of the chip is ignored */
+			if (copy_record(&rec, reader->uba + rec.address,
+					reader->data, reader->base,
+					reader->size, reader->extents)) {
+				fprintf(stderr, "Out of memory!\n");
+				return EXIT_FAILURE;
 			}
-			switch (rec.type) {
-			case IHEX_DATA:
-				/* If file data size is bigger than chip size
-				 * update the new size */
-				if (chip_size >= uba + rec.address + rec.count)
-					/* copy record data */
-					memcpy(&(data[uba + rec.address]),
-					       rec.data, rec.count);
-				/* else
-				 * *size = (uba + rec.address + rec.count);
-				 */
-				break;
-			case IHEX_EOF:
-				if (eof) {
-					fprintf(stderr,
-						"Error on line %u: wrong end of file record.\n",
-						line);
-					return EXIT_FAILURE;
-				}
-				eof = 1;
-				break;
-				/* Calculate the upper block address from a segment address */
-			case IHEX_ESA:
-				uba = ((rec.data[0] << 12) |
-				       (rec.data[1] << 4));
-				break;
-				/* Calculate the upper block address from an extended linear address */
-			case IHEX_ELA:
-				uba = ((rec.data[0] << 24) | rec.data[1] << 16);
-				break;
-				/* Load a segmented address */
-			case IHEX_SSA:
-				uba = ((rec.data[0] << 12) |
-				       (rec.data[1] << 4)) +
-				      ((rec.data[2] << 8) | rec.data[3]);
-				break;
-				/* Load a linear address */
-			case IHEX_SLA:
-				uba = ((rec.data[0] << 24) |
-				       (rec.data[1] << 16) |
-				       (rec.data[2] << 8) | rec.data[3]);
-				break;
-			default:
+			break;
+		case IHEX_EOF:
+			if (reader->eof) {
 				fprintf(stderr,
-					"Error on line %u: unknown record type.\n",
+					"Error on line %u: wrong end of file record.\n",
 					line);
 				return EXIT_FAILURE;
 			}
+			reader->eof = 1;
+			break;
+			/* Calculate the upper block address from a segment address */
+		case IHEX_ESA:
+			reader->uba =
+				((rec.data[0] << 12) | (rec.data[1] << 4));
+			break;
+			/* Calculate the upper block address from an extended linear address */
+		case IHEX_ELA:
+			reader->uba = ((rec.data[0] << 24) | rec.data[1] << 16);
+			break;
+			/* Load a segmented address */
+		case IHEX_SSA:
+			reader->uba =
+				((rec.data[0] << 12) | (rec.data[1] << 4)) +
+				((rec.data[2] << 8) | rec.data[3]);
+			break;
+			/* Load a linear address */
+		case IHEX_SLA:
+			reader->uba =
+				((rec.data[0] << 24) | (rec.data[1] << 16) |
+				 (rec.data[2] << 8) | rec.data[3]);
+			break;
+		default:
+			fprintf(stderr, "Error on line %u: unknown record type.\n",
+				line);
+			return EXIT_FAILURE;
 		}
-		buffer = (uint8_t *)strchr((char *)++buffer, ':');
 	}
-	if (!eof) {
+	return EXIT_SUCCESS;
+}
+
+/* Check that the file was complete */
+int ihex_reader_end(ihex_reader_t *reader)
+{
+	if (!reader->eof) {
 		fprintf(stderr, "Error: no end of file record found.\n");
 		return EXIT_FAILURE;
 	}
 	return INTEL_HEX_FORMAT;
 }
 
-/* Write an Intel hex file */
-int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
-		   int write_eof)
+/* Read an Intel hex file.
+ * Only data at base..base + size is loaded, relative to base.
+ * The loaded address ranges are added to extents if not NULL. */
+int read_hex_file(uint8_t *buffer, uint8_t *data, uint32_t base, size_t *size,
+		  extents_t *extents)
+{
+	ihex_reader_t reader;
+	int ret;
+
+	ihex_reader_init(&reader, data, base, *size, extents);
+	while (buffer) {
+		/* Skip empty lines */
+		if (*buffer == '\r' || *buffer == '\n') {
+			buffer++;
+			continue;
+		}
+
+		if ((ret = ihex_reader_record(&reader, buffer)))
+			return ret;
+		buffer += reader.length;
+		buffer = (uint8_t *)strchr((char *)buffer, ':');
+	}
+	return ihex_reader_end(&reader);
+}
+
+/* Write an Intel hex file.
+ * Data records hold row_size bytes, 0 selects the default of 16. */
+int write_hex_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
+		   size_t row_size, int write_eof)
 {
 	record_t rec;
-	uint16_t uba = 0;
+	uint16_t uba = address >> 16;
 	size_t len;
 
-	/* if size > 64K insert an extended linear address record */
+	output_t *out = malloc(sizeof(output_t));
+	if (!out) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	out->file = file;
+	out->length = 0;
+	out->error = 0;
+	if (!row_size || row_size > sizeof(rec.data))
+		row_size = ROW_SIZE;
+
+	/* if the data doesn't fit in the first 64K insert an extended linear
+	 * address record */
 	memset(rec.data, 0x00, sizeof(rec.data));
-	if (size > 65536) {
+	if (address + size > 65536) {
 		rec.type = IHEX_ELA;
 		rec.count = 0x02;
 		rec.address = 0x00;
-		write_record(file, &rec);
+		rec.data[0] = (uint8_t)(uba >> 8);
+		rec.data[1] = (uint8_t)uba;
+		write_record(out, &rec);
 	}
 
 	while (size) {
-		/* Write data */
-		len = (size > ROW_SIZE ? ROW_SIZE : size);
+		/* Write data, rows never cross a 64K boundary */
+		len = (size > row_size ? row_size : size);
+		if (len > 0x10000 - (address & 0xFFFF))
+			len = 0x10000 - (address & 0xFFFF);
 		rec.type = IHEX_DATA;
 		rec.count = len;
-		rec.address = address;
+		rec.address = (uint16_t)address;
 		memcpy(rec.data, data, len);
-		write_record(file, &rec);
-		data += ROW_SIZE;
+		write_record(out, &rec);
+		data += len;
 		size -= len;
-		address += ROW_SIZE;
+		address += len;
 
 		/* Insert an extended linear address record */
-		if (!address && size) {
+		if (!(address & 0xFFFF) && size) {
 			uba++;
 			rec.type = IHEX_ELA;
 			rec.count = 0x02;
 			rec.address = 0x00;
-			rec.data[0] = (uint8_t)uba << 8;
+			rec.data[0] = (uint8_t)(uba >> 8);
 			rec.data[1] = (uint8_t)uba;
-			write_record(file, &rec);
+			write_record(out, &rec);
 		}
 	}
 
@@ -278,7 +412,15 @@ int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
 		rec.type = IHEX_EOF;
 		rec.count = 0x00;
 		rec.address = 0x00;
-		write_record(file, &rec);
+		write_record(out, &rec);
+	}
+
+	flush_output(out);
+	int error = out->error;
+	free(out);
+	if (error) {
+		fprintf(stderr, "File write error!\n");
+		return EXIT_FAILURE;
 	}
 	return EXIT_SUCCESS;
 }
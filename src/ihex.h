@@ -20,12 +20,34 @@
 #define IHEX_H_
 
 #include <stdint.h>
+#include "extent.h"
 
 #define INTEL_HEX_FORMAT 0
 #define NOT_IHEX	 -1
 
-int read_hex_file(uint8_t *buffer, uint8_t *data, size_t *size);
-int write_hex_file(FILE *file, uint8_t *data, uint16_t address, size_t size,
-		   int write_eof);
+/* Incremental Intel hex reader, fed one record at a time */
+typedef struct ihex_reader {
+	uint8_t *data; /* Load window, data[0] is at address base */
+	uint32_t base;
+	size_t size;
+	extents_t *extents; /* Loaded address ranges, may be NULL */
+	uint32_t line;
+	uint32_t uba;
+	uint8_t eof;
+	size_t length; /* Characters of the last record */
+	int64_t last_address; /* Last data record, relative to base */
+	uint8_t last_count; /* Zero if the last record had no data */
+} ihex_reader_t;
+
+void ihex_reader_init(ihex_reader_t *reader, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents);
+int ihex_probe(const uint8_t *record);
+int ihex_reader_record(ihex_reader_t *reader, const uint8_t *record);
+int ihex_reader_end(ihex_reader_t *reader);
+
+int read_hex_file(uint8_t *buffer, uint8_t *data, uint32_t base, size_t *size,
+		  extents_t *extents);
+int write_hex_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
+		   size_t row_size, int write_eof);
 
 #endif
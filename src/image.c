@@ -0,0 +1,227 @@
+/*
+ * image.c - Multi-section image files.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "image.h"
+#include "minipro.h"
+
+/*
+ * Image file layout, all values are little endian.
+ *
+ * Header:
+ * |--------|------|---------------------------------------------|
+ * | Offset | Size | Data                                        |
+ * |--------|------|---------------------------------------------|
+ * | 0x00   | 8    | Magic "MPIMAGE1"                            |
+ * | 0x08   | 32   | Device name, zero padded                    |
+ * | 0x28   | 4    | Number of sections                          |
+ * | 0x2c   | 4    | CRC32 of the header bytes 0x00-0x2b and of  |
+ * |        |      | the section table                           |
+ * |--------|------|---------------------------------------------|
+ *
+ * Followed by the section table, one entry for each section:
+ * |--------|------|---------------------------------------------|
+ * | 0x00   | 4    | Section tag "CODE", "DATA", "USER" or "CONF"|
+ * | 0x04   | 4    | File offset of the section data             |
+ * | 0x08   | 4    | Section length                              |
+ * | 0x0c   | 4    | CRC32 of the section data                   |
+ * |--------|------|---------------------------------------------|
+ *
+ * The section data follows the table. Unknown sections are skipped.
+ */
+
+static const char *tags[IMAGE_SECTIONS] = { "CODE", "DATA", "USER", "CONF" };
+static const char *names[IMAGE_SECTIONS] = { "code", "data", "user",
+					     "config" };
+
+const char *image_section_name(int section)
+{
+	return names[section];
+}
+
+/* Image files are named .mpi, optionally compressed */
+int is_image_name(const char *filename)
+{
+	size_t length = strlen(filename);
+	if (length > 3 && !strcasecmp(filename + length - 3, ".gz"))
+		length -= 3;
+	return length > 4 && !strncasecmp(filename + length - 4, ".mpi", 4);
+}
+
+image_t *image_new(const char *device_name)
+{
+	image_t *image = calloc(1, sizeof(image_t));
+	if (!image) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	snprintf(image->device_name, sizeof(image->device_name), "%s",
+		 device_name);
+	return image;
+}
+
+/* Store a copy of the section data in an image from image_new */
+int image_set_section(image_t *image, int section, const uint8_t *data,
+		      size_t length)
+{
+	uint8_t *copy = malloc(length ? length : 1);
+	if (!copy) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	memcpy(copy, data, length);
+	free(image->sections[section].data);
+	image->sections[section].data = copy;
+	image->sections[section].length = length;
+	return EXIT_SUCCESS;
+}
+
+int image_write(FILE *file, const image_t *image)
+{
+	uint8_t header[IMAGE_HEADER_SIZE +
+		       IMAGE_SECTIONS * IMAGE_ENTRY_SIZE];
+	size_t i, count = 0;
+	uint32_t offset;
+
+	for (i = 0; i < IMAGE_SECTIONS; i++)
+		count += image->sections[i].data != NULL;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, IMAGE_MAGIC, 8);
+	memcpy(&header[8], image->device_name,
+	       strlen(image->device_name));
+	format_int(&header[0x28], count, 4, MP_LITTLE_ENDIAN);
+
+	uint8_t *entry = &header[IMAGE_HEADER_SIZE];
+	offset = IMAGE_HEADER_SIZE + count * IMAGE_ENTRY_SIZE;
+	for (i = 0; i < IMAGE_SECTIONS; i++) {
+		const image_section_t *section = &image->sections[i];
+		if (!section->data)
+			continue;
+		memcpy(entry, tags[i], 4);
+		format_int(&entry[4], offset, 4, MP_LITTLE_ENDIAN);
+		format_int(&entry[8], section->length, 4, MP_LITTLE_ENDIAN);
+		format_int(&entry[12],
+			   crc_32(section->data, section->length, 0xFFFFFFFF),
+			   4, MP_LITTLE_ENDIAN);
+		offset += section->length;
+		entry += IMAGE_ENTRY_SIZE;
+	}
+
+	/* The table CRC continues the header CRC */
+	uint32_t crc = crc_32(header, 0x2c, 0xFFFFFFFF);
+	crc = crc_32(&header[IMAGE_HEADER_SIZE], count * IMAGE_ENTRY_SIZE,
+		     crc);
+	format_int(&header[0x2c], crc, 4, MP_LITTLE_ENDIAN);
+
+	size_t length = entry - header;
+	if (fwrite(header, 1, length, file) != length) {
+		perror("File write error");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < IMAGE_SECTIONS; i++) {
+		const image_section_t *section = &image->sections[i];
+		if (section->data && fwrite(section->data, 1, section->length,
+					    file) != section->length) {
+			perror("File write error");
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Check an image file and set up its sections.
+ * The image takes the buffer over, also on failure. */
+image_t *image_parse(uint8_t *buffer, size_t length)
+{
+	size_t i, j;
+
+	if (!is_image(buffer, length) || length < IMAGE_HEADER_SIZE) {
+		fprintf(stderr, "This is not an image file.\n");
+		free(buffer);
+		return NULL;
+	}
+	size_t count = load_int(&buffer[0x28], 4, MP_LITTLE_ENDIAN);
+	if (count > IMAGE_MAX_ENTRIES ||
+	    length < IMAGE_HEADER_SIZE + count * IMAGE_ENTRY_SIZE) {
+		fprintf(stderr, "Bad image file header.\n");
+		free(buffer);
+		return NULL;
+	}
+	uint32_t crc = crc_32(buffer, 0x2c, 0xFFFFFFFF);
+	crc = crc_32(&buffer[IMAGE_HEADER_SIZE], count * IMAGE_ENTRY_SIZE,
+		     crc);
+	if (crc != load_int(&buffer[0x2c], 4, MP_LITTLE_ENDIAN)) {
+		fprintf(stderr, "Bad image file header.\n");
+		free(buffer);
+		return NULL;
+	}
+
+	char name[IMAGE_DEVICE_NAME_SIZE + 1] = { 0 };
+	memcpy(name, &buffer[8], IMAGE_DEVICE_NAME_SIZE);
+	image_t *image = image_new(name);
+	if (!image) {
+		free(buffer);
+		return NULL;
+	}
+	image->buffer = buffer;
+
+	for (i = 0; i < count; i++) {
+		uint8_t *entry =
+			&buffer[IMAGE_HEADER_SIZE + i * IMAGE_ENTRY_SIZE];
+		size_t offset = load_int(&entry[4], 4, MP_LITTLE_ENDIAN);
+		size_t size = load_int(&entry[8], 4, MP_LITTLE_ENDIAN);
+		if (offset > length || size > length - offset) {
+			fprintf(stderr, "Image section %.4s is truncated.\n",
+				entry);
+			image_free(image);
+			return NULL;
+		}
+		if (crc_32(&buffer[offset], size, 0xFFFFFFFF) !=
+		    load_int(&entry[12], 4, MP_LITTLE_ENDIAN)) {
+			fprintf(stderr, "Image section %.4s is corrupted.\n",
+				entry);
+			image_free(image);
+			return NULL;
+		}
+		for (j = 0; j < IMAGE_SECTIONS; j++) {
+			if (!memcmp(entry, tags[j], 4)) {
+				image->sections[j].data = &buffer[offset];
+				image->sections[j].length = size;
+			}
+		}
+	}
+	return image;
+}
+
+void image_free(image_t *image)
+{
+	size_t i;
+	if (!image)
+		return;
+	if (image->buffer)
+		free(image->buffer);
+	else {
+		for (i = 0; i < IMAGE_SECTIONS; i++)
+			free(image->sections[i].data);
+	}
+	free(image);
+}
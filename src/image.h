@@ -0,0 +1,75 @@
+/*
+ * image.h - Multi-section image file declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IMAGE_MAGIC	       "MPIMAGE1"
+#define IMAGE_HEADER_SIZE      48
+#define IMAGE_ENTRY_SIZE       16
+#define IMAGE_MAX_ENTRIES      16
+#define IMAGE_DEVICE_NAME_SIZE 32
+
+/* Section types */
+#define IMAGE_CODE     0
+#define IMAGE_DATA     1
+#define IMAGE_USER     2
+#define IMAGE_CONFIG   3
+#define IMAGE_SECTIONS 4
+
+typedef struct image_section {
+	uint8_t *data; /* NULL if the section is missing */
+	size_t length;
+} image_section_t;
+
+typedef struct image {
+	char device_name[IMAGE_DEVICE_NAME_SIZE + 1];
+	image_section_t sections[IMAGE_SECTIONS];
+	uint8_t *buffer; /* The loaded file, sections point into it */
+} image_t;
+
+/*
+ * An image file holds all the memory sections of a chip (code, data,
+ * user and the fuses text) together with the device name, so a chip is
+ * stored as one file. Every section has a CRC32.
+ */
+image_t *image_new(const char *device_name);
+int image_set_section(image_t *image, int section, const uint8_t *data,
+		      size_t length);
+int image_write(FILE *file, const image_t *image);
+image_t *image_parse(uint8_t *buffer, size_t length);
+void image_free(image_t *image);
+const char *image_section_name(int section);
+int is_image_name(const char *filename);
+
+static inline size_t image_max_size(size_t data_size)
+{
+	return IMAGE_HEADER_SIZE + IMAGE_MAX_ENTRIES * IMAGE_ENTRY_SIZE +
+	       data_size;
+}
+
+static inline int is_image(const uint8_t *buffer, size_t length)
+{
+	return length >= 8 && !memcmp(buffer, IMAGE_MAGIC, 8);
+}
+
+#endif
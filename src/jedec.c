@@ -17,6 +17,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,9 +29,15 @@
 #define STX	     0x02
 #define ETX	     0x03
 #define JED_MIN_SIZE 8
-#define JED_MAX_SIZE 1048576
 #define ROW_SIZE     32
 #define DELIMITER    '*'
+#define OUTPUT_SIZE  65536
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FAST_FUSES
+#endif
 
 typedef enum {
 	NO_ERROR,
@@ -39,272 +46,227 @@ typedef enum {
 	MEMORY_ERROR
 } Result;
 
-/* Parse uint32 value from char buffer */
-static int parse_uint32(const char *buffer, uint32_t *value, char **pEnd,
-			uint8_t radix)
+typedef struct parser {
+	const char *p; /* Current character */
+	const char *end;
+	uint16_t checksum; /* File checksum so far */
+} parser_t;
+
+/* Parse an uint32 value following a field name.
+ * Like strtoul the value may have leading white space. */
+static int parse_value(const char *buffer, uint32_t *value, char **pEnd,
+		       uint8_t radix)
 {
 	errno = 0;
 	char *p_end;
 	*value = strtoul(buffer, &p_end, radix);
 	if (pEnd != NULL)
 		*pEnd = p_end;
-	if (p_end == buffer)
+	if (p_end == buffer || errno)
 		return BAD_FORMAT;
-	return errno;
+	return NO_ERROR;
+}
+
+/* Move to the next field delimiter or the ETX, adding up the skipped
+ * characters to the file checksum. The delimiter is consumed too. */
+static void skip_field(parser_t *parser)
+{
+	const char *p = parser->p;
+	uint16_t checksum = parser->checksum;
+	while (p < parser->end && *p != DELIMITER && *p != ETX)
+		checksum += (uint8_t)*p++;
+	if (p < parser->end && *p == DELIMITER)
+		checksum += (uint8_t)*p++;
+	parser->p = p;
+	parser->checksum = checksum;
 }
+
+/* Store the 8 fuses in bits starting at fuse */
+static inline void put_fuse_byte(jedec_t *jedec, uint32_t fuse, uint8_t bits)
+{
+	size_t index = fuse >> 3, shift = fuse & 7;
+	if (!shift) {
+		jedec->fuses[index] = bits;
+		return;
+	}
+	jedec->fuses[index] = (jedec->fuses[index] & (0xff >> (8 - shift))) |
+			      bits << shift;
+	jedec->fuses[index + 1] =
+		(jedec->fuses[index + 1] & (0xff << shift)) |
+		bits >> (8 - shift);
+}
+
 /*
- This function will parse the numeric value of the given command.
- If found, will return the parsed value and a pointer after the last character
- parsed.
+ * Decode the '0' and '1' characters of an L field starting at fuse.
+ * Fuse rows may be split over several lines, the white space between
+ * the digits is skipped. Runs of 8 digits are decoded at once.
  */
-static int parse_token(const char *buffer, const char *token_name,
-		       size_t token_size, uint32_t *value, char **pEnd,
-		       uint8_t radix)
+static int parse_fuses(parser_t *parser, jedec_t *jedec, uint32_t fuse)
 {
-	/* Compare the first 'token_size' characters ignoring case. */
-	if (strncasecmp(buffer, token_name, token_size))
-		return TOKEN_NOT_FOUND;
-
-	/* If found parse the numeric value next to it */
-	if (!parse_uint32(buffer + token_size, value, pEnd, radix))
-		return NO_ERROR;
-	return BAD_FORMAT;
+	const char *p = parser->p, *end = parser->end;
+	uint16_t checksum = parser->checksum;
+
+	while (p < end && *p != DELIMITER) {
+#ifdef FAST_FUSES
+		uint64_t word;
+		if (end - p >= 8 && fuse < jedec->QF && jedec->QF - fuse >= 8) {
+			memcpy(&word, p, sizeof(word));
+			/* All of them '0' (0x30) or '1' (0x31)? */
+			if ((word & 0xfefefefefefefefeULL) ==
+			    0x3030303030303030ULL) {
+				word &= 0x0101010101010101ULL;
+				/* Gather the digit bits, digit k to bit k */
+				put_fuse_byte(jedec, fuse,
+					      (word * 0x0102040810204080ULL) >>
+						      56);
+				/* Eight times 0x30 plus the number of ones */
+				checksum += 0x180 +
+					    ((word * 0x0101010101010101ULL) >>
+					     56);
+				fuse += 8;
+				p += 8;
+				continue;
+			}
+		}
+#endif
+		if (*p == '0' || *p == '1') {
+			if (fuse >= jedec->QF)
+				return BAD_FORMAT;
+			jedec_set_fuse(jedec, fuse++, *p == '1');
+		} else if (*p != ' ' && !iscntrl((int)*p))
+			return BAD_FORMAT;
+		checksum += (uint8_t)*p++;
+	}
+	parser->p = p;
+	parser->checksum = checksum;
+	return NO_ERROR;
 }
 
 /*
  This function will parse each recognized jedec command found in the buffer.
  Supported commands: QP, QF, F, G, L, C
  It was adapted for most horrible formated jedec files i have found.
+ The file is parsed in a single pass, the file checksum is added up on
+ the way. Until a first valid field is found unknown fields are skipped,
+ this is where the design specification is.
  */
-static int parse_tokens(char *buffer, size_t buffer_size, jedec_t *jedec,
-			uint16_t *checksum)
+static int parse_tokens(const char *buffer, size_t buffer_size,
+			jedec_t *jedec)
 {
-	/* some state machine helpers */
 	uint8_t is_QP_set = 0;
 	uint8_t is_QF_set = 0;
 	uint8_t is_F_set = 0;
 	uint8_t is_G_set = 0;
 	uint8_t is_C_set = 0;
-	uint8_t is_initialized = 0;
 	uint8_t valid_token = 0;
 
-	uint32_t parsed_value;
-	uint16_t file_checksum;
-	size_t current_offset, stx_offset, stx_count, etx_count;
-	char *p_token, *p_next;
-
-	current_offset = 0;
-	stx_offset = 0;
-	stx_count = 0;
-	etx_count = 0;
-
-	/* short file analysis, search for STX offset. */
-	while (current_offset < buffer_size) {
-		if (buffer[current_offset] == STX) {
-			stx_count++;
-			stx_offset =
-				current_offset; /* save the STX offset found */
-		}
-		if (buffer[current_offset] == ETX)
-			etx_count++;
-		if (stx_count > 1 || etx_count > 1)
-			return BAD_FORMAT; /* Failed, must be a binary file */
-		current_offset++;
-	}
+	uint32_t value;
+	char *p_next;
+	const char *stx = memchr(buffer, STX, buffer_size);
+	const char *end = buffer + buffer_size;
 
-	current_offset = stx_offset; /* save the STX offset for latter usage */
-	if (!stx_count || !etx_count)
-		return BAD_FORMAT; /* No STX or ETX found */
-
-	/* Search for ETX offset, compute the file checksum. */
-	file_checksum = 0;
-	while (current_offset < buffer_size) {
-		file_checksum += buffer[current_offset];
-		if (buffer[current_offset] == ETX)
-			break;
-		current_offset++;
-	}
-
-	/* Parse the file checksum */
-	if (parse_uint32(&buffer[current_offset + 1], &parsed_value, &p_next,
-			 16))
-		return BAD_FORMAT;
-
-	/* The checksum must have 4 hex digits */
-	if (p_next - &buffer[current_offset + 1] != 4)
+	/* Exactly one STX followed by one ETX, else it is a binary file */
+	if (!stx || memchr(buffer, ETX, stx - buffer) ||
+	    memchr(stx + 1, STX, end - stx - 1))
 		return BAD_FORMAT;
 
-	/* Store both parsed and calculated file checksums. */
-	jedec->decl_file_checksum = parsed_value;
-	jedec->calc_file_checksum = file_checksum;
-
-	/* Parse each token in the buffer starting with STX offset. */
-	p_token = buffer + stx_offset;
-	while (p_token) {
-		/* Skip empty tokens */
-		if (!*p_token)
-			continue;
-
-		/* Skip non printable characters but ETX */
-		while (!isalpha((int)*p_token) && *p_token != ETX)
-			p_token++;
-
-		/* Exit the loop if the ETX character is found */
-		if (*p_token == ETX)
-			break;
-
-		/* Parse QP token */
-		switch (parse_token(p_token, "QP", 2, &parsed_value, NULL,
-				    10)) {
-		case NO_ERROR:
-			if (!is_QP_set) {
-				jedec->QP = parsed_value;
-				is_QP_set = 1;
-				valid_token = 1;
-			} else
-				return BAD_FORMAT;
+	parser_t parser = { .p = stx + 1, .end = end, .checksum = STX };
+	for (;;) {
+		/* Skip to the next field name */
+		while (parser.p < end && !isalpha((int)*parser.p) &&
+		       *parser.p != ETX)
+			parser.checksum += (uint8_t)*parser.p++;
+		if (parser.p == end)
+			return BAD_FORMAT; /* No ETX found */
+		if (*parser.p == ETX)
 			break;
-		case BAD_FORMAT:
-			if (!valid_token)
-				break;
-			return BAD_FORMAT;
-		}
 
-		/* Parse QF token */
-		switch (parse_token(p_token, "QF", 2, &parsed_value, NULL,
-				    10)) {
-		case NO_ERROR:
-			if (!is_QF_set) {
-				jedec->QF = parsed_value;
-				is_QF_set = 1;
-				valid_token = 1;
-			} else
-				return BAD_FORMAT;
+		const char *p = parser.p;
+		uint8_t *flag = NULL;
+		int ret = TOKEN_NOT_FOUND;
+		switch (toupper((int)p[0])) {
+		case 'Q':
+			if (toupper((int)p[1]) == 'P') {
+				flag = &is_QP_set;
+				ret = parse_value(p + 2, &value, NULL, 10);
+				jedec->QP = value;
+			} else if (toupper((int)p[1]) == 'F') {
+				flag = &is_QF_set;
+				ret = parse_value(p + 2, &value, NULL, 10);
+				jedec->QF = value;
+			}
 			break;
-		case BAD_FORMAT:
-			if (!valid_token)
-				break;
-			return BAD_FORMAT;
-		}
-
-		/* Parse G token */
-		switch (parse_token(p_token, "G", 1, &parsed_value, NULL, 10)) {
-		case NO_ERROR:
-			if (!is_G_set) {
-				jedec->G = parsed_value;
-				is_G_set = 1;
-				valid_token = 1;
-			} else
-				return BAD_FORMAT;
+		case 'G':
+			flag = &is_G_set;
+			ret = parse_value(p + 1, &value, NULL, 10);
+			jedec->G = value;
 			break;
-		case BAD_FORMAT:
-			if (!valid_token)
-				break;
-			return BAD_FORMAT;
-		}
-
-		/* Parse F token */
-		switch (parse_token(p_token, "F", 1, &parsed_value, NULL, 10)) {
-		case NO_ERROR:
-			if (!is_F_set) {
-				jedec->F = parsed_value;
-				is_F_set = 1;
-				valid_token = 1;
-			} else
-				return BAD_FORMAT;
+		case 'F':
+			flag = &is_F_set;
+			ret = parse_value(p + 1, &value, NULL, 10);
+			jedec->F = value;
 			break;
-		case BAD_FORMAT:
-			if (!valid_token)
-				break;
-			return BAD_FORMAT;
-		}
-
-		/* Parse C token */
-		switch (parse_token(p_token, "C", 1, &parsed_value, NULL, 16)) {
-		case NO_ERROR:
-			if (!is_C_set) {
-				jedec->C = parsed_value;
-				is_C_set = 1;
-				valid_token = 1;
-			} else
-				return BAD_FORMAT;
+		case 'C':
+			flag = &is_C_set;
+			ret = parse_value(p + 1, &value, NULL, 16);
+			jedec->C = value;
 			break;
-		case BAD_FORMAT:
-			if (!valid_token)
+		case 'L':
+			ret = parse_value(p + 1, &value, &p_next, 10);
+			if (ret == BAD_FORMAT)
 				break;
-			return BAD_FORMAT;
-		}
-
-		/* Parse L token */
-		switch (parse_token(p_token, "L", 1, &parsed_value, &p_next,
-				    10)) {
-		case NO_ERROR:
 			/* No 'L' allowed after C token or 'L' without a valid header */
 			if (is_C_set || !valid_token || !is_QF_set)
 				return BAD_FORMAT;
+			/* The start fuse must be inside the fuse map */
+			if (value >= jedec->QF)
+				return BAD_FORMAT;
 
-			if (!is_initialized) {
-
-				/* On first 'L' token found allocate
-			         * buffer and clear it with the default
-			         * 'F' value.
-				 * If no 'F' default fuse value
-			         * is set then the default will be 0.
-				 */
-				jedec->fuses = malloc(jedec->QF);
-				if (!jedec->fuses) {
-					return MEMORY_ERROR;
-				}
-				memset(jedec->fuses,
-				       is_F_set ?
-					       (jedec->F == 0 ? 0x00 : 0x01) :
-					       0,
-				       (jedec->QF));
-				is_initialized = 1;
-				*checksum = 0;
-			}
-
-			/* Some jed files have fuses divided on several lines.
-			 * So we need to skip line breaks characters and
-			 * extract only valid digits. For example: L0000<CR><LF>
-			 * 1111111111111111111111111111111111111111<CR><LF>
-			 * 1111111111111111111111110111111111011101<CR><LF>
-			 * 0000000000000000000000000000000000000000*<CR><LF>
-			 * We need to parse each line to get the entire
-			 * 120 bits row.
-			 */
-			while (*p_next != DELIMITER) {
-				if (!iscntrl((int)*p_next) && *p_next != ' ' &&
-				    *p_next != '0' && *p_next != '1')
-					return BAD_FORMAT;
-
-				if (*p_next == '0' || *p_next == '1') {
-					jedec->fuses[parsed_value] = 0;
-					if (*p_next == '1') {
-						jedec->fuses[parsed_value] = 1;
-						(*checksum) +=
-							(0x01 << (parsed_value &
-								  0x07));
-					}
-					parsed_value++;
-				}
-				p_next++;
-			}
+			/* On first 'L' token found allocate the fuse map
+			 * and clear it with the default 'F' value.
+			 * If no 'F' default fuse value is set then the
+			 * default will be 0. */
+			if (!jedec->fuses &&
+			    jedec_alloc_fuses(jedec, is_F_set && jedec->F))
+				return MEMORY_ERROR;
+
+			for (; parser.p < p_next; parser.p++)
+				parser.checksum += (uint8_t)*parser.p;
+			if (parse_fuses(&parser, jedec, value))
+				return BAD_FORMAT;
 			break;
-		case BAD_FORMAT:
+		}
+
+		if (ret == BAD_FORMAT && valid_token)
 			return BAD_FORMAT;
+		if (ret == NO_ERROR) {
+			if (flag && *flag)
+				return BAD_FORMAT; /* Set twice */
+			if (flag)
+				*flag = 1;
+			valid_token = 1;
 		}
-		p_token = strchr(p_token, DELIMITER);
-		if (p_token)
-			p_token++; /* Skip the delimiter character */
+		skip_field(&parser);
 	}
+
+	/* The file checksum includes the ETX and must have 4 hex digits */
+	parser.checksum += ETX;
+	const char *p = parser.p + 1;
+	if (memchr(p, ETX, end - p) || !isxdigit((int)*p) ||
+	    parse_value(p, &value, &p_next, 16) || p_next - p != 4)
+		return BAD_FORMAT;
+
+	/* Store both parsed and calculated file checksums. */
+	jedec->decl_file_checksum = value;
+	jedec->calc_file_checksum = parser.checksum;
 	return NO_ERROR;
 }
 
 /* JEDEC file parser */
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 {
-	uint16_t checksum = 0;
+	jedec->fuses = NULL;
+	jedec->QP = jedec->QF = jedec->F = jedec->G = jedec->C = 0;
 
 	/* Check for size limits */
 	if (size < JED_MIN_SIZE) {
@@ -313,9 +275,11 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 		return EXIT_FAILURE;
 	}
 
-	switch (parse_tokens(buffer, size, jedec, &checksum)) {
+	switch (parse_tokens(buffer, size, jedec)) {
 	case BAD_FORMAT:
 		fprintf(stderr, "JED file format error!\n");
+		free(jedec->fuses);
+		jedec->fuses = NULL;
 		free(buffer);
 		return EXIT_FAILURE;
 	case MEMORY_ERROR:
@@ -326,56 +290,238 @@ int read_jedec_file(char *buffer, size_t size, jedec_t *jedec)
 		break;
 	}
 
-	jedec->fuse_checksum = checksum;
+	/* The checksum covers the whole fuse map, listed or not */
+	if (jedec->fuses)
+		jedec->fuse_checksum = jedec_fuse_checksum(jedec);
 	return EXIT_SUCCESS;
 }
 
+typedef struct output {
+	FILE *file;
+	size_t length;
+	uint16_t checksum; /* File checksum of the flushed data */
+	int error;
+	char buffer[OUTPUT_SIZE];
+} output_t;
+
+static void flush_output(output_t *out)
+{
+	size_t i;
+	for (i = 0; i < out->length; i++)
+		out->checksum += (uint8_t)out->buffer[i];
+	if (!out->error &&
+	    fwrite(out->buffer, 1, out->length, out->file) != out->length)
+		out->error = 1;
+	out->length = 0;
+}
+
+/* Make room for length more characters */
+static inline char *reserve_output(output_t *out, size_t length)
+{
+	if (out->length + length > OUTPUT_SIZE)
+		flush_output(out);
+	return &out->buffer[out->length];
+}
+
+static void print_output(output_t *out, const char *format, ...)
+{
+	va_list args;
+	char *p = reserve_output(out, 512);
+	va_start(args, format);
+	int n = vsnprintf(p, OUTPUT_SIZE - out->length, format, args);
+	va_end(args);
+	if (n > 0)
+		out->length += MIN((size_t)n, OUTPUT_SIZE - out->length - 1);
+}
+
+/* The digits for 8 fuses, fuse 0 first */
+static const char *fuse_digits(uint8_t bits)
+{
+	static char digits[256][8];
+	static int initialized;
+	size_t i, j;
+	if (!initialized) {
+		for (i = 0; i < 256; i++)
+			for (j = 0; j < 8; j++)
+				digits[i][j] = '0' + ((i >> j) & 1);
+		initialized = 1;
+	}
+	return digits[bits];
+}
+
 /* JEDEC file writer */
 int write_jedec_file(FILE *file, jedec_t *jedec)
 {
-	uint16_t fuse_checksum = 0, file_checksum = 0;
-	size_t i;
+	uint32_t i, n;
 
-	char *buffer = malloc(JED_MAX_SIZE);
-	if (!buffer) {
+	output_t *out = malloc(sizeof(output_t));
+	if (!out) {
 		fprintf(stderr, "Out of memory!\n");
 		return EXIT_FAILURE;
 	}
-	char *p_buff = buffer;
+	out->file = file;
+	out->length = 0;
+	out->checksum = 0;
+	out->error = 0;
 
 	if (!jedec->device_name)
 		jedec->device_name = "Unknown";
 
 	/* Print jedec header */
-	p_buff += sprintf(
-		p_buff,
+	print_output(
+		out,
 		"%c\r\nDevice: %s\r\n\r\nNOTE: Written by Minipro open source"
 		" software v%s\r\n\r\n*QP%u\r\n*QF%u\r\n*F%u\r\n*G%u\r\n\r\n",
 		STX, jedec->device_name, VERSION, jedec->QP, jedec->QF,
 		jedec->F, jedec->G);
 
-	/* Print fuses */
-	for (i = 0; i < jedec->QF; i++) {
-		if ((i % ROW_SIZE) == 0)
-			p_buff += sprintf(p_buff, "%s*L%05u ",
-					  i ? (i % ROW_SIZE ? "" : "\r\n") : "",
-					  (uint32_t)i);
-		p_buff +=
-			sprintf(p_buff, "%c", jedec->fuses[i] == 1 ? '1' : '0');
-		fuse_checksum += jedec->fuses[i] == 1 ? (0x01 << (i & 0x07)) :
-							0;
+	/* Print fuses, rows start at a byte boundary */
+	for (i = 0; i < jedec->QF; i += ROW_SIZE) {
+		print_output(out, "%s*L%05u ", i ? "\r\n" : "", i);
+		char *p = reserve_output(out, ROW_SIZE);
+		for (n = 0; n < ROW_SIZE && i + n < jedec->QF; n += 8) {
+			memcpy(p + n, fuse_digits(jedec->fuses[(i + n) >> 3]),
+			       8);
+		}
+		out->length += MIN(ROW_SIZE, jedec->QF - i);
 	}
 
 	/* Print fuses checksum and ETX character */
-	p_buff += sprintf(p_buff, "\r\n*C%04X\r\n%c", fuse_checksum, ETX);
+	print_output(out, "\r\n*C%04X\r\n%c", jedec_fuse_checksum(jedec), ETX);
+
+	/* The file checksum runs up to the ETX */
+	flush_output(out);
+	print_output(out, "%04X\r\n", out->checksum);
+	flush_output(out);
+
+	int ret = out->error ? EXIT_FAILURE : EXIT_SUCCESS;
+	if (ret)
+		perror("File write error");
+	free(out);
+	return ret;
+}
 
-	/* Calculate the file checksum */
-	for (i = 0; i < p_buff - buffer; i++)
-		file_checksum += buffer[i];
+/* Allocate the fuse map with all fuses set to value */
+int jedec_alloc_fuses(jedec_t *jedec, uint8_t value)
+{
+	size_t size = JEDEC_FUSES_SIZE(jedec->QF);
+	jedec->fuses = malloc(size ? size : 1);
+	if (!jedec->fuses)
+		return EXIT_FAILURE;
+	memset(jedec->fuses, value ? 0xff : 0x00, size);
+	/* Keep the bits past the last fuse clear */
+	if (value && (jedec->QF & 7))
+		jedec->fuses[size - 1] = 0xff >> (8 - (jedec->QF & 7));
+	return EXIT_SUCCESS;
+}
 
-	sprintf(p_buff, "%04X\r\n", file_checksum);
+/* The JEDEC fuse checksum is the sum of the fuse map bytes.
+ * Eight bytes are summed at a time in four 16 bit lanes. */
+uint16_t jedec_fuse_checksum(const jedec_t *jedec)
+{
+	const uint64_t lanes = 0x00ff00ff00ff00ffULL;
+	size_t size = JEDEC_FUSES_SIZE(jedec->QF), i = 0;
+	uint64_t word, sum;
+	uint16_t checksum = 0;
+
+	while (size - i >= 8) {
+		/* Fold the lanes before they can overflow */
+		size_t end = i + MIN((size - i) & ~(size_t)7, 128 * 8);
+		for (sum = 0; i < end; i += 8) {
+			memcpy(&word, &jedec->fuses[i], sizeof(word));
+			sum += (word & lanes) + ((word >> 8) & lanes);
+		}
+		sum = (sum & 0xffff) + ((sum >> 16) & 0xffff) +
+		      ((sum >> 32) & 0xffff) + (sum >> 48);
+		checksum += sum;
+	}
+	for (; i < size; i++)
+		checksum += jedec->fuses[i];
+	return checksum;
+}
+
+/* Reverse the bit order of a byte */
+static inline uint8_t reverse_bits(uint8_t value)
+{
+	value = (value & 0xf0) >> 4 | (value & 0x0f) << 4;
+	value = (value & 0xcc) >> 2 | (value & 0x33) << 2;
+	return (value & 0xaa) >> 1 | (value & 0x55) << 1;
+}
+
+/* Read the 8 fuses starting at fuse, fuse + 1 in bit 1 and so on */
+static inline uint8_t get_fuse_byte(const jedec_t *jedec, size_t fuse,
+				    size_t count)
+{
+	size_t index = fuse >> 3, shift = fuse & 7;
+	uint16_t value = jedec->fuses[index];
+	if (shift + count > 8)
+		value |= jedec->fuses[index + 1] << 8;
+	return (value >> shift) & (0xff >> (8 - count));
+}
+
+/*
+ * Pack count fuses starting at first and stride apart into a device
+ * row, the first fuse goes to the MSB of row[0]. Rows of consecutive
+ * fuses are copied a byte at a time.
+ */
+void jedec_gather(const jedec_t *jedec, uint8_t *row, size_t first,
+		  size_t stride, size_t count)
+{
+	size_t i, j, n;
+	for (i = 0; i < count; i += 8, row++) {
+		n = MIN(count - i, 8);
+		if (stride == 1) {
+			*row = reverse_bits(get_fuse_byte(jedec, first + i, n));
+			continue;
+		}
+		uint8_t value = 0;
+		size_t fuse = first + i * stride;
+		for (j = 0; j < n; j++, fuse += stride)
+			value |= jedec_get_fuse(jedec, fuse) << (7 - j);
+		*row = value;
+	}
+}
 
-	fputs(buffer, file);
-	free(buffer);
+/* The opposite of jedec_gather */
+void jedec_scatter(jedec_t *jedec, const uint8_t *row, size_t first,
+		   size_t stride, size_t count)
+{
+	size_t i, j, n;
+	for (i = 0; i < count; i += 8, row++) {
+		n = MIN(count - i, 8);
+		size_t fuse = first + i * stride;
+		if (stride == 1 && !(fuse & 7) && n == 8) {
+			jedec->fuses[fuse >> 3] = reverse_bits(*row);
+			continue;
+		}
+		for (j = 0; j < n; j++, fuse += stride)
+			jedec_set_fuse(jedec, fuse, (*row >> (7 - j)) & 1);
+	}
+}
+
+/* Find the first fuse that differs, a byte at a time */
+int jedec_compare(const jedec_t *jedec1, const jedec_t *jedec2,
+		  uint32_t *fuse, uint8_t *value1, uint8_t *value2)
+{
+	size_t count = MIN(jedec1->QF, jedec2->QF);
+	size_t size = JEDEC_FUSES_SIZE(count), i;
+
+	for (i = 0; i < size; i++) {
+		uint8_t diff = jedec1->fuses[i] ^ jedec2->fuses[i];
+		if (i == size - 1 && (count & 7))
+			diff &= 0xff >> (8 - (count & 7));
+		if (!diff)
+			continue;
+		size_t bit = 0;
+		while (!(diff & (1 << bit)))
+			bit++;
+		if (fuse)
+			*fuse = i * 8 + bit;
+		if (value1)
+			*value1 = jedec_get_fuse(jedec1, i * 8 + bit);
+		if (value2)
+			*value2 = jedec_get_fuse(jedec2, i * 8 + bit);
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
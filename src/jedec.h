@@ -19,22 +19,55 @@
 #ifndef JEDEC_H_
 #define JEDEC_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define JED_MAX_SIZE 8388608 /* Largest JED file read */
+
 typedef struct jedec_s {
 	const char *device_name;     /* Device name */
 	uint8_t F;		     /* Unlisted fuses value (0-1) */
 	uint8_t G;		     /* Security Fuse */
-	uint16_t QF;		     /* How many fuses in the JEDEC file are */
+	uint32_t QF;		     /* How many fuses in the JEDEC file are */
 	uint8_t QP;		     /* Number of pins */
 	uint16_t C;		     /* declared fuses checksum */
 	uint16_t fuse_checksum;	     /* calculated fuses checksum */
 	uint16_t calc_file_checksum; /* calculated file checksum */
 	uint16_t decl_file_checksum; /* declared file checksum */
-	uint8_t *fuses;		     /* Fuses array */
+	uint8_t *fuses;		     /* Fuses bitmap, see below */
 } jedec_t;
 
+/*
+ * The fuses are packed eight to a byte, fuse n is bit (n & 7) of byte
+ * n / 8. This is the layout of the JEDEC fuse checksum, which is then
+ * just the sum of the bytes. Bits past QF are always zero.
+ */
+#define JEDEC_FUSES_SIZE(qf) (((size_t)(qf) + 7) / 8)
+
+static inline uint8_t jedec_get_fuse(const jedec_t *jedec, size_t fuse)
+{
+	return (jedec->fuses[fuse >> 3] >> (fuse & 7)) & 1;
+}
+
+static inline void jedec_set_fuse(jedec_t *jedec, size_t fuse, uint8_t value)
+{
+	uint8_t mask = 1 << (fuse & 7);
+	if (value)
+		jedec->fuses[fuse >> 3] |= mask;
+	else
+		jedec->fuses[fuse >> 3] &= ~mask;
+}
+
 int read_jedec_file(char *buffer, size_t size, jedec_t *jedec);
 int write_jedec_file(FILE *file, jedec_t *jedec);
 
+int jedec_alloc_fuses(jedec_t *jedec, uint8_t value);
+uint16_t jedec_fuse_checksum(const jedec_t *jedec);
+void jedec_gather(const jedec_t *jedec, uint8_t *row, size_t first,
+		  size_t stride, size_t count);
+void jedec_scatter(jedec_t *jedec, const uint8_t *row, size_t first,
+		   size_t stride, size_t count);
+int jedec_compare(const jedec_t *jedec1, const jedec_t *jedec2,
+		  uint32_t *fuse, uint8_t *value1, uint8_t *value2);
+
 #endif /* JEDEC_H_ */
@@ -0,0 +1,245 @@
+/*
+ * journal.c - Resumable read/write journal.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "minipro.h"
+
+#define JOURNAL_MAGIC	    "MPJRNL01"
+#define JOURNAL_HEADER_SIZE 36
+#define JOURNAL_RECORD_SIZE 12
+
+/*
+ * Journal file layout, all values are little endian.
+ *
+ * Header:
+ * |--------|------|---------------------------------------------|
+ * | Offset | Size | Data                                        |
+ * |--------|------|---------------------------------------------|
+ * | 0x00   | 8    | Magic "MPJRNL01"                            |
+ * | 0x08   | 1    | Operation 'R' or 'W'                        |
+ * | 0x09   | 1    | Page type (MP_CODE, MP_DATA, MP_USER)       |
+ * | 0x0a   | 2    | Unused                                      |
+ * | 0x0c   | 4    | Block size                                  |
+ * | 0x10   | 4    | Total size                                  |
+ * | 0x14   | 4    | CRC32 of the input data (writes only)       |
+ * | 0x18   | 4    | CRC32 of the device name                    |
+ * | 0x1c   | 4    | Start address of the range                  |
+ * | 0x20   | 4    | CRC32 of the header bytes 0x00-0x1f         |
+ * |--------|------|---------------------------------------------|
+ *
+ * Followed by one record for each completed block:
+ * |--------|------|---------------------------------------------|
+ * | 0x00   | 4    | Block number                                |
+ * | 0x04   | 4    | Block length                                |
+ * | 0x08   | 4    | CRC32 of the block data                     |
+ * | 0x0c   | n    | Block data (reads only)                     |
+ * |--------|------|---------------------------------------------|
+ */
+
+static void make_header(uint8_t *header, const char *device_name,
+			uint8_t operation, uint8_t type, uint32_t start,
+			uint8_t *data, size_t size, size_t block_size)
+{
+	memset(header, 0, JOURNAL_HEADER_SIZE);
+	memcpy(header, JOURNAL_MAGIC, 8);
+	header[8] = operation;
+	header[9] = type;
+	format_int(&header[12], block_size, 4, MP_LITTLE_ENDIAN);
+	format_int(&header[16], size, 4, MP_LITTLE_ENDIAN);
+	if (operation == JOURNAL_WRITE)
+		format_int(&header[20], crc_32(data, size, 0xFFFFFFFF), 4,
+			   MP_LITTLE_ENDIAN);
+	format_int(&header[24],
+		   crc_32((uint8_t *)device_name, strlen(device_name),
+			  0xFFFFFFFF),
+		   4, MP_LITTLE_ENDIAN);
+	format_int(&header[28], start, 4, MP_LITTLE_ENDIAN);
+	format_int(&header[32], crc_32(header, 32, 0xFFFFFFFF), 4,
+		   MP_LITTLE_ENDIAN);
+}
+
+/* Load the completed blocks of a previous run.
+ * Stops at the first damaged or truncated record. */
+static void load_records(journal_t *journal, uint8_t *data, size_t size)
+{
+	uint8_t record[JOURNAL_RECORD_SIZE];
+	uint8_t *block = malloc(journal->block_size);
+	long good = JOURNAL_HEADER_SIZE;
+
+	if (!block)
+		return;
+	while (fread(record, 1, sizeof(record), journal->file) ==
+	       sizeof(record)) {
+		size_t index = load_int(&record[0], 4, MP_LITTLE_ENDIAN);
+		size_t length = load_int(&record[4], 4, MP_LITTLE_ENDIAN);
+		uint32_t crc = load_int(&record[8], 4, MP_LITTLE_ENDIAN);
+		size_t offset = index * journal->block_size;
+
+		if (index >= journal->blocks_count ||
+		    length > journal->block_size || offset + length > size)
+			break;
+
+		if (journal->operation == JOURNAL_READ) {
+			if (fread(block, 1, length, journal->file) != length ||
+			    crc_32(block, length, 0xFFFFFFFF) != crc)
+				break;
+			memcpy(data + offset, block, length);
+		} else if (crc_32(data + offset, length, 0xFFFFFFFF) != crc) {
+			break;
+		}
+
+		if (!journal->done[index])
+			journal->resumed++;
+		journal->done[index] = 1;
+		good = ftell(journal->file);
+	}
+	free(block);
+
+	/* Append new records after the last good one */
+	fseek(journal->file, good, SEEK_SET);
+}
+
+/* The code page uses the journal path itself, the other pages get a
+ * file of their own so a multi page job can resume at any page */
+static char *page_path(const char *path, uint8_t type)
+{
+	const char *suffix = type == MP_DATA ? ".data" :
+			     type == MP_USER ? ".user" :
+					       "";
+	char *name = malloc(strlen(path) + strlen(suffix) + 1);
+	if (name)
+		sprintf(name, "%s%s", path, suffix);
+	return name;
+}
+
+journal_t *journal_open(const char *path, const char *device_name,
+			uint8_t operation, uint8_t type, uint32_t start,
+			uint8_t *data, size_t size, size_t block_size)
+{
+	uint8_t header[JOURNAL_HEADER_SIZE], old[JOURNAL_HEADER_SIZE];
+
+	journal_t *journal = calloc(1, sizeof(journal_t));
+	if (!journal) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	journal->operation = operation;
+	journal->block_size = block_size;
+	journal->blocks_count = (size + block_size - 1) / block_size;
+	journal->done = calloc(1, journal->blocks_count);
+	journal->path = page_path(path, type);
+	if (!journal->done || !journal->path) {
+		fprintf(stderr, "Out of memory!\n");
+		journal_close(journal, 0);
+		return NULL;
+	}
+
+	make_header(header, device_name, operation, type, start, data, size,
+		    block_size);
+
+	/* Resume if the journal belongs to this very operation */
+	journal->file = fopen(journal->path, "r+b");
+	if (journal->file) {
+		if (fread(old, 1, sizeof(old), journal->file) == sizeof(old) &&
+		    !memcmp(old, header, sizeof(header))) {
+			load_records(journal, data, size);
+			if (journal->resumed)
+				fprintf(stderr,
+					"Resuming from journal, %zu of %zu blocks done.\n",
+					journal->resumed,
+					journal->blocks_count);
+			return journal;
+		}
+		fclose(journal->file);
+		fprintf(stderr, "Discarding stale journal %s\n", journal->path);
+	}
+
+	/* Start a new journal */
+	journal->file = fopen(journal->path, "w+b");
+	if (!journal->file ||
+	    fwrite(header, 1, sizeof(header), journal->file) !=
+		    sizeof(header) ||
+	    fflush(journal->file)) {
+		fprintf(stderr, "Could not create journal %s\n",
+			journal->path);
+		perror("");
+		journal_close(journal, 0);
+		return NULL;
+	}
+	return journal;
+}
+
+/* Record a completed block. The record is flushed to the disk before
+ * returning so it survives a crash or power loss. */
+int journal_commit(journal_t *journal, size_t block, uint8_t *data,
+		   size_t length)
+{
+	uint8_t record[JOURNAL_RECORD_SIZE];
+
+	if (!journal)
+		return EXIT_SUCCESS;
+
+	format_int(&record[0], block, 4, MP_LITTLE_ENDIAN);
+	format_int(&record[4], length, 4, MP_LITTLE_ENDIAN);
+	format_int(&record[8], crc_32(data, length, 0xFFFFFFFF), 4,
+		   MP_LITTLE_ENDIAN);
+	if (fwrite(record, 1, sizeof(record), journal->file) != sizeof(record))
+		return EXIT_FAILURE;
+	if (journal->operation == JOURNAL_READ &&
+	    fwrite(data, 1, length, journal->file) != length)
+		return EXIT_FAILURE;
+	if (fflush(journal->file))
+		return EXIT_FAILURE;
+#ifndef _WIN32
+	fsync(fileno(journal->file));
+#endif
+	journal->done[block] = 1;
+	return EXIT_SUCCESS;
+}
+
+/* Close the journal, it is only needed anymore if the operation
+ * didn't complete. */
+void journal_close(journal_t *journal, int completed)
+{
+	if (!journal)
+		return;
+	if (journal->file) {
+		fclose(journal->file);
+		if (completed)
+			remove(journal->path);
+	}
+	free(journal->done);
+	free(journal->path);
+	free(journal);
+}
+
+/* Remove the journals of all pages once the whole job is done */
+void journal_remove(const char *path)
+{
+	static const uint8_t types[] = { MP_CODE, MP_DATA, MP_USER };
+	for (size_t i = 0; i < sizeof(types); i++) {
+		char *name = page_path(path, types[i]);
+		if (name)
+			remove(name);
+		free(name);
+	}
+}
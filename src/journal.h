@@ -0,0 +1,62 @@
+/*
+ * journal.h - Resumable read/write journal declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define JOURNAL_READ  'R'
+#define JOURNAL_WRITE 'W'
+
+typedef struct journal {
+	FILE *file;
+	char *path;
+	uint8_t operation;
+	size_t block_size;
+	size_t blocks_count;
+	uint8_t *done; /* One flag per block */
+	size_t resumed; /* Blocks restored from a previous run */
+} journal_t;
+
+/*
+ * The journal records every completed block of a read or write
+ * together with its CRC (and for reads the data itself), so an
+ * interrupted operation can be resumed with the same command line.
+ * The journal file is discarded if it belongs to another device, page,
+ * address range, block layout or (for writes) input data.
+ *
+ * For reads the restored blocks are copied back into the data buffer.
+ * Each page has its own journal file, the code page uses the path as
+ * given and the data and user pages append ".data" and ".user".
+ */
+journal_t *journal_open(const char *path, const char *device_name,
+			uint8_t operation, uint8_t type, uint32_t start,
+			uint8_t *data, size_t size, size_t block_size);
+int journal_commit(journal_t *journal, size_t block, uint8_t *data,
+		   size_t length);
+void journal_close(journal_t *journal, int completed);
+void journal_remove(const char *path);
+
+static inline int journal_done(journal_t *journal, size_t block)
+{
+	return journal && block < journal->blocks_count &&
+	       journal->done[block];
+}
+
+#endif
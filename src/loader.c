@@ -0,0 +1,436 @@
+/*
+ * loader.c - Incremental image file loader.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "elf.h"
+#include "loader.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static const struct {
+	const char *extension;
+	int format;
+} extensions[] = {
+	{ ".hex", LOADER_IHEX },   { ".ihx", LOADER_IHEX },
+	{ ".ihex", LOADER_IHEX },  { ".mcs", LOADER_IHEX },
+	{ ".srec", LOADER_SREC },  { ".s19", LOADER_SREC },
+	{ ".s28", LOADER_SREC },   { ".s37", LOADER_SREC },
+	{ ".mot", LOADER_SREC },   { ".elf", LOADER_ELF },
+	{ ".axf", LOADER_ELF },	   { ".bin", LOADER_BINARY },
+	{ ".rom", LOADER_BINARY }, { ".raw", LOADER_BINARY },
+	{ ".mpi", LOADER_BINARY },
+};
+
+/* Nonzero if the file name ends in .gz */
+int loader_gzip_name(const char *filename)
+{
+	size_t length = strlen(filename);
+	return length > 3 && !strcasecmp(filename + length - 3, ".gz");
+}
+
+/* Guess the format from the file name, a .gz suffix is skipped */
+int loader_guess_format(const char *filename)
+{
+	size_t i, length = strlen(filename);
+	if (loader_gzip_name(filename))
+		length -= 3;
+
+	for (i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+		size_t n = strlen(extensions[i].extension);
+		if (length > n && !strncasecmp(filename + length - n,
+					       extensions[i].extension, n))
+			return extensions[i].format;
+	}
+	return LOADER_AUTO;
+}
+
+/* Pick the decoder from the start of the file. Only the ELF magic and
+ * the first line are looked at, the expected format is tried first. */
+static int detect_format(loader_t *loader, int expected)
+{
+	uint8_t *p = loader->chunk, *end = p + loader->pending;
+	if (expected == LOADER_BINARY)
+		return LOADER_BINARY;
+	if (is_elf(p, loader->pending))
+		return LOADER_ELF;
+	while (p < end && (*p == '\r' || *p == '\n' || *p == ' ' || *p == '\t'))
+		p++;
+
+	/* Records are short, a long first line means binary data */
+	if (!memchr(p, '\n', MIN(end - p, LOADER_MAX_LINE)) &&
+	    (!loader->eof || end - p > LOADER_MAX_LINE))
+		return LOADER_BINARY;
+	if (expected == LOADER_SREC && *p == 'S' &&
+	    srec_probe(p) == SREC_FORMAT)
+		return LOADER_SREC;
+	if (*p == ':' && ihex_probe(p) == INTEL_HEX_FORMAT)
+		return LOADER_IHEX;
+	if (*p == 'S' && srec_probe(p) == SREC_FORMAT)
+		return LOADER_SREC;
+	return LOADER_BINARY;
+}
+
+/* Feed one hex record to the reader and track the loaded data */
+static int parse_record(loader_t *loader, const uint8_t *record)
+{
+	int64_t address;
+	uint32_t line;
+	uint8_t count;
+	int ret;
+
+	if (loader->format == LOADER_IHEX) {
+		ret = ihex_reader_record(&loader->ihex, record);
+		address = loader->ihex.last_address;
+		count = loader->ihex.last_count;
+		line = loader->ihex.line;
+	} else {
+		ret = srec_reader_record(&loader->srec, record);
+		address = loader->srec.last_address;
+		count = loader->srec.last_count;
+		line = loader->srec.line;
+	}
+	if (ret == NOT_IHEX || ret == NOT_SREC) {
+		fprintf(stderr, "Error on line %u: bad format.\n", line);
+		return EXIT_FAILURE;
+	}
+	if (ret || !count)
+		return ret;
+
+	/* The data before consumed may already be programmed */
+	if (address < (int64_t)loader->consumed && address + count > 0 &&
+	    address < (int64_t)loader->size) {
+		fprintf(stderr,
+			"Error on line %u: record out of address order, can't program while reading the file.\n",
+			line);
+		return EXIT_FAILURE;
+	}
+	if (address > (int64_t)loader->ready)
+		loader->ready = MIN((size_t)address, loader->size);
+	return EXIT_SUCCESS;
+}
+
+/* Parse all the complete lines in the chunk.
+ * A partial line is kept for the next chunk unless this is the last. */
+static int parse_lines(loader_t *loader)
+{
+	uint8_t *p = loader->chunk, *end = p + loader->pending;
+	uint8_t start_code = loader->format == LOADER_IHEX ? ':' : 'S';
+
+	while (p < end) {
+		uint8_t *nl = memchr(p, '\n', end - p);
+		if (!nl) {
+			if (!loader->eof)
+				break;
+			nl = end;
+		}
+		uint8_t *record = memchr(p, start_code, nl - p);
+		if (record && parse_record(loader, record))
+			return EXIT_FAILURE;
+		p = nl + 1;
+	}
+
+	size_t left = p < end ? end - p : 0;
+	if (left > LOADER_MAX_LINE) {
+		fprintf(stderr, "Error: line too long.\n");
+		return EXIT_FAILURE;
+	}
+	memmove(loader->chunk, p, left);
+	loader->pending = left;
+	return EXIT_SUCCESS;
+}
+
+/* Copy binary data from the chunk into the window */
+static int copy_binary(loader_t *loader, uint8_t *buffer, size_t length)
+{
+	size_t offset = loader->file_size;
+	loader->file_size += length;
+	if (offset >= loader->size)
+		return EXIT_SUCCESS;
+
+	length = MIN(length, loader->size - offset);
+	if (buffer != &loader->data[offset])
+		memcpy(&loader->data[offset], buffer, length);
+	loader->ready = offset + length;
+	if (loader->extents && extents_add(loader->extents, offset, length)) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Read from the file, a short read means EOF */
+static int read_data(loader_t *loader, uint8_t *buffer, size_t length,
+		     size_t *n)
+{
+	*n = fread(buffer, 1, length, loader->file);
+	if (*n < length) {
+		if (ferror(loader->file)) {
+			perror("File read error");
+			return EXIT_FAILURE;
+		}
+		/* A gzip error shows up as an early EOF */
+		if (loader->gz && gzio_finish(loader->gz))
+			return EXIT_FAILURE;
+		loader->eof = 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+#ifndef _WIN32
+/* Map a regular file, NULL if it can't be mapped */
+static uint8_t *map_file(FILE *file, size_t *length)
+{
+	struct stat st;
+	if (file == stdin || fstat(fileno(file), &st) || !S_ISREG(st.st_mode) ||
+	    !st.st_size)
+		return NULL;
+	void *image =
+		mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		     fileno(file), 0);
+	if (image == MAP_FAILED)
+		return NULL;
+	*length = st.st_size;
+	return image;
+}
+#endif
+
+/* Read the rest of a stream after the first chunk into memory */
+static uint8_t *read_file(loader_t *loader, size_t *length)
+{
+	size_t capacity = loader->pending, n;
+	uint8_t *image = malloc(capacity);
+	if (!image) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	memcpy(image, loader->chunk, loader->pending);
+	*length = loader->pending;
+	while (!loader->eof) {
+		if (*length == capacity) {
+			uint8_t *p = realloc(image, capacity * 2);
+			if (!p) {
+				fprintf(stderr, "Out of memory!\n");
+				free(image);
+				return NULL;
+			}
+			image = p;
+			capacity *= 2;
+		}
+		if (read_data(loader, &image[*length], capacity - *length,
+			      &n)) {
+			free(image);
+			return NULL;
+		}
+		*length += n;
+	}
+	return image;
+}
+
+/* Load a whole ELF file, the segments are not in any address order */
+static int load_elf(loader_t *loader)
+{
+	uint8_t *image = NULL;
+	size_t length;
+	int ret;
+
+#ifndef _WIN32
+	image = map_file(loader->file, &length);
+	if (image) {
+		loader->eof = 1;
+		ret = read_elf_file(image, length, loader->data, loader->base,
+				    loader->size, loader->extents);
+		munmap(image, length);
+	} else
+#endif
+	{
+		image = read_file(loader, &length);
+		if (!image)
+			return EXIT_FAILURE;
+		ret = read_elf_file(image, length, loader->data, loader->base,
+				    loader->size, loader->extents);
+		free(image);
+	}
+	if (ret == NOT_ELF) {
+		fprintf(stderr, "Bad ELF file.\n");
+		return EXIT_FAILURE;
+	}
+	if (ret)
+		return EXIT_FAILURE;
+	loader->pending = 0;
+	loader->file_size = loader->size;
+	loader->ready = loader->size;
+	return EXIT_SUCCESS;
+}
+
+/* Process the data read so far */
+static int process_chunk(loader_t *loader)
+{
+	if (loader->format == LOADER_BINARY) {
+		int ret = copy_binary(loader, loader->chunk, loader->pending);
+		loader->pending = 0;
+		if (ret)
+			return EXIT_FAILURE;
+	} else if (parse_lines(loader))
+		return EXIT_FAILURE;
+
+	if (!loader->eof)
+		return EXIT_SUCCESS;
+
+	/* Everything is known now */
+	loader->ready = loader->size;
+	switch (loader->format) {
+	case LOADER_IHEX:
+		loader->file_size = loader->size;
+		return ihex_reader_end(&loader->ihex);
+	case LOADER_SREC:
+		loader->file_size = loader->srec.file_size;
+		break;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Read the next chunk */
+static int read_chunk(loader_t *loader)
+{
+	uint8_t *buffer = &loader->chunk[loader->pending];
+	size_t length = LOADER_CHUNK_SIZE;
+
+	/* Binary data inside the window is read in place */
+	if (loader->format == LOADER_BINARY &&
+	    loader->file_size < loader->size) {
+		buffer = &loader->data[loader->file_size];
+		length = MIN(length, loader->size - loader->file_size);
+	}
+
+	size_t n;
+	if (read_data(loader, buffer, length, &n))
+		return EXIT_FAILURE;
+
+	if (buffer != &loader->chunk[loader->pending])
+		return copy_binary(loader, buffer, n) ||
+		       (loader->eof && process_chunk(loader));
+	loader->pending += n;
+	loader->chunk[loader->pending] = 0;
+	return process_chunk(loader);
+}
+
+loader_t *loader_open(FILE *file, int format, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents)
+{
+	loader_t *loader = malloc(sizeof(loader_t));
+	if (!loader) {
+		fprintf(stderr, "Out of memory!\n");
+		if (file != stdin)
+			fclose(file);
+		return NULL;
+	}
+	memset(loader, 0, offsetof(loader_t, chunk));
+
+	/* Look for the gzip magic only if the file may be compressed */
+	int gzip = format == LOADER_AUTO || (format & LOADER_GZIP);
+	if (format != LOADER_AUTO)
+		format &= ~LOADER_GZIP;
+
+	loader->file = file;
+	loader->data = data;
+	loader->base = base;
+	loader->size = size;
+	loader->extents = extents;
+	ihex_reader_init(&loader->ihex, data, base, size, extents);
+	srec_reader_init(&loader->srec, data, base, size, extents);
+
+	/* The first chunk decides the format */
+	if (read_data(loader, loader->chunk, LOADER_CHUNK_SIZE,
+		      &loader->pending)) {
+		loader_close(loader);
+		return NULL;
+	}
+
+	/* Start over with the decompressed data */
+	if (gzip && is_gzip(loader->chunk, loader->pending)) {
+		loader->gz =
+			gzio_open_read(file, loader->chunk, loader->pending);
+		if (!loader->gz) {
+			free(loader);
+			return NULL;
+		}
+		loader->file = loader->gz->stream;
+		loader->eof = 0;
+		if (read_data(loader, loader->chunk, LOADER_CHUNK_SIZE,
+			      &loader->pending)) {
+			loader_close(loader);
+			return NULL;
+		}
+	}
+	loader->chunk[loader->pending] = 0;
+	if (!loader->pending) {
+		fprintf(stderr, "No data to read.\n");
+		loader_close(loader);
+		return NULL;
+	}
+
+	loader->format = detect_format(loader, format);
+	if (loader->format == LOADER_ELF ? load_elf(loader) :
+					   process_chunk(loader)) {
+		loader_close(loader);
+		return NULL;
+	}
+	return loader;
+}
+
+/* Read until the data up to offset is final */
+int loader_fill(loader_t *loader, size_t offset)
+{
+	while (loader->ready < offset && !loader->eof) {
+		if (read_chunk(loader))
+			return EXIT_FAILURE;
+	}
+	if (offset > loader->consumed)
+		loader->consumed = offset;
+	return EXIT_SUCCESS;
+}
+
+/* Read the rest of the file */
+int loader_finish(loader_t *loader)
+{
+	while (!loader->eof) {
+		if (read_chunk(loader))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+void loader_close(loader_t *loader)
+{
+	if (!loader)
+		return;
+	if (loader->gz)
+		gzio_close(loader->gz);
+	else if (loader->file != stdin)
+		fclose(loader->file);
+	free(loader);
+}
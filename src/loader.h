@@ -0,0 +1,85 @@
+/*
+ * loader.h - Incremental image file loader declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "extent.h"
+#include "gzio.h"
+#include "ihex.h"
+#include "srec.h"
+
+#define LOADER_CHUNK_SIZE 65536
+#define LOADER_MAX_LINE	  1024
+
+#define LOADER_AUTO   -1
+#define LOADER_BINARY 0
+#define LOADER_IHEX   1
+#define LOADER_SREC   2
+#define LOADER_ELF    3
+#define LOADER_GZIP   0x100 /* Flag, the file may be gzip compressed */
+
+typedef struct loader {
+	FILE *file;
+	gzio_t *gz; /* Set for gzip compressed files */
+	int format;
+	uint8_t *data; /* Load window */
+	uint32_t base;
+	size_t size;
+	size_t file_size; /* Binary file size or hex image size */
+	extents_t *extents;
+	size_t ready; /* data[0..ready) is final */
+	size_t consumed; /* data[0..consumed) was handed out */
+	int eof;
+	size_t pending; /* Bytes in chunk */
+	ihex_reader_t ihex;
+	srec_reader_t srec;
+	uint8_t chunk[LOADER_CHUNK_SIZE + LOADER_MAX_LINE + 1];
+} loader_t;
+
+/*
+ * The loader reads an image file chunk by chunk and decodes it into the
+ * data window as it arrives. The format is detected from the first
+ * record, the expected format (see loader_guess_format) is tried first.
+ * LOADER_BINARY takes the file as is. loader_fill() returns as soon as the data
+ * up to an offset is known, so a writer can program a piped hex file
+ * while it is still being received. Hex records must then be in
+ * address order; a record landing in data already handed out is an
+ * error.
+ *
+ * Gzip compressed files are recognized by their magic and decompressed
+ * on the fly, whatever the format inside. The magic is only looked for
+ * when the format is LOADER_AUTO or has the LOADER_GZIP flag, so a
+ * binary file starting with the magic bytes is loaded as is.
+ *
+ * ELF files are random access and are loaded whole when opened, mapped
+ * into memory when the file allows it.
+ *
+ * The loader owns the file and closes it unless it is stdin.
+ */
+loader_t *loader_open(FILE *file, int format, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents);
+int loader_fill(loader_t *loader, size_t offset);
+int loader_guess_format(const char *filename);
+int loader_gzip_name(const char *filename);
+int loader_finish(loader_t *loader);
+void loader_close(loader_t *loader);
+
+#endif
@@ -0,0 +1,932 @@
+/*
+ * logic.c - Logic IC test engine.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "logic.h"
+#include "usb.h"
+
+#define LOGIC_MSG_SIZE	  32
+#define LOGIC_PINS_OFFSET 8
+
+struct logic_engine;
+
+/* One vector message, reused once its reply was read */
+typedef struct logic_slot {
+	struct logic_engine *engine;
+	uint8_t msg[LOGIC_MSG_SIZE];
+	usb_cancel_t cancel;
+	int pending; /* The message is still being sent */
+	int status;
+} logic_slot_t;
+
+typedef struct logic_engine {
+	minipro_handle_t *handle;
+	device_t *device; /* The vectors to run */
+	uint8_t opcode;
+	uint8_t *packed; /* Vectors packed to 2 pin/byte */
+	size_t packed_size;
+	size_t overcurrent; /* Vector number + 1 which tripped it */
+
+	/* Called for each result, nonzero stops the run */
+	int (*progress)(void *ctx, size_t n);
+	void *ctx;
+	logic_slot_t slots[LOGIC_PIPELINE_DEPTH];
+#ifndef _WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+} logic_engine_t;
+
+/* Result byte to the mask bits of its two pins */
+static uint8_t unpack_table[256];
+
+static void init_unpack_table(void)
+{
+	static int initialized;
+	int i;
+	if (initialized)
+		return;
+	initialized = 1;
+	for (i = 0; i < 256; i++)
+		unpack_table[i] = (i & 0x0f ? 1 : 0) | (i & 0xf0 ? 2 : 0);
+}
+
+static int count_bits(uint64_t bits)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(bits);
+#else
+	int n;
+	for (n = 0; bits; n++)
+		bits &= bits - 1;
+	return n;
+#endif
+}
+
+/* Index of the lowest set bit, bits must not be 0 */
+static int lowest_bit(uint64_t bits)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(bits);
+#else
+	int n;
+	for (n = 0; !(bits & 1); n++)
+		bits >>= 1;
+	return n;
+#endif
+}
+
+/* Called from the USB event thread */
+static void send_done(int status, void *user_data)
+{
+	logic_slot_t *slot = user_data;
+	logic_engine_t *engine = slot->engine;
+#ifndef _WIN32
+	pthread_mutex_lock(&engine->lock);
+#endif
+	slot->status = status;
+	slot->pending = 0;
+#ifndef _WIN32
+	pthread_cond_broadcast(&engine->cond);
+	pthread_mutex_unlock(&engine->lock);
+#else
+	(void)engine;
+#endif
+}
+
+static int wait_slot(logic_engine_t *engine, logic_slot_t *slot)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&engine->lock);
+	while (slot->pending)
+		pthread_cond_wait(&engine->cond, &engine->lock);
+	pthread_mutex_unlock(&engine->lock);
+#else
+	(void)engine;
+#endif
+	return slot->status;
+}
+
+static void init_engine(logic_engine_t *engine, minipro_handle_t *handle,
+			uint8_t opcode)
+{
+	int i;
+	memset(engine, 0, sizeof(*engine));
+	engine->handle = handle;
+	engine->opcode = opcode;
+	for (i = 0; i < LOGIC_PIPELINE_DEPTH; i++)
+		engine->slots[i].engine = engine;
+	init_unpack_table();
+#ifndef _WIN32
+	pthread_mutex_init(&engine->lock, NULL);
+	pthread_cond_init(&engine->cond, NULL);
+#endif
+}
+
+static void free_engine(logic_engine_t *engine)
+{
+#ifndef _WIN32
+	pthread_cond_destroy(&engine->cond);
+	pthread_mutex_destroy(&engine->lock);
+#endif
+	free(engine->packed);
+}
+
+/* Pack all vectors of a device once, they are the same in both steps */
+static int load_vectors(logic_engine_t *engine, device_t *device)
+{
+	uint8_t pin_count = device->package_details.pin_count;
+	uint8_t *vector = device->vectors;
+	int i, n;
+
+	engine->device = device;
+	engine->packed_size = (pin_count + 1) / 2;
+	free(engine->packed);
+	engine->packed =
+		malloc(engine->packed_size * device->vector_count + 1);
+	if (!engine->packed) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	uint8_t *out = engine->packed;
+	for (n = 0; n < device->vector_count; n++) {
+		for (i = 0; i < pin_count; i += 2) {
+			*out = vector[i];
+			if (i + 1 < pin_count)
+				*out |= vector[i + 1] << 4;
+			out++;
+		}
+		vector += pin_count;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Send vector n of the given step */
+static int send_vector(logic_engine_t *engine, logic_slot_t *slot,
+		       size_t n)
+{
+	device_t *device = engine->device;
+	int pull = n >= (size_t)device->vector_count;
+	if (pull)
+		n -= device->vector_count;
+
+	memset(slot->msg, 0xff, sizeof(slot->msg));
+	slot->msg[0] = engine->opcode;
+	slot->msg[1] = device->voltages.vcc;
+	slot->msg[1] |= pull << 7; /* Set the pull-up/pull-down */
+	format_int(&slot->msg[2], device->package_details.pin_count, 2,
+		   MP_LITTLE_ENDIAN);
+	format_int(&slot->msg[4], n, 4, MP_LITTLE_ENDIAN);
+	memcpy(&slot->msg[LOGIC_PINS_OFFSET],
+	       &engine->packed[n * engine->packed_size],
+	       engine->packed_size);
+
+	slot->pending = 1;
+	slot->status = EXIT_SUCCESS;
+	if (msg_send_async(engine->handle->usb_handle, slot->msg,
+			   sizeof(slot->msg), send_done, slot,
+			   &slot->cancel)) {
+		slot->pending = 0;
+		slot->status = EXIT_FAILURE;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Unpack the result from 2 pin/byte to a pin mask */
+static uint64_t unpack_result(uint8_t *msg, uint8_t pin_count)
+{
+	uint8_t *in = &msg[LOGIC_PINS_OFFSET];
+	uint64_t pins = 0;
+	int i;
+	for (i = 0; i < pin_count; i += 2)
+		pins |= (uint64_t)unpack_table[*in++] << i;
+	return pins & logic_pin_mask(pin_count);
+}
+
+/* Run both steps as one stream of vectors. The next vectors are sent
+ * while the pin states of the current one are read back. */
+static int run_vectors(logic_engine_t *engine, uint64_t *result)
+{
+	minipro_handle_t *handle = engine->handle;
+	uint8_t pin_count = engine->device->package_details.pin_count;
+	size_t total = 2 * (size_t)engine->device->vector_count;
+	size_t sent = 0, received, i;
+	uint8_t msg[LOGIC_MSG_SIZE];
+	int ret = EXIT_SUCCESS;
+
+	for (received = 0; received < total; received++) {
+		while (sent < total &&
+		       sent < received + LOGIC_PIPELINE_DEPTH) {
+			logic_slot_t *slot =
+				&engine->slots[sent % LOGIC_PIPELINE_DEPTH];
+			if (wait_slot(engine, slot) ||
+			    send_vector(engine, slot, sent)) {
+				ret = EXIT_FAILURE;
+				goto drain;
+			}
+			sent++;
+		}
+
+		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
+			/* Nothing more can be read */
+			received = sent;
+			ret = EXIT_FAILURE;
+			goto drain;
+		}
+		if (msg[1]) {
+			engine->overcurrent = ++received;
+			ret = EXIT_FAILURE;
+			goto drain;
+		}
+		result[received] = unpack_result(msg, pin_count);
+		if (engine->progress &&
+		    engine->progress(engine->ctx, received)) {
+			received++;
+			goto drain;
+		}
+	}
+
+drain:
+	/* Stop the vectors still being sent and skip the replies to those
+	 * which got through, the programmer is left in a known state */
+	for (i = 0; i < LOGIC_PIPELINE_DEPTH; i++)
+		if (engine->slots[i].pending)
+			usb_cancel(handle->usb_handle,
+				   &engine->slots[i].cancel);
+	for (i = 0; i < LOGIC_PIPELINE_DEPTH; i++)
+		wait_slot(engine, &engine->slots[i]);
+	for (; received < sent; received++) {
+		logic_slot_t *slot =
+			&engine->slots[received % LOGIC_PIPELINE_DEPTH];
+		if (!slot->status &&
+		    msg_recv(handle->usb_handle, msg, sizeof(msg)))
+			break;
+	}
+	return ret;
+}
+
+/* One pass of the soak test */
+static int engine_pass(void *ctx, uint64_t *result)
+{
+	logic_engine_t *engine = ctx;
+	if (run_vectors(engine, result)) {
+		if (engine->overcurrent)
+			fprintf(stderr, "\nOvercurrent protection!\007\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+int logic_ic_test(minipro_handle_t *handle, uint8_t opcode)
+{
+	size_t size = handle->device->vector_count;
+	logic_engine_t engine;
+	int ret = EXIT_FAILURE;
+
+	/* Both steps share one buffer */
+	uint64_t *result = calloc(2 * size + 1, sizeof(uint64_t));
+	if (!result) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	init_engine(&engine, handle, opcode);
+	if (load_vectors(&engine, handle->device)) {
+		free_engine(&engine);
+		free(result);
+		return EXIT_FAILURE;
+	}
+
+	if (handle->cmdopts->soak_passes || handle->cmdopts->soak_seconds)
+		ret = logic_soak(handle, engine_pass, &engine, 1);
+	else if (run_vectors(&engine, result)) {
+		if (engine.overcurrent)
+			fprintf(stderr, "Overcurrent protection!\007\n");
+		fprintf(stderr, "Error running the logic test.\n");
+	} else if (handle->cmdopts->logicic_out)
+		ret = write_logic_file(handle, result, &result[size]);
+	else
+		ret = logic_check(handle, result, &result[size]);
+
+	free_engine(&engine);
+	free(result);
+	return ret;
+}
+
+/* The pins of one vector read wrong with the pull-up or the pull-down.
+ * A Z pin follows the pull resistor. */
+static uint64_t step_errors(const logic_mask_t *mask, uint64_t pins,
+			    int pull_down)
+{
+	uint64_t low = mask->expect_l, high = mask->expect_h;
+	if (pull_down)
+		low |= mask->expect_z;
+	else
+		high |= mask->expect_z;
+	return (pins & low) | (~pins & high);
+}
+
+/* Convert the vectors of a device to pin masks */
+logic_mask_t *logic_masks(device_t *device)
+{
+	uint8_t pin_count = device->package_details.pin_count;
+	uint8_t *vector = device->vectors;
+	int n, i;
+
+	logic_mask_t *masks =
+		calloc(device->vector_count + 1, sizeof(logic_mask_t));
+	if (!masks) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	for (n = 0; n < device->vector_count; n++) {
+		logic_mask_t *mask = &masks[n];
+		for (i = 0; i < pin_count; i++) {
+			uint64_t bit = 1ULL << i;
+			switch (vector[i]) {
+			case LOGIC_1:
+				mask->high |= bit;
+				/* fall through */
+			case LOGIC_0:
+				mask->drive |= bit;
+				break;
+			case LOGIC_C:
+				mask->drive |= bit;
+				mask->clock |= bit;
+				break;
+			case LOGIC_L:
+				mask->expect_l |= bit;
+				break;
+			case LOGIC_H:
+				mask->expect_h |= bit;
+				break;
+			case LOGIC_Z:
+				mask->expect_z |= bit;
+				break;
+			}
+		}
+		vector += pin_count;
+	}
+	return masks;
+}
+
+/* Performing a logic test. This is accomplished in two steps.
+ * The first step will set a pull-up resistor on all chip outputs (L, H, Z).
+ * The second step will set a pull-down resistor on all chip outputs.
+ * According to the vector table then each output is compared against the two
+ * result array. Considering the weak pull-up/pull-down resistors we can detect
+ * L(low) state as 0 in both steps, H(high) state as 1 in both steps and
+ * Z(high impedance) state as 1 in step 1 when the pull-up is activated and
+ * 0 in step 2 when the pull-down is activated.
+ * While for chips with open collector/open drain output we need to perform
+ * these two steps to detect the Z state, for chips with totem-pole outputs
+ * this is not really necessary but, sometimes internal issues can be
+ * detected this way like burned H side or L side output transistors.
+ * The C (clock) state is performed in firmware by first pulsing the pin
+ * marked as C and then all pins are read back.
+ * The X (don't care) state will leave the pin unconnected.
+ * The V (VCC) and G (Ground) state will designate the power supply pins.
+ * With a single step H and Z can't be told apart, both must read as 1.
+ */
+int logic_check(minipro_handle_t *handle, uint64_t *first_step,
+		uint64_t *second_step)
+{
+	uint8_t *vector = handle->device->vectors;
+	uint8_t pin_count = handle->device->package_details.pin_count;
+	static const char pst[] = "01LHCZXGV";
+	int errors = 0, err;
+	size_t n = 0;
+
+	logic_mask_t *masks = logic_masks(handle->device);
+	if (!masks)
+		return EXIT_FAILURE;
+
+	/* A single step reads the same pins twice */
+	int z_low = second_step != NULL;
+	if (!second_step)
+		second_step = first_step;
+
+	printf("      ");
+	for (int pin = 1; pin <= pin_count; pin++)
+		printf("%-3d", pin);
+	putchar('\n');
+
+	for (int i = 0; i < handle->device->vector_count; i++) {
+		uint64_t pins = step_errors(&masks[i], first_step[i], 0) |
+				step_errors(&masks[i], second_step[i], z_low);
+		errors += count_bits(pins);
+
+		printf("%04d: ", i);
+		for (int pin = 0; pin < pin_count; pin++) {
+			err = (pins >> pin) & 1;
+			printf("%s%c%c ", err ? "\e[0;91m" : "\e[0m",
+			       pst[vector[n]], err ? '-' : ' ');
+			n++;
+		}
+		printf("\e[0m\n");
+	}
+	free(masks);
+
+	if (errors) {
+		fprintf(stderr, "Logic test failed: %d errors encountered.\n",
+			errors);
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "Logic test successful.\n");
+	return EXIT_SUCCESS;
+}
+
+/* Failure counters of a soak test */
+typedef struct logic_stats {
+	uint32_t passes;
+	uint32_t failed_passes;
+	uint32_t *vector_fails;
+	uint32_t pin_fails[64];
+	uint16_t *cells; /* Per vector and pin, saturating */
+	time_t seconds;
+} logic_stats_t;
+
+/* Count the failing pins of one pass, returns nonzero if any */
+static int count_failures(logic_stats_t *stats, logic_mask_t *masks,
+			  int vector_count, uint8_t pin_count,
+			  uint64_t *first_step, uint64_t *second_step,
+			  int z_low)
+{
+	int v, pin, failed = 0;
+	for (v = 0; v < vector_count; v++) {
+		uint64_t pins = step_errors(&masks[v], first_step[v], 0) |
+				step_errors(&masks[v], second_step[v], z_low);
+		if (!pins)
+			continue;
+		failed = 1;
+		stats->vector_fails[v]++;
+		for (; pins; pins &= pins - 1) {
+			pin = lowest_bit(pins);
+			stats->pin_fails[pin]++;
+			if (stats->cells[v * pin_count + pin] < UINT16_MAX)
+				stats->cells[v * pin_count + pin]++;
+		}
+	}
+	return failed;
+}
+
+/* Print the vectors which failed with a shade per pin */
+static void print_heatmap(device_t *device, logic_stats_t *stats)
+{
+	uint8_t pin_count = device->package_details.pin_count;
+	static const char pst[] = "01LHCZXGV";
+	static const char shades[] = ".123456789#";
+	int v, pin;
+
+	fprintf(stderr, "      ");
+	for (pin = 1; pin <= pin_count; pin++)
+		fprintf(stderr, "%-3d", pin);
+	fprintf(stderr, "\n");
+
+	/* Untested pins show their state, tested ones the failure rate
+	 * in ninths, # when failing in every pass */
+	for (v = 0; v < device->vector_count; v++) {
+		if (!stats->vector_fails[v])
+			continue;
+		uint8_t *vector = &device->vectors[v * pin_count];
+		uint16_t *cells = &stats->cells[v * pin_count];
+		fprintf(stderr, "%04d: ", v);
+		for (pin = 0; pin < pin_count; pin++) {
+			uint32_t count = cells[pin];
+			char c = pst[vector[pin]];
+			if (count >= stats->passes)
+				c = shades[10];
+			else if (count)
+				c = shades[1 + count * 9 / stats->passes];
+			else if (vector[pin] == LOGIC_L ||
+				 vector[pin] == LOGIC_H ||
+				 vector[pin] == LOGIC_Z)
+				c = shades[0];
+			fprintf(stderr, "%s%c  ", count ? "\e[0;91m" : "\e[0m",
+				c);
+		}
+		fprintf(stderr, "\e[0m %u\n", stats->vector_fails[v]);
+	}
+	fprintf(stderr, "Pins: ");
+	for (pin = 0; pin < pin_count; pin++)
+		fprintf(stderr, "%-3u", stats->pin_fails[pin]);
+	fprintf(stderr, "\n");
+}
+
+static void print_json(device_t *device, logic_stats_t *stats)
+{
+	uint8_t pin_count = device->package_details.pin_count;
+	int v, pin, first = 1;
+
+	printf("{\n  \"device\": \"%s\",\n", device->name);
+	printf("  \"passes\": %u,\n  \"failed_passes\": %u,\n",
+	       stats->passes, stats->failed_passes);
+	printf("  \"seconds\": %ld,\n", (long)stats->seconds);
+	printf("  \"vector_failures\": [");
+	for (v = 0; v < device->vector_count; v++)
+		printf("%s%u", v ? ", " : "", stats->vector_fails[v]);
+	printf("],\n  \"pin_failures\": [");
+	for (pin = 0; pin < pin_count; pin++)
+		printf("%s%u", pin ? ", " : "", stats->pin_fails[pin]);
+	printf("],\n  \"cells\": [");
+	for (v = 0; v < device->vector_count; v++) {
+		for (pin = 0; pin < pin_count; pin++) {
+			uint16_t count = stats->cells[v * pin_count + pin];
+			if (!count)
+				continue;
+			printf("%s\n    { \"vector\": %d, \"pin\": %d, "
+			       "\"failures\": %u }",
+			       first ? "" : ",", v, pin + 1, count);
+			first = 0;
+		}
+	}
+	printf("%s]\n}\n", first ? "" : "\n  ");
+}
+
+/* Repeat the logic test for the cmdopts soak_passes or soak_seconds.
+ * All buffers are allocated up front, a pass only runs the vectors and
+ * counts the failures. */
+int logic_soak(minipro_handle_t *handle, int (*pass)(void *, uint64_t *),
+	       void *ctx, int two_steps)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	device_t *device = handle->device;
+	uint8_t pin_count = device->package_details.pin_count;
+	int vector_count = device->vector_count;
+	int ret = EXIT_FAILURE;
+	logic_stats_t stats;
+
+	memset(&stats, 0, sizeof(stats));
+	uint64_t *result = calloc(2 * (size_t)vector_count + 1,
+				  sizeof(uint64_t));
+	logic_mask_t *masks = logic_masks(device);
+	stats.vector_fails = calloc(vector_count + 1, sizeof(uint32_t));
+	stats.cells = calloc((size_t)vector_count * pin_count + 1,
+			     sizeof(uint16_t));
+	if (!result || !masks || !stats.vector_fails || !stats.cells) {
+		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+
+	/* A single step reads the same pins twice */
+	uint64_t *second_step = two_steps ? &result[vector_count] : result;
+	time_t start = time(NULL);
+	ret = EXIT_SUCCESS;
+	while (cmdopts->soak_passes ?
+		       stats.passes < cmdopts->soak_passes :
+		       time(NULL) - start < (time_t)cmdopts->soak_seconds) {
+		if (pass(ctx, result)) {
+			fprintf(stderr, "Error running the logic test.\n");
+			ret = EXIT_FAILURE;
+			break;
+		}
+		stats.passes++;
+		stats.failed_passes +=
+			count_failures(&stats, masks, vector_count, pin_count,
+				       result, second_step, two_steps);
+		fprintf(stderr, "\r\e[KSoak test: %u passes, %u failed",
+			stats.passes, stats.failed_passes);
+		fflush(stderr);
+	}
+	stats.seconds = time(NULL) - start;
+	fprintf(stderr, "\n");
+
+	if (stats.failed_passes)
+		print_heatmap(device, &stats);
+	print_json(device, &stats);
+	if (stats.failed_passes) {
+		fprintf(stderr, "Logic soak test failed: %u of %u passes.\n",
+			stats.failed_passes, stats.passes);
+		ret = EXIT_FAILURE;
+	} else if (!ret)
+		fprintf(stderr, "Logic soak test successful.\n");
+
+cleanup:
+	free(result);
+	free(masks);
+	free(stats.vector_fails);
+	free(stats.cells);
+	return ret;
+}
+
+/* Write out results of a logic test. Instead of checking test
+ * results they are just written out to a file. Any expected
+ * L, H or Z values in the vector are replaced with the read
+ * logic state
+ */
+int write_logic_file(minipro_handle_t *handle, uint64_t *first_step,
+		     uint64_t *second_step)
+{
+	FILE *out;
+	uint8_t *pvec = handle->device->vectors;
+	char *device_name = handle->cmdopts->device_name;
+	int pin_count = handle->device->package_details.pin_count;
+	int vector_count = handle->device->vector_count;
+	static const char pst[] = "01LHCZXGV";
+	static const char *vcc_table[] = {"5V", "3V3", "2V5", "1V8"};
+
+	const char *vcc = vcc_table[handle->device->voltages.vcc];
+
+	/* Must have enough space for max pins (48) + spaces between each character */
+	char linebuf[100];
+
+	logic_mask_t *masks = logic_masks(handle->device);
+	if (!masks)
+		return EXIT_FAILURE;
+	out = fopen(handle->cmdopts->logicic_out, "w");
+	if (out == NULL) {
+		free(masks);
+		return EXIT_FAILURE;
+	}
+	fputs("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n", out);
+	fputs("<logicic>\n", out);
+	fputs("  <database device=\"LOGIC\">\n", out);
+	fputs("    <manufacturer name=\"Logic Ic\">\n", out);
+	fprintf(out, "      <ic name=\"%s\" type=\"5\" voltage=\"%s\" pins=\"%d\">\n",
+		device_name, vcc, pin_count);
+	for (int i = 0; i < vector_count; i++) {
+		logic_mask_t *mask = &masks[i];
+		uint64_t tested = mask->expect_l | mask->expect_h |
+				  mask->expect_z;
+		/* Pulled high: H, pulled low: L, not pulled at all: Z */
+		uint64_t high = first_step[i] & second_step[i];
+		uint64_t low = ~first_step[i] & ~second_step[i];
+		uint64_t z = first_step[i] & ~second_step[i];
+		char *p = linebuf;
+		for (int j = 0; j < pin_count; j++) {
+			uint64_t bit = 1ULL << j;
+			/* If vector doesn't require a test just copy existing value */
+			if (!(tested & bit))
+				*p = pst[*pvec];
+			else if (high & bit)
+				*p = 'H';
+			else if (low & bit)
+				*p = 'L';
+			else if (z & bit)
+				*p = 'Z';
+			else
+			/* Should be impossible */
+				*p = '?';
+			pvec++;
+			*++p = ' ';
+			p++;
+		}
+		*p = 0;
+		fprintf(out, "        <vector id=\"%02d\"> %s</vector>\n", i, linebuf);
+	}
+	fputs("      </ic>\n", out);
+	fputs("    </manufacturer>\n", out);
+	fputs("  </database>\n", out);
+	fputs("</logicic>\n", out);
+	fclose(out);
+	free(masks);
+	return EXIT_SUCCESS;
+}
+
+/* Candidate elimination of the identify action */
+typedef struct identify {
+	logic_list_t *list;
+	logic_mask_t **masks; /* Vectors of each device */
+	uint8_t *alive; /* No mismatch seen yet */
+	uint8_t *done; /* All vectors checked in both steps */
+	int *shared; /* Leading vectors two devices drive the same */
+	size_t current; /* Device whose vectors are running */
+	size_t received; /* Results of the current run */
+	uint64_t *result;
+} identify_t;
+
+/* Number of leading vectors of a which b drives the same way. The
+ * results of those are valid for both devices. The programmer drives
+ * the inputs only, outputs are all read the same. */
+static int shared_prefix(device_t *a, logic_mask_t *ma, device_t *b,
+			 logic_mask_t *mb)
+{
+	int n;
+
+	if (a->voltages.vcc != b->voltages.vcc)
+		return 0;
+	for (n = 0; n < a->vector_count && n < b->vector_count; n++) {
+		if (ma[n].drive != mb[n].drive || ma[n].high != mb[n].high ||
+		    ma[n].clock != mb[n].clock ||
+		    (ma[n].expect_l | ma[n].expect_h | ma[n].expect_z) !=
+			    (mb[n].expect_l | mb[n].expect_h | mb[n].expect_z))
+			return n;
+	}
+	return n;
+}
+
+/* Only devices powered from exactly the given pins are safe to try */
+static int power_matches(device_t *device, uint8_t gnd, uint8_t vcc)
+{
+	uint8_t pin_count = device->package_details.pin_count;
+	uint8_t *vector = device->vectors;
+	int n, i;
+
+	if (!device->vector_count)
+		return 0;
+	for (n = 0; n < device->vector_count; n++) {
+		for (i = 0; i < pin_count; i++) {
+			if ((vector[i] == LOGIC_G) != (i == gnd) ||
+			    (vector[i] == LOGIC_V) != (i == vcc))
+				return 0;
+		}
+		vector += pin_count;
+	}
+	return 1;
+}
+
+/* Called for every result of the current run. Prune the devices which
+ * disagree and stop once nobody needs the remaining vectors. */
+static int identify_progress(void *ctx, size_t n)
+{
+	identify_t *id = ctx;
+	size_t count = id->list->count, c = id->current, d;
+	int vector_count = id->list->devices[c].vector_count;
+	int pull_down = n >= (size_t)vector_count;
+	int v = pull_down ? n - vector_count : n;
+	int *shared = &id->shared[c * count];
+	int interested = 0;
+
+	id->received = n + 1;
+	for (d = 0; d < count; d++) {
+		if (!id->alive[d] || shared[d] <= v)
+			continue;
+		if (step_errors(&id->masks[d][v], id->result[n], pull_down))
+			id->alive[d] = 0;
+		/* Results in both steps are needed, the pull-down step
+		 * runs from its first vector again */
+		if (id->alive[d] && !id->done[d] &&
+		    shared[d] > (pull_down ? v + 1 : 0))
+			interested = 1;
+	}
+	return !interested;
+}
+
+/* Pick the device sharing the most vectors with the other candidates
+ * so one run prunes as many of them as possible */
+static int next_candidate(identify_t *id, size_t *next)
+{
+	size_t count = id->list->count, c, d;
+	long best = -1;
+
+	for (c = 0; c < count; c++) {
+		if (!id->alive[c] || id->done[c])
+			continue;
+		long sum = 0;
+		for (d = 0; d < count; d++)
+			if (id->alive[d] && !id->done[d] && d != c)
+				sum += id->shared[c * count + d];
+		if (sum > best) {
+			best = sum;
+			*next = c;
+		}
+	}
+	return best >= 0;
+}
+
+static int identify_devices(logic_engine_t *engine, identify_t *id)
+{
+	size_t count = id->list->count, c, d;
+	device_t *devices = id->list->devices;
+
+	while (next_candidate(id, &c)) {
+		int *shared = &id->shared[c * count];
+		int vector_count = devices[c].vector_count;
+
+		id->current = c;
+		id->received = 0;
+		if (load_vectors(engine, &devices[c]))
+			return EXIT_FAILURE;
+		if (run_vectors(engine, id->result)) {
+			if (!engine->overcurrent)
+				return EXIT_FAILURE;
+
+			/* Every device driving the same vectors trips too */
+			int v = (engine->overcurrent - 1) % vector_count;
+			for (d = 0; d < count; d++)
+				if (shared[d] > v)
+					id->alive[d] = 0;
+			id->alive[c] = 0;
+			engine->overcurrent = 0;
+
+			/* Release the pins before the next device */
+			if (minipro_end_transaction(engine->handle))
+				return EXIT_FAILURE;
+			continue;
+		}
+
+		/* The devices whose vectors all ran in both steps */
+		for (d = 0; d < count; d++) {
+			int count_d = devices[d].vector_count;
+			if (id->alive[d] && shared[d] == count_d &&
+			    id->received >= (size_t)vector_count + count_d)
+				id->done[d] = 1;
+		}
+		id->done[c] = 1;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Run the vectors of every logic IC in list on the unknown chip and
+ * print the ones which pass */
+int logic_identify(minipro_handle_t *handle, uint8_t opcode,
+		   logic_list_t *list)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	size_t count = list->count, c, d, found = 0;
+	logic_engine_t engine;
+	identify_t id;
+	int max_vectors = 0, ret = EXIT_FAILURE;
+
+	memset(&id, 0, sizeof(id));
+	id.list = list;
+	id.masks = calloc(count + 1, sizeof(logic_mask_t *));
+	id.alive = calloc(count + 1, 1);
+	id.done = calloc(count + 1, 1);
+	id.shared = calloc(count * count + 1, sizeof(int));
+	if (!id.masks || !id.alive || !id.done || !id.shared) {
+		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+
+	for (c = 0; c < count; c++) {
+		if (!power_matches(&list->devices[c], cmdopts->logic_gnd,
+				   cmdopts->logic_vcc))
+			continue;
+		id.masks[c] = logic_masks(&list->devices[c]);
+		if (!id.masks[c])
+			goto cleanup;
+		id.alive[c] = 1;
+		if (list->devices[c].vector_count > max_vectors)
+			max_vectors = list->devices[c].vector_count;
+	}
+	for (c = 0; c < count; c++)
+		for (d = 0; d < count; d++)
+			if (id.alive[c] && id.alive[d])
+				id.shared[c * count + d] = shared_prefix(
+					&list->devices[c], id.masks[c],
+					&list->devices[d], id.masks[d]);
+
+	id.result = calloc(2 * (size_t)max_vectors + 1, sizeof(uint64_t));
+	if (!id.result) {
+		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+
+	init_engine(&engine, handle, opcode);
+	engine.progress = identify_progress;
+	engine.ctx = &id;
+	ret = identify_devices(&engine, &id);
+	free_engine(&engine);
+	if (ret) {
+		fprintf(stderr, "Error running the logic test.\n");
+		goto cleanup;
+	}
+
+	for (c = 0; c < count; c++) {
+		if (id.alive[c] && id.done[c]) {
+			printf("%s\n", list->names[c]);
+			found++;
+		}
+	}
+	if (found) {
+		fprintf(stderr, "%zu matching logic IC%s found.\n", found,
+			found > 1 ? "s" : "");
+	} else {
+		fprintf(stderr, "No matching logic IC found.\n");
+		ret = EXIT_FAILURE;
+	}
+
+cleanup:
+	if (id.masks)
+		for (c = 0; c < count; c++)
+			free(id.masks[c]);
+	free(id.masks);
+	free(id.alive);
+	free(id.done);
+	free(id.shared);
+	free(id.result);
+	return ret;
+}
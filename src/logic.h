@@ -0,0 +1,88 @@
+/*
+ * logic.h - Logic IC test engine declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef LOGIC_H_
+#define LOGIC_H_
+
+#include <stdint.h>
+
+#include "database.h"
+#include "minipro.h"
+
+/* Test vectors kept in flight. There is no USB event thread on Windows
+ * where every transfer completes before the next one is started. */
+#ifdef _WIN32
+#define LOGIC_PIPELINE_DEPTH 1
+#else
+#define LOGIC_PIPELINE_DEPTH 8
+#endif
+
+/* One test vector as pin masks, bit n is pin n + 1 */
+typedef struct logic_mask {
+	uint64_t drive; /* Pins set to 0 or 1 or clocked */
+	uint64_t high; /* Driven pins set to 1 */
+	uint64_t clock;
+	uint64_t expect_l; /* Output pins and their expected state */
+	uint64_t expect_h;
+	uint64_t expect_z;
+} logic_mask_t;
+
+static inline uint64_t logic_pin_mask(uint8_t pin_count)
+{
+	return pin_count >= 64 ? ~0ULL : (1ULL << pin_count) - 1;
+}
+
+/* The device vectors as masks, free() the result */
+logic_mask_t *logic_masks(device_t *device);
+
+/*
+ * Run the logic test on the TL866II+, T48 and T56. These take one
+ * vector per 32 byte message with two pins per byte and the vector
+ * command opcode is the only difference.
+ */
+int logic_ic_test(minipro_handle_t *handle, uint8_t opcode);
+
+/* Print the vectors and check the results, a pin mask per vector.
+ * second_step is NULL if the programmer reads the pins with the pull-up
+ * only. */
+int logic_check(minipro_handle_t *handle, uint64_t *first_step,
+		uint64_t *second_step);
+
+/*
+ * Repeat the logic test for the cmdopts soak_passes, or soak_seconds if
+ * that is 0. pass() runs the vectors once without any setup and fills
+ * one pin mask per vector, the pull-down step follows if two_steps is
+ * set. Prints a heatmap of the failing pins and a JSON summary.
+ */
+int logic_soak(minipro_handle_t *handle, int (*pass)(void *, uint64_t *),
+	       void *ctx, int two_steps);
+
+/* Write the vectors to the logicic_out file with the expected output
+ * states replaced by the ones read */
+int write_logic_file(minipro_handle_t *handle, uint64_t *first_step,
+		     uint64_t *second_step);
+
+/*
+ * Find which logic ICs of the list the chip in the socket could be.
+ * Only the devices powered from the cmdopts logic_gnd and logic_vcc
+ * pins are tried. Devices driving the same leading vectors share the
+ * results of those, so a mismatch prunes all of them at once.
+ */
+int logic_identify(minipro_handle_t *handle, uint8_t opcode,
+		   logic_list_t *list);
+
+#endif
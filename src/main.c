@@ -25,16 +25,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <sys/time.h>
 #include <getopt.h>
 #include <unistd.h>
 
 #include "database.h"
+#include "extent.h"
+#include "gzio.h"
 #include "jedec.h"
 #include "ihex.h"
+#include "image.h"
 #include "srec.h"
+#include "journal.h"
+#include "loader.h"
 #include "minipro.h"
+#include "session.h"
 #include "version.h"
 
 #ifdef _WIN32
@@ -48,7 +53,6 @@
 #define VPP_VOLTAGE	 0
 #define VCC_VOLTAGE	 1
 
-#define READ_BUFFER_SIZE 65536
 #define MIN(a, b)	 (((a) < (b)) ? (a) : (b))
 
 static const char *user_id[] = {
@@ -160,6 +164,15 @@ static struct option long_options[] = {
 	{ "logicic", required_argument, NULL, 4 },
 	{ "logicic_out", required_argument, NULL, 5 },
 	{ "algorithms", required_argument, NULL, 6 },
+	{ "reconnect", required_argument, NULL, 7 },
+	{ "journal", required_argument, NULL, 8 },
+	{ "offset", required_argument, NULL, 9 },
+	{ "length", required_argument, NULL, 10 },
+	{ "blank_gaps", no_argument, NULL, 11 },
+	{ "record_length", required_argument, NULL, 12 },
+	{ "compress_level", required_argument, NULL, 13 },
+	{ "identify", required_argument, NULL, 14 },
+	{ "soak", required_argument, NULL, 15 },
 	{ "list", no_argument, NULL, 'l' },
 	{ "search", required_argument, NULL, 'L' },
 	{ "get_info", required_argument, NULL, 'd' },
@@ -768,18 +781,29 @@ void spi_autodetect_and_exit(uint8_t package_type, cmdopts_t *cmdopts)
 				exit(EXIT_FAILURE);
 			}
 
-			/*
-			 * For the time being, device must be NULL
-			 * before minipro_spi_autodetect() is called.
-			 * Otherwise bb_autodetect() will be called,
-			 * which is currently not implemented.
-			 */
+			/* The native autodetection needs no device */
 			handle->device = NULL;
 		} else
 			fprintf(stderr, "Pin test is not supported.\n");
 	}
 
-	if (minipro_spi_autodetect(handle, package_type >> 4, &chip_id)) {
+	/* Fall back to the bit banged ID probe if the native command
+	 * is missing or finds nothing. It starts at a low VCC, so it is
+	 * skipped on the TL866A which always powers the chip at 5V. */
+	int ret = minipro_spi_autodetect(handle, package_type >> 4, &chip_id);
+	if ((ret || !chip_id || chip_id == 0xffffff) &&
+	    handle->version != MP_TL866A && handle->minipro_set_zif_state) {
+		device_t device;
+		memset(&device, 0, sizeof(device));
+		device.flags.custom_protocol = 1;
+		device.protocol_id = CP_SPI;
+		handle->device = &device;
+		ret = minipro_spi_autodetect(handle, package_type >> 4,
+					     &chip_id);
+		handle->device = NULL;
+	}
+	if (ret) {
+		minipro_close(handle);
 		exit(EXIT_FAILURE);
 	}
 
@@ -804,6 +828,102 @@ void spi_autodetect_and_exit(uint8_t package_type, cmdopts_t *cmdopts)
 	exit(EXIT_SUCCESS);
 }
 
+/* Identify an unknown logic IC from its pin count and power pins */
+void logic_identify_and_exit(cmdopts_t *cmdopts)
+{
+	minipro_handle_t *handle = minipro_open(VERBOSE);
+	if (!handle) {
+		exit(EXIT_FAILURE);
+	}
+	minipro_print_system_info(handle);
+	if (handle->status == MP_STATUS_BOOTLOADER) {
+		fprintf(stderr, "in bootloader mode!\n");
+		exit(EXIT_FAILURE);
+	}
+	handle->cmdopts = cmdopts;
+
+	db_data_t db_data;
+	memset(&db_data, 0, sizeof(db_data));
+	db_data.logicic_path = cmdopts->logicic_path;
+	db_data.infoic_path = cmdopts->infoic_path;
+	db_data.algo_path = cmdopts->algo_path;
+	db_data.pin_count = cmdopts->logic_pins;
+	logic_list_t *list = get_logic_devices(&db_data);
+	if (!list) {
+		minipro_close(handle);
+		exit(EXIT_FAILURE);
+	}
+	if (!list->count) {
+		fprintf(stderr, "No %u pin logic IC found in the database.\n",
+			cmdopts->logic_pins);
+		free_logic_devices(list);
+		minipro_close(handle);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "Identifying %u pin logic IC (GND:%u VCC:%u)\n",
+		cmdopts->logic_pins, cmdopts->logic_gnd + 1,
+		cmdopts->logic_vcc + 1);
+	handle->device = &list->devices[0];
+	int ret = minipro_logic_ic_identify(handle, list);
+	handle->device = NULL;
+	free_logic_devices(list);
+	minipro_close(handle);
+	exit(ret);
+}
+
+/* Parse <pins>[:<gnd>:<vcc>], the power pins default to the usual DIP
+ * corners */
+static int parse_identify(const char *arg, cmdopts_t *cmdopts)
+{
+	unsigned int pins, gnd, vcc;
+	char extra;
+
+	if (sscanf(arg, "%u%c", &pins, &extra) == 1) {
+		gnd = pins / 2;
+		vcc = pins;
+	} else if (sscanf(arg, "%u:%u:%u%c", &pins, &gnd, &vcc, &extra) != 3)
+		return EXIT_FAILURE;
+	if (pins < 4 || pins > 48 || !gnd || !vcc || gnd > pins ||
+	    vcc > pins || gnd == vcc)
+		return EXIT_FAILURE;
+	cmdopts->logic_pins = pins;
+	cmdopts->logic_gnd = gnd - 1;
+	cmdopts->logic_vcc = vcc - 1;
+	return EXIT_SUCCESS;
+}
+
+/* Parse a pass count or a duration ending in s, m or h */
+static int parse_soak(const char *arg, cmdopts_t *cmdopts)
+{
+	char *end;
+	unsigned long long value = strtoull(arg, &end, 10);
+	if (end == arg || !value || value > UINT32_MAX)
+		return EXIT_FAILURE;
+	if (!*end) {
+		cmdopts->soak_passes = value;
+		return EXIT_SUCCESS;
+	}
+	if (end[1])
+		return EXIT_FAILURE;
+	switch (*end) {
+	case 'h':
+		value *= 60;
+		/* fall through */
+	case 'm':
+		value *= 60;
+		/* fall through */
+	case 's':
+		break;
+	default:
+		return EXIT_FAILURE;
+	}
+	if (value > UINT32_MAX)
+		return EXIT_FAILURE;
+	cmdopts->soak_seconds = value;
+	return EXIT_SUCCESS;
+}
+
 void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 {
 	int8_t c;
@@ -833,6 +953,67 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 		case 6:
 			cmdopts->algo_path = optarg; /* Custom algorithm.xml */
 			break;
+		case 7:
+			/* Number of reconnect attempts after an USB error */
+			cmdopts->reconnect = atoi(optarg);
+			if (cmdopts->reconnect <= 0) {
+				fprintf(stderr, "Invalid reconnect count.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
+		case 8:
+			cmdopts->journal_path = optarg; /* Resume journal */
+			break;
+		case 9:
+		case 10:
+			/* Address range for read, write, verify and blank check */
+			errno = 0;
+			char *end;
+			unsigned long value = strtoul(optarg, &end, 0);
+			if (errno || *end || !*optarg || value > UINT32_MAX ||
+			    (c == 10 && !value)) {
+				fprintf(stderr, "Invalid %s: %s\n",
+					c == 9 ? "offset" : "length", optarg);
+				print_help_and_exit(argv[0]);
+			}
+			if (c == 9)
+				cmdopts->offset = value;
+			else
+				cmdopts->length = value;
+			break;
+		case 11:
+			cmdopts->blank_gaps = 1; /* Verify hex file gaps as blank */
+			break;
+		case 12:
+			/* Data bytes per Intel hex or S-Record line */
+			cmdopts->record_length = atoi(optarg);
+			if (cmdopts->record_length <= 0 ||
+			    cmdopts->record_length > 255) {
+				fprintf(stderr, "Invalid record length.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
+		case 13:
+			/* Gzip level for .gz output files */
+			cmdopts->compress_level = atoi(optarg);
+			if (cmdopts->compress_level < 1 ||
+			    cmdopts->compress_level > 9) {
+				fprintf(stderr, "Invalid compression level.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
+		case 14:
+			if (parse_identify(optarg, cmdopts)) {
+				fprintf(stderr, "Invalid logic IC pins.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
+		case 15:
+			if (parse_soak(optarg, cmdopts)) {
+				fprintf(stderr, "Invalid soak test length.\n");
+				print_help_and_exit(argv[0]);
+			}
+			break;
 		case 'q':
 			if (!strcasecmp(optarg, "tl866a"))
 				cmdopts->version = MP_TL866A;
@@ -929,6 +1110,8 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 				cmdopts->format = IHEX;
 			if (!strcasecmp(optarg, "srec"))
 				cmdopts->format = SREC;
+			if (!strcasecmp(optarg, "image"))
+				cmdopts->format = IMAGE;
 			if (!cmdopts->format) {
 				fprintf(stderr, "Unknown file format\n");
 				exit(EXIT_FAILURE);
@@ -1035,6 +1218,30 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 	if (cmdopts->filter_fuses || cmdopts->filter_locks ||
 	    cmdopts->filter_uid)
 		cmdopts->page = CONFIG;
+
+	/* A .mpi file holds all the memory sections of the chip */
+	if (!cmdopts->format && cmdopts->filename &&
+	    is_image_name(cmdopts->filename))
+		cmdopts->format = IMAGE;
+
+	/* An address range selects the code memory if no page is given */
+	if (cmdopts->offset || cmdopts->length) {
+		if (cmdopts->page == UNSPECIFIED)
+			cmdopts->page = CODE;
+		if (cmdopts->page == CONFIG || cmdopts->page == CALIBRATION) {
+			fprintf(stderr,
+				"An address range can't be used with the %s page.\n",
+				cmdopts->page == CONFIG ? "config" :
+							  "calibration");
+			print_help_and_exit(argv[0]);
+		}
+	}
+	if ((cmdopts->soak_passes || cmdopts->soak_seconds) &&
+	    (cmdopts->action != LOGIC_IC_TEST || cmdopts->logicic_out)) {
+		fprintf(stderr,
+			"--soak needs -T and can't be used with --logicic_out.\n");
+		print_help_and_exit(argv[0]);
+	}
 	if (cmdopts->version && !p_func) {
 		fprintf(stderr,
 			"-L, -l or -d command is required for this action.\n");
@@ -1044,6 +1251,8 @@ void parse_cmdline(int argc, char **argv, cmdopts_t *cmdopts)
 		p_func(cmdopts);
 	if (package_type)
 		spi_autodetect_and_exit(package_type, cmdopts);
+	if (cmdopts->logic_pins)
+		logic_identify_and_exit(cmdopts);
 }
 
 /* Search for config name in buffer. */
@@ -1169,7 +1378,8 @@ int compare_word_memory(uint16_t replacement_value, uint16_t compare_mask,
 
 /* RAM-centric IO operations */
 int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
-		  size_t size)
+		  uint32_t start, size_t size, journal_t *journal,
+		  const extents_t *extents)
 {
 	char status_msg[64], *name;
 	switch (type) {
@@ -1201,15 +1411,23 @@ int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
 	uint32_t address;
 	size_t i;
 	for (i = 0; i < blocks_count; i++) {
+		/* Already read in a previous run or not needed */
+		if (journal_done(journal, i) ||
+		    (extents &&
+		     !extents_overlap(extents, i * buffer_size, buffer_size)))
+			continue;
 		update_status(status_msg, "%2d%%", i * 100 / blocks_count);
 		/* Translating address to protocol-specific */
-		address = i * buffer_size + offset;
+		address = start + i * buffer_size + offset;
 		if (handle->device->flags.has_word && type == MP_CODE)
 			address = address >> 1;
 
-		if (minipro_read_block(handle, type, address,
-				       buf + i * buffer_size, buffer_size))
-			return EXIT_FAILURE;
+		/* On a connection loss resume from the current block */
+		while (minipro_read_block(handle, type, address,
+					  buf + i * buffer_size, buffer_size)) {
+			if (session_recover(handle->session))
+				return EXIT_FAILURE;
+		}
 
 		uint8_t ovc;
 		if (minipro_get_ovc_status(handle, NULL, &ovc))
@@ -1218,6 +1436,12 @@ int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
 			fprintf(stderr, "\nOvercurrent protection!\007\n");
 			return EXIT_FAILURE;
 		}
+
+		if (journal_commit(journal, i, buf + i * buffer_size,
+				   MIN(buffer_size, size - i * buffer_size))) {
+			fprintf(stderr, "\nJournal write error!\n");
+			return EXIT_FAILURE;
+		}
 	}
 	gettimeofday(&end, NULL);
 	snprintf(status_msg, sizeof(status_msg), "Reading %s...  %.2fSec  OK",
@@ -1229,7 +1453,8 @@ int read_page_ram(minipro_handle_t *handle, uint8_t *buf, uint8_t type,
 }
 
 int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
-		   size_t size)
+		   uint32_t start, size_t size, journal_t *journal,
+		   const extents_t *extents, loader_t *loader)
 {
 	char status_msg[64], *name;
 	switch (type) {
@@ -1260,18 +1485,31 @@ int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
 				  0;
 	uint32_t address;
 	for (i = 0; i < blocks_count; i++) {
+		/* Wait until the file data of this block has arrived */
+		if (loader &&
+		    loader_fill(loader, MIN((i + 1) * buffer_size, size)))
+			return EXIT_FAILURE;
+
+		/* Already written in a previous run or no file data here */
+		if (journal_done(journal, i) ||
+		    (extents &&
+		     !extents_overlap(extents, i * buffer_size, buffer_size)))
+			continue;
 		update_status(status_msg, "%2d%%", i * 100 / blocks_count);
 		/* Translating address to protocol-specific */
-		address = i * buffer_size + offset;
+		address = start + i * buffer_size + offset;
 		if (handle->device->flags.has_word && type == MP_CODE)
 			address = address >> 1;
 
 		/* Last block */
+		size_t length = buffer_size;
 		if ((i + 1) * buffer_size > size)
-			buffer_size = size % buffer_size;
-		if (minipro_write_block(handle, type, address,
-					buffer + i * buffer_size, buffer_size))
-			return EXIT_FAILURE;
+			length = size - i * buffer_size;
+		while (minipro_write_block(handle, type, address,
+					   buffer + i * buffer_size, length)) {
+			if (session_recover(handle->session))
+				return EXIT_FAILURE;
+		}
 
 		uint8_t ovc = 0;
 		if (minipro_get_ovc_status(handle, &status, &ovc))
@@ -1297,6 +1535,12 @@ int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
 						 0xFFFF));
 			return EXIT_FAILURE;
 		}
+
+		if (journal_commit(journal, i, buffer + i * buffer_size,
+				   length)) {
+			fprintf(stderr, "\nJournal write error!\n");
+			return EXIT_FAILURE;
+		}
 	}
 	gettimeofday(&end, NULL);
 	snprintf(status_msg, sizeof(status_msg), "Writing %s...  %.2fSec  OK",
@@ -1310,7 +1554,7 @@ int write_page_ram(minipro_handle_t *handle, uint8_t *buffer, uint8_t type,
 /* Read PLD device */
 int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 {
-	size_t i, j;
+	size_t i;
 	struct timeval begin, end;
 	gettimeofday(&begin, NULL);
 
@@ -1328,16 +1572,14 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	}
 
 	/* Read fuses */
-	memset(jedec->fuses, 0, jedec->QF);
+	memset(jedec->fuses, 0, JEDEC_FUSES_SIZE(jedec->QF));
 	for (i = 0; i < config->fuses_size; i++) {
 		if (minipro_read_jedec_row(handle, buffer, i, 0,
 					   config->row_width))
 			return EXIT_FAILURE;
 		/* Unpacking the row */
-		for (j = 0; j < config->row_width; j++) {
-			if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-				jedec->fuses[config->fuses_size * j + i] = 1;
-		}
+		jedec_scatter(jedec, buffer, i, config->fuses_size,
+			      config->row_width);
 		update_status(status_msg, "%2d%%",
 			      i * 100 / config->fuses_size);
 	}
@@ -1350,10 +1592,8 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 		if (minipro_read_jedec_row(handle, buffer, i, 0,
 					   config->ues_size))
 			return EXIT_FAILURE;
-		for (j = 0; j < config->ues_size; j++) {
-			if (buffer[j / 8] & (0x80 >> (j & 0x07)))
-				jedec->fuses[config->ues_address + j] = 1;
-		}
+		jedec_scatter(jedec, buffer, config->ues_address, 1,
+			      config->ues_size);
 	}
 
 	/* Read architecture control word (ACW) */
@@ -1362,7 +1602,7 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 		return EXIT_FAILURE;
 	for (i = 0; i < config->acw_size; i++) {
 		if (buffer[i / 8] & (0x80 >> (i & 0x07)))
-			jedec->fuses[config->acw_bits[i]] = 1;
+			jedec_set_fuse(jedec, config->acw_bits[i], 1);
 	}
 
 	/* Read Power-Down bit */
@@ -1371,7 +1611,7 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 		if (minipro_read_jedec_row(handle, buffer,
 					   config->powerdown_row, 0, 1))
 			return EXIT_FAILURE;
-		jedec->fuses[jedec->QF - 1] = (buffer[0] >> 7) & 0x01;
+		jedec_set_fuse(jedec, jedec->QF - 1, (buffer[0] >> 7) & 0x01);
 	}
 
 	gettimeofday(&end, NULL);
@@ -1386,7 +1626,7 @@ int read_jedec(minipro_handle_t *handle, jedec_t *jedec)
 /* Write PLD device */
 int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 {
-	size_t i, j;
+	size_t i;
 	struct timeval begin, end;
 	gettimeofday(&begin, NULL);
 
@@ -1407,10 +1647,8 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	for (i = 0; i < config->fuses_size; i++) {
 		memset(buffer, 0, sizeof(buffer));
 		/* Building a row */
-		for (j = 0; j < config->row_width; j++) {
-			if (jedec->fuses[config->fuses_size * j + i] == 1)
-				buffer[j / 8] |= (0x80 >> (j & 0x07));
-		}
+		jedec_gather(jedec, buffer, i, config->fuses_size,
+			     config->row_width);
 		update_status(status_msg, "%2d%%",
 			      i * 100 / config->fuses_size);
 		if (minipro_write_jedec_row(handle, buffer, i, 0,
@@ -1424,10 +1662,8 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	if ((config->ues_address != 0) && (config->ues_size != 0) &&
 	    ((config->ues_address + config->ues_size) <= jedec->QF) &&
 	    !(handle->device->voltages.vdd & ATF_IN_PAL_COMPAT_MODE)) {
-		for (j = 0; j < config->ues_size; j++) {
-			if (jedec->fuses[config->ues_address + j] == 1)
-				buffer[j / 8] |= (0x80 >> (j & 0x07));
-		}
+		jedec_gather(jedec, buffer, config->ues_address, 1,
+			     config->ues_size);
 	}
 	/* UES field is always written, even when not contained in JEDEC */
 	if (minipro_write_jedec_row(handle, buffer, i, 0, config->ues_size))
@@ -1436,7 +1672,7 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	/* Write architecture control word (ACW) */
 	memset(buffer, 0, sizeof(buffer));
 	for (i = 0; i < config->acw_size; i++) {
-		if (jedec->fuses[config->acw_bits[i]] == 1)
+		if (jedec_get_fuse(jedec, config->acw_bits[i]))
 			buffer[i / 8] |= (0x80 >> (i & 0x07));
 	}
 	if (minipro_write_jedec_row(handle, buffer, config->acw_address,
@@ -1447,7 +1683,7 @@ int write_jedec(minipro_handle_t *handle, jedec_t *jedec)
 	if (config->powerdown_row != 0) {
 		/* only '0' bits shall be written */
 		if (((handle->device->flags.has_power_down) &&
-		     (jedec->fuses[jedec->QF - 1] == 0)) ||
+		     !jedec_get_fuse(jedec, jedec->QF - 1)) ||
 		     (handle->device->flags.is_powerdown_disabled)) {
 			memset(buffer, 0, sizeof(buffer));
 			if (minipro_write_jedec_row(handle, buffer,
@@ -1485,143 +1721,139 @@ int erase_device(minipro_handle_t *handle)
 	return EXIT_SUCCESS;
 }
 
-/* Opens a physical file or a pipe if the pipe character is specified */
-int open_file(minipro_handle_t *handle, uint8_t *data, size_t *file_size)
+/* The format of the input file once it is known */
+static int input_format = LOADER_AUTO;
+
+/* The image file being read or written and its current section. The
+ * section data goes through a temporary file. */
+static image_t *image;
+static int image_section = -1;
+
+/* A temporary file holding the current image section */
+static FILE *open_section(void)
+{
+	image_section_t *section = &image->sections[image_section];
+	FILE *file = tmpfile();
+	if (!file) {
+		perror("Can't create temporary file");
+		return NULL;
+	}
+	if (fwrite(section->data, 1, section->length, file) !=
+	    section->length) {
+		perror("File write error");
+		fclose(file);
+		return NULL;
+	}
+	rewind(file);
+	return file;
+}
+
+/* Opens a physical file or a pipe if the pipe character is specified.
+ * Hex files are loaded relative to the start address.
+ * The address ranges holding file data are added to extents if not NULL.
+ * Returns a loader which has read the first chunk of the file. */
+static loader_t *open_loader(minipro_handle_t *handle, uint8_t *data,
+			     uint32_t start, size_t size, extents_t *extents)
 {
 	FILE *file;
-	struct stat st;
+	int gzip = 0;
 
 	/* Check if we are dealing with a pipe. */
-	if (handle->cmdopts->is_pipe) {
+	if (image && image_section >= 0) {
+		file = open_section();
+		if (!file)
+			return NULL;
+	} else if (handle->cmdopts->is_pipe)
 		file = stdin;
-		st.st_size = 0;
-	} else {
+	else {
 		file = fopen(handle->cmdopts->filename, "rb");
-		int ret = stat(handle->cmdopts->filename, &st);
-		if (!file || ret) {
+		if (!file) {
 			fprintf(stderr, "Could not open file %s for reading.\n",
 				handle->cmdopts->filename);
 			perror("");
-			if (file)
-				fclose(file);
-			return EXIT_FAILURE;
+			return NULL;
 		}
+		gzip = loader_gzip_name(handle->cmdopts->filename);
 	}
 
-	/* Allocate a zero initialized buffer.
-	 * If the file size is unknown (pipe) a default size will be used. */
-	uint8_t *buffer = calloc(1, st.st_size ? st.st_size : READ_BUFFER_SIZE);
-	if (!buffer) {
-		fclose(file);
-		fprintf(stderr, "Out of memory!\n");
-		return EXIT_FAILURE;
-	}
-
-	/* Try to read the whole file.
-	 * If we are reading from stdin, data will be read in small
-	 * chunks of 64K each until EOF. */
-	size_t br = 0;
-	size_t sz = READ_BUFFER_SIZE;
-	if (!st.st_size) {
-		size_t ch;
-		uint8_t *tmp;
-		while (br < UINT32_MAX) {
-			ch = fread(buffer + br, 1, READ_BUFFER_SIZE, file);
-			br += ch;
-			if (ch != READ_BUFFER_SIZE)
-				break;
-			sz += READ_BUFFER_SIZE;
-			tmp = realloc(buffer, sz);
-			if (!tmp) {
-				free(buffer);
-				fclose(file);
-				fprintf(stderr, "Out of memory!\n");
-				return EXIT_FAILURE;
-			}
-			buffer = tmp;
-		}
-	} else
-		br = fread(buffer, 1, st.st_size, file);
-
-	fclose(file);
-	if (!br) {
-		fprintf(stderr, "No data to read.\n");
-		free(buffer);
-		return EXIT_FAILURE;
-	}
+	/* JED files are parsed by the caller. Otherwise the format is
+	 * expected from -f, an earlier open or the file name. */
+	int format = input_format;
+	if (handle->device->chip_type == MP_PLD ||
+	    handle->cmdopts->format == IMAGE)
+		format = LOADER_BINARY;
+	else if (handle->cmdopts->format == IHEX)
+		format = LOADER_IHEX;
+	else if (handle->cmdopts->format == SREC)
+		format = LOADER_SREC;
+	else if (format == LOADER_AUTO && !handle->cmdopts->is_pipe)
+		format = loader_guess_format(handle->cmdopts->filename);
 
-	/* If we are dealing with a jed file just return the data. */
-	if (handle->device->chip_type == MP_PLD) {
-		memcpy(data, buffer, br);
-		free(buffer);
-		*file_size = br;
-		return EXIT_SUCCESS;
-	}
+	if (gzip && format != LOADER_AUTO)
+		format |= LOADER_GZIP;
 
-	size_t chip_size = *file_size;
-	*file_size = br;
+	loader_t *loader =
+		loader_open(file, format, data, start, size, extents);
+	if (!loader || handle->device->chip_type == MP_PLD)
+		return loader;
 
-	/* Probe for an Intel hex file */
-	size_t hex_size = chip_size;
-	int ret = read_hex_file(buffer, data, &hex_size);
-	switch (ret) {
-	case NOT_IHEX:
-		break;
-	case EXIT_FAILURE:
-		free(buffer);
-		return EXIT_FAILURE;
-		break;
-	case INTEL_HEX_FORMAT:
-		*file_size = hex_size;
+	switch (loader->format) {
+	case LOADER_IHEX:
 		fprintf(stderr, "Found Intel hex file.\n");
-		free(buffer);
-		return EXIT_SUCCESS;
-	}
-
-	/* Probe for a Motorola srec file */
-	hex_size = chip_size;
-	ret = read_srec_file(buffer, data, &hex_size);
-	switch (ret) {
-	case NOT_SREC:
-		break;
-	case EXIT_FAILURE:
-		free(buffer);
-		return EXIT_FAILURE;
 		break;
-	case SREC_FORMAT:
-		*file_size = hex_size;
+	case LOADER_SREC:
 		fprintf(stderr, "Found Motorola S-Record file.\n");
-		free(buffer);
-		return EXIT_SUCCESS;
+		break;
+	case LOADER_ELF:
+		fprintf(stderr, "Found ELF file.\n");
+		break;
 	}
-
-	if (handle->cmdopts->format == IHEX) {
+	if (handle->cmdopts->format == IHEX && loader->format != LOADER_IHEX) {
 		fprintf(stderr, "This is not an Intel hex file.\n");
-		free(buffer);
-		return EXIT_FAILURE;
+		loader_close(loader);
+		return NULL;
 	}
-	if (handle->cmdopts->format == SREC) {
+	if (handle->cmdopts->format == SREC && loader->format != LOADER_SREC) {
 		fprintf(stderr, "This is not an S-Record file.\n");
-		free(buffer);
-		return EXIT_FAILURE;
+		loader_close(loader);
+		return NULL;
 	}
-	/* This must be a binary file */
-	memcpy(data, buffer, *file_size > chip_size ? chip_size : *file_size);
-	free(buffer);
-	return EXIT_SUCCESS;
+	input_format = loader->format | (loader->gz ? LOADER_GZIP : 0);
+	return loader;
+}
+
+/* Load a whole file, see open_loader */
+int open_file(minipro_handle_t *handle, uint8_t *data, uint32_t start,
+	      size_t *file_size, extents_t *extents)
+{
+	loader_t *loader =
+		open_loader(handle, data, start, *file_size, extents);
+	if (!loader)
+		return EXIT_FAILURE;
+
+	int ret = loader_finish(loader);
+	*file_size = loader->file_size;
+	loader_close(loader);
+	return ret;
 }
 
 /* Open a JED file */
 int open_jed_file(minipro_handle_t *handle, jedec_t *jedec)
 {
-	char *buffer = calloc(1, READ_BUFFER_SIZE);
+	char *buffer = calloc(1, JED_MAX_SIZE);
 	if (!buffer) {
 		fprintf(stderr, "Out of memory!\n");
 		return EXIT_FAILURE;
 	}
 
-	size_t file_size = handle->device->code_memory_size;
-	if (open_file(handle, (uint8_t *)buffer, &file_size)) {
+	/* Keep the text null terminated */
+	size_t file_size = JED_MAX_SIZE - 1;
+	if (open_file(handle, (uint8_t *)buffer, 0, &file_size, NULL)) {
+		free(buffer);
+		return EXIT_FAILURE;
+	}
+	if (file_size > JED_MAX_SIZE - 1) {
+		fprintf(stderr, "JED file too large.\n");
 		free(buffer);
 		return EXIT_FAILURE;
 	}
@@ -1654,10 +1886,18 @@ int open_jed_file(minipro_handle_t *handle, jedec_t *jedec)
 	return EXIT_SUCCESS;
 }
 
+/* The compressed output file, if any */
+static gzio_t *output_gz;
+
+/* Open the output file, compressed if the name ends in .gz */
 FILE *get_file(minipro_handle_t *handle)
 {
 	FILE *file;
-	if (handle->cmdopts->is_pipe)
+	if (image && image_section >= 0) {
+		file = tmpfile();
+		if (!file)
+			perror("Can't create temporary file");
+	} else if (handle->cmdopts->is_pipe)
 		file = stdout;
 	else {
 		file = fopen(handle->cmdopts->filename, "wb");
@@ -1667,35 +1907,200 @@ FILE *get_file(minipro_handle_t *handle)
 			perror("");
 			return NULL;
 		}
+		size_t len = strlen(handle->cmdopts->filename);
+		if (len > 3 &&
+		    !strcasecmp(handle->cmdopts->filename + len - 3, ".gz")) {
+			output_gz = gzio_open_write(
+				file, handle->cmdopts->compress_level);
+			if (!output_gz)
+				return NULL;
+			file = output_gz->stream;
+		}
 	}
 	return file;
 }
 
-/* Wrappers for operating with files */
-int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
+/* Move a temporary file into the current image section */
+static int close_section(FILE *file)
 {
-	/* Allocate the buffer and clear it with default value */
-	uint8_t *file_data = malloc(size);
-	if (!file_data) {
+	int ret = EXIT_FAILURE;
+	uint8_t *buffer = NULL;
+	long length = ftell(file);
+	if (length < 0) {
+		perror("File read error");
+		goto cleanup;
+	}
+	buffer = malloc(length + 1);
+	if (!buffer) {
 		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+	rewind(file);
+	if (fread(buffer, 1, length, file) != (size_t)length) {
+		perror("File read error");
+		goto cleanup;
+	}
+	ret = image_set_section(image, image_section, buffer, length);
+
+cleanup:
+	free(buffer);
+	fclose(file);
+	return ret;
+}
+
+/* Close a file from get_file, this is when compression completes */
+static int close_file(FILE *file)
+{
+	if (image && image_section >= 0)
+		return close_section(file);
+	if (output_gz && output_gz->stream == file) {
+		int ret = gzio_close(output_gz);
+		output_gz = NULL;
+		return ret;
+	}
+	if (fclose(file)) {
+		perror("File write error");
 		return EXIT_FAILURE;
 	}
+	return EXIT_SUCCESS;
+}
 
-	memset(file_data, handle->device->blank_value, size);
-	size_t file_size = size;
-	if (open_file(handle, file_data, &file_size))
+/* Narrow a page operation down to the --offset/--length address range.
+ * The range must be aligned to the transfer block size so only whole
+ * blocks are read or written, except for the last block of the page. */
+static int get_page_range(minipro_handle_t *handle, size_t align,
+			  uint32_t *start, size_t *size)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	size_t page_size = *size;
+
+	*start = 0;
+	if (!cmdopts->offset && !cmdopts->length)
+		return EXIT_SUCCESS;
+
+	if (cmdopts->offset >= page_size ||
+	    cmdopts->length > page_size - cmdopts->offset) {
+		fprintf(stderr,
+			"Address range exceeds the memory size (0x%zX).\n",
+			page_size);
+		return EXIT_FAILURE;
+	}
+	size_t length = cmdopts->length ? cmdopts->length :
+					  page_size - cmdopts->offset;
+	align = MIN(align, page_size);
+	if (cmdopts->offset % align ||
+	    (length % align && cmdopts->offset + length != page_size)) {
+		fprintf(stderr,
+			"Offset and length must be multiples of 0x%zX bytes.\n",
+			align);
 		return EXIT_FAILURE;
-	if (file_size != size) {
-		if (!handle->cmdopts->size_error) {
+	}
+
+	*start = cmdopts->offset;
+	*size = length;
+	fprintf(stderr, "Address range: 0x%06X-0x%06zX\n", *start,
+		*start + length - 1);
+	return EXIT_SUCCESS;
+}
+
+/* Compare the file data with the chip data and report the first mismatch.
+ * If extents is not NULL only the address ranges holding file data are
+ * compared, the gaps between them are don't care. */
+static int compare_page(minipro_handle_t *handle, uint8_t type, uint32_t start,
+			uint8_t *file_data, uint8_t *chip_data,
+			size_t file_size, size_t size,
+			const extents_t *extents)
+{
+	int ret = EXIT_SUCCESS;
+	uint8_t c1 = 0, c2 = 0;
+	uint16_t cw1 = 0, cw2 = 0;
+	uint32_t address = 0, offset = 0;
+	uint16_t compare_mask =
+		(type == MP_CODE) ? handle->device->compare_mask : 0xff;
+	size_t i, count = extents ? extents->count : 1;
+
+	for (i = 0; i < count && !ret; i++) {
+		size_t size1 = file_size, size2 = size;
+		if (extents) {
+			offset = extents->list[i].start;
+			size1 = extents->list[i].length;
+			/* Word devices are compared in whole words */
+			if (compare_mask > 0xff) {
+				size1 += offset & 1;
+				offset &= ~1;
+				size1 += size1 & 1;
+			}
+			if (offset >= size)
+				break;
+			size1 = MIN(size1, size - offset);
+			size2 = size1;
+		}
+		if (compare_mask > 0xff) {
+			ret = compare_word_memory(0xffff, compare_mask, 1,
+						  file_data + offset,
+						  chip_data + offset, size1,
+						  size2, &address, &cw1, &cw2);
+		} else {
+			ret = compare_memory(compare_mask, file_data + offset,
+					     chip_data + offset, size1, size2,
+					     &address, &c1, &c2);
+		}
+	}
+
+	if (ret) {
+		if (compare_mask > 0xff) {
 			fprintf(stderr,
-				"Incorrect file size: %zu (needed %zu, use -s/S to ignore)\n",
-				file_size, size);
-			free(file_data);
-			return EXIT_FAILURE;
-		} else if (handle->cmdopts->size_nowarn == 0)
+				"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
+				start + offset + address, cw1, cw2);
+		} else {
 			fprintf(stderr,
-				"Warning: Incorrect file size: %zu (needed %zu)\n",
-				file_size, size);
+				"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
+				start + offset + address, c1, c2);
+		}
+	}
+	return ret;
+}
+
+/* Check the file size against the page size */
+static int check_file_size(minipro_handle_t *handle, size_t file_size,
+			   size_t size)
+{
+	if (file_size == size)
+		return EXIT_SUCCESS;
+	if (!handle->cmdopts->size_error) {
+		fprintf(stderr,
+			"Incorrect file size: %zu (needed %zu, use -s/S to ignore)\n",
+			file_size, size);
+		return EXIT_FAILURE;
+	} else if (handle->cmdopts->size_nowarn == 0)
+		fprintf(stderr, "Warning: Incorrect file size: %zu (needed %zu)\n",
+			file_size, size);
+	return EXIT_SUCCESS;
+}
+
+/* Prepare the chip for writing, also re-run after a reconnect */
+static int write_setup(minipro_handle_t *handle)
+{
+	if (handle->cmdopts->protect_off &&
+	    handle->device->flags.off_protect_before) {
+		if (minipro_protect_off(handle))
+			return EXIT_FAILURE;
+		fprintf(stderr, "Protect off...OK\n");
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Write and verify the file data loaded by write_page_file.
+ * Only the blocks holding file data are written. If a loader is given
+ * the file is still being read and its size is checked at the end. */
+static int write_page_data(minipro_handle_t *handle, uint8_t type,
+			   uint32_t start, uint8_t *file_data,
+			   size_t file_size, size_t size, extents_t *extents,
+			   loader_t *loader)
+{
+	if (!loader && file_size != size) {
+		if (check_file_size(handle, file_size, size))
+			return EXIT_FAILURE;
 
 		/* The size of our array must be a multiple of
 		 * handle->device->read_buffer_size, otherwise read_page_ram
@@ -1707,46 +2112,64 @@ int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 			size += buffer_size - size_mod;
 	}
 
-	/* Perform an erase first */
-	if (erase_device(handle)) {
-		free(file_data);
+	/* Resume an interrupted write if there is a journal */
+	journal_t *journal = NULL;
+	if (handle->cmdopts->journal_path) {
+		journal = journal_open(handle->cmdopts->journal_path,
+				       handle->device->name, JOURNAL_WRITE,
+				       type, start, file_data, size,
+				       handle->device->write_buffer_size);
+		if (!journal)
+			return EXIT_FAILURE;
+	}
+
+	/* Perform an erase first, but never erase what was already written */
+	if ((!journal || !journal->resumed) && erase_device(handle)) {
+		journal_close(journal, 0);
 		return EXIT_FAILURE;
 	}
 	/* We must reset the transaction after the erase */
 	if (minipro_end_transaction(handle)) {
-		free(file_data);
+		journal_close(journal, 0);
 		return EXIT_FAILURE;
 	}
 	if (minipro_begin_transaction(handle)) {
-		free(file_data);
+		journal_close(journal, 0);
 		return EXIT_FAILURE;
 	}
 
-	if (handle->cmdopts->protect_off &&
-	    handle->device->flags.off_protect_before) {
-		if (minipro_protect_off(handle)) {
-			free(file_data);
-			return EXIT_FAILURE;
-		}
-		fprintf(stderr, "Protect off...OK\n");
+	if (write_setup(handle)) {
+		journal_close(journal, 0);
+		return EXIT_FAILURE;
 	}
 
-	if (write_page_ram(handle, file_data, type, size)) {
-		free(file_data);
+	if (handle->session)
+		handle->session->setup = write_setup;
+	int ret = write_page_ram(handle, file_data, type, start, size,
+				 journal, extents, loader);
+	if (handle->session)
+		handle->session->setup = NULL;
+	if (ret) {
+		journal_close(journal, 0);
 		return EXIT_FAILURE;
 	}
+	journal_close(journal, 1);
+
+	if (loader) {
+		if (loader_finish(loader))
+			return EXIT_FAILURE;
+		file_size = loader->file_size;
+		if (check_file_size(handle, file_size, size))
+			return EXIT_FAILURE;
+	}
 
 	/* Verify if data was written ok */
 	if (handle->cmdopts->no_verify == 0) {
 		/* We must reset the transaction for VCC verify to have effect */
-		if (minipro_end_transaction(handle)) {
-			free(file_data);
+		if (minipro_end_transaction(handle))
 			return EXIT_FAILURE;
-		}
-		if (minipro_begin_transaction(handle)) {
-			free(file_data);
+		if (minipro_begin_transaction(handle))
 			return EXIT_FAILURE;
-		}
 
 		/* There is an off by one bug in T56 firmware.
 		 * Allocate couple extra bytes to prevent buffer overflow.
@@ -1755,55 +2178,92 @@ int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 		uint8_t *chip_data = malloc(size + 16);
 		if (!chip_data) {
 			fprintf(stderr, "Out of memory\n");
-			free(file_data);
 			return EXIT_FAILURE;
 		}
-		if (read_page_ram(handle, chip_data, type, size)) {
-			free(file_data);
+
+		/* The gaps are read back too if they must be blank */
+		if (handle->cmdopts->blank_gaps)
+			extents = NULL;
+		if (read_page_ram(handle, chip_data, type, start, size, NULL,
+				  extents)) {
 			free(chip_data);
 			return EXIT_FAILURE;
 		}
 
-		int ret;
-		uint8_t c1 = 0, c2 = 0;
-		uint16_t cw1 = 0, cw2 = 0;
-		uint32_t address;
-		uint16_t compare_mask =
-			(type == MP_CODE) ? handle->device->compare_mask : 0xff;
-		if (compare_mask > 0xff) {
-			ret = compare_word_memory(0xffff, compare_mask, 1,
-						  file_data, chip_data,
-						  file_size, size, &address,
-						  &cw1, &cw2);
-		} else {
-			ret = compare_memory(compare_mask, file_data, chip_data,
-					     file_size, size, &address, &c1,
-					     &c2);
-		}
-
+		int ret = compare_page(handle, type, start, file_data,
+				       chip_data, file_size, size, extents);
 		free(chip_data);
-		free(file_data);
-
-		if (ret) {
-			if (compare_mask > 0xff) {
-				fprintf(stderr,
-					"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
-					address, cw1, cw2);
-			} else {
-				fprintf(stderr,
-					"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
-					address, c1, c2);
-			}
+		if (ret)
 			return EXIT_FAILURE;
-		} else {
-			fprintf(stderr, "Verification OK\n");
-		}
+		fprintf(stderr, "Verification OK\n");
 	}
 	return EXIT_SUCCESS;
 }
 
+/* Wrappers for operating with files */
+int write_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
+{
+	uint32_t start;
+	if (get_page_range(handle, handle->device->write_buffer_size, &start,
+			   &size))
+		return EXIT_FAILURE;
+
+	/* The erase command always wipes the whole chip */
+	if ((handle->cmdopts->offset || handle->cmdopts->length) &&
+	    !handle->cmdopts->no_erase && handle->device->flags.can_erase) {
+		fprintf(stderr,
+			"Erasing would wipe the whole chip, use -e to write an address range.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Allocate the buffer and clear it with default value */
+	uint8_t *file_data = malloc(size);
+	if (!file_data) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(file_data, handle->device->blank_value, size);
+	size_t file_size = size;
+	extents_t extents = { 0 };
+
+	/* A piped file is programmed while it is still arriving.
+	 * The journal needs the whole file up front. */
+	loader_t *loader = NULL;
+	int ret;
+	if (handle->cmdopts->is_pipe && !handle->cmdopts->journal_path) {
+		loader = open_loader(handle, file_data, start, size, &extents);
+		ret = loader ? EXIT_SUCCESS : EXIT_FAILURE;
+
+		/* Hex records place their own data, but a binary file of the
+		 * wrong size would only be found after the erase. Unless -s/-S
+		 * allow any size it is read whole and checked first. */
+		if (loader && loader->format == LOADER_BINARY &&
+		    !handle->cmdopts->size_error) {
+			ret = loader_finish(loader);
+			file_size = loader->file_size;
+			loader_close(loader);
+			loader = NULL;
+		}
+	} else
+		ret = open_file(handle, file_data, start, &file_size,
+				&extents);
+	if (!ret)
+		ret = write_page_data(handle, type, start, file_data,
+				      file_size, size, &extents, loader);
+	loader_close(loader);
+	extents_free(&extents);
+	free(file_data);
+	return ret;
+}
+
 int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 {
+	uint32_t start;
+	if (get_page_range(handle, handle->device->read_buffer_size, &start,
+			   &size))
+		return EXIT_FAILURE;
+
 	FILE *file = get_file(handle);
 	if (!file)
 		return EXIT_FAILURE;
@@ -1815,28 +2275,49 @@ int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	uint8_t *buffer = malloc(size + 16);
 	if (!buffer) {
 		fprintf(stderr, "Out of memory\n");
-		fclose(file);
+		close_file(file);
 		return EXIT_FAILURE;
 	}
 
 	memset(buffer, handle->device->blank_value, size);
-	if (read_page_ram(handle, buffer, type, size)) {
-		fclose(file);
+
+	/* Resume an interrupted read if there is a journal */
+	journal_t *journal = NULL;
+	if (handle->cmdopts->journal_path) {
+		journal = journal_open(handle->cmdopts->journal_path,
+				       handle->device->name, JOURNAL_READ, type,
+				       start, buffer, size,
+				       MIN(size,
+					   handle->device->read_buffer_size));
+		if (!journal) {
+			close_file(file);
+			free(buffer);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (read_page_ram(handle, buffer, type, start, size, journal, NULL)) {
+		journal_close(journal, 0);
+		close_file(file);
 		free(buffer);
 		return EXIT_FAILURE;
 	}
 
 	switch (handle->cmdopts->format) {
 	case IHEX:
-		if (write_hex_file(file, buffer, 0, size, 1)) {
-			fclose(file);
+		if (write_hex_file(file, buffer, start, size,
+				   handle->cmdopts->record_length, 1)) {
+			journal_close(journal, 0);
+			close_file(file);
 			free(buffer);
 			return EXIT_FAILURE;
 		}
 		break;
 	case SREC:
-		if (write_srec_file(file, buffer, 0, size, 1)) {
-			fclose(file);
+		if (write_srec_file(file, buffer, start, size,
+				    handle->cmdopts->record_length, 1)) {
+			journal_close(journal, 0);
+			close_file(file);
 			free(buffer);
 			return EXIT_FAILURE;
 		}
@@ -1845,9 +2326,10 @@ int read_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 		fwrite(buffer, 1, size, file);
 	}
 
-	fclose(file);
 	free(buffer);
-	return EXIT_SUCCESS;
+	/* Kept until all pages are read, see action_read() */
+	journal_close(journal, 0);
+	return close_file(file);
 }
 
 int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
@@ -1865,6 +2347,10 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	default:
 		name = "Code";
 	}
+	uint32_t start;
+	if (get_page_range(handle, handle->device->read_buffer_size, &start,
+			   &size))
+		return EXIT_FAILURE;
 	size_t file_size = size;
 
 	/* Allocate the buffer and clear it with default value */
@@ -1873,24 +2359,20 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 		fprintf(stderr, "Out of memory!\n");
 		return EXIT_FAILURE;
 	}
+	extents_t extents = { 0 };
 	if (handle->cmdopts->filename) {
 		memset(file_data, handle->device->blank_value, size);
-		if (open_file(handle, file_data, &file_size)) {
+		if (open_file(handle, file_data, start, &file_size,
+			      &extents)) {
+			extents_free(&extents);
 			free(file_data);
 			return EXIT_FAILURE;
 		}
 
-		if (file_size != size) {
-			if (!handle->cmdopts->size_error) {
-				fprintf(stderr,
-					"Incorrect file size: %zu (needed %zu, use -s/S to ignore)\n",
-					file_size, size);
-				free(file_data);
-				return EXIT_FAILURE;
-			} else if (handle->cmdopts->size_nowarn == 0)
-				fprintf(stderr,
-					"Warning: Incorrect file size: %zu (needed %zu)\n",
-					file_size, size);
+		if (check_file_size(handle, file_size, size)) {
+			extents_free(&extents);
+			free(file_data);
+			return EXIT_FAILURE;
 		}
 
 	}
@@ -1898,54 +2380,40 @@ int verify_page_file(minipro_handle_t *handle, uint8_t type, size_t size)
 	else
 		memset(file_data, handle->device->blank_value, size);
 
+	/* Only the file data is verified unless the gaps must be blank */
+	extents_t *ranges = &extents;
+	if (!handle->cmdopts->filename || handle->cmdopts->blank_gaps)
+		ranges = NULL;
+
 	/* Downloading data from chip*/
 	uint8_t *chip_data = malloc(size + 128);
 	if (!chip_data) {
 		fprintf(stderr, "Out of memory!\n");
+		extents_free(&extents);
 		free(file_data);
 		return EXIT_FAILURE;
 	}
-	if (read_page_ram(handle, chip_data, type, size)) {
+	if (read_page_ram(handle, chip_data, type, start, size, NULL,
+			  ranges)) {
+		extents_free(&extents);
 		free(file_data);
 		free(chip_data);
 		return EXIT_FAILURE;
 	}
 
-	int ret;
-	uint8_t c1 = 0, c2 = 0;
-	uint16_t cw1 = 0, cw2 = 0;
-	uint32_t address;
-	uint16_t compare_mask =
-		(type == MP_CODE) ? handle->device->compare_mask : 0xff;
-	if (compare_mask > 0xff) {
-		ret = compare_word_memory(0xffff, compare_mask, 1, file_data,
-					  chip_data, file_size, size, &address,
-					  &cw1, &cw2);
-	} else {
-		ret = compare_memory(compare_mask, file_data, chip_data,
-				     file_size, size, &address, &c1, &c2);
-	}
+	int ret = compare_page(handle, type, start, file_data, chip_data,
+			       file_size, size, ranges);
 
+	extents_free(&extents);
 	free(file_data);
 	free(chip_data);
 
-	if (ret) {
-		if (compare_mask > 0xff) {
-			fprintf(stderr,
-				"Verification failed at address 0x%04X: File=0x%04X, Device=0x%04X\n",
-				address, cw1, cw2);
-		} else {
-			fprintf(stderr,
-				"Verification failed at address 0x%04X: File=0x%02X, Device=0x%02X\n",
-				address, c1, c2);
-		}
+	if (ret)
 		return EXIT_FAILURE;
+	if (handle->cmdopts->filename) {
+		fprintf(stderr, "Verification OK\n");
 	} else {
-		if (handle->cmdopts->filename) {
-			fprintf(stderr, "Verification OK\n");
-		} else {
-			fprintf(stderr, "%s memory section is blank.\n", name);
-		}
+		fprintf(stderr, "%s memory section is blank.\n", name);
 	}
 	return EXIT_SUCCESS;
 }
@@ -1966,7 +2434,7 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 	if (handle->cmdopts->page == CALIBRATION) {
 		if (minipro_read_calibration(handle, buffer,
 					     fuses->num_calibytes)) {
-			fclose(file);
+			close_file(file);
 			return EXIT_FAILURE;
 		}
 
@@ -1976,7 +2444,8 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				i < fuses->num_calibytes - 1 ? ", " : "");
 		}
 		fprintf(file, "\n");
-		fclose(file);
+		if (close_file(file))
+			return EXIT_FAILURE;
 		fprintf(stderr, "Reading calibration bytes... OK\n");
 		return EXIT_SUCCESS;
 	}
@@ -1987,20 +2456,20 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 
 	if (cmdopts->filter_fuses && !fuses->num_fuses) {
 		fprintf(stderr, "No fuse section to read!\n");
-		fclose(file);
+		close_file(file);
 		return EXIT_FAILURE;
 	}
 
 	if (cmdopts->filter_uid && !fuses->num_uids) {
 		fprintf(stderr, "No user id section to read!\n");
-		fclose(file);
+		close_file(file);
 		return EXIT_FAILURE;
 	}
 
 	if (cmdopts->filter_locks &&
 	    (handle->device->flags.lock_bit_write_only || !fuses->num_locks)) {
 		fprintf(stderr, "Can't read the lock byte for this device!\n");
-		fclose(file);
+		close_file(file);
 		return EXIT_FAILURE;
 	}
 
@@ -2015,7 +2484,7 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 				       fuses->num_fuses *
 					       handle->device->flags.word_size,
 				       items, buffer)) {
-			fclose(file);
+			close_file(file);
 			return EXIT_FAILURE;
 		}
 		for (i = 0; i < fuses->num_fuses; i++) {
@@ -2043,7 +2512,7 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 		if (minipro_read_fuses(handle, MP_FUSE_USER,
 				       fuses->num_uids * item_size, 0,
 				       buffer)) {
-			fclose(file);
+			close_file(file);
 			return EXIT_FAILURE;
 		}
 		for (i = 0; i < fuses->num_uids; i++) {
@@ -2064,7 +2533,7 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 			    handle, MP_FUSE_LOCK,
 			    fuses->num_locks * handle->device->flags.word_size,
 			    handle->device->flags.word_size, buffer)) {
-			fclose(file);
+			close_file(file);
 			return EXIT_FAILURE;
 		}
 		for (i = 0; i < fuses->num_locks; i++) {
@@ -2088,8 +2557,7 @@ int read_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 	fprintf(stderr, "Reading config... %.2fSec  OK\n",
 		(double)(end.tv_usec - begin.tv_usec) / 1000000 +
 			(double)(end.tv_sec - begin.tv_sec));
-	fclose(file);
-	return EXIT_SUCCESS;
+	return close_file(file);
 }
 
 int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
@@ -2102,7 +2570,7 @@ int write_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 
 	memset(config, 0, sizeof(config));
 	size_t file_size = sizeof(config);
-	if (open_file(handle, (uint8_t *)config, &file_size))
+	if (open_file(handle, (uint8_t *)config, 0, &file_size, NULL))
 		return EXIT_FAILURE;
 
 	/* Perform an erase first if requested */
@@ -2319,7 +2787,7 @@ int verify_fuses(minipro_handle_t *handle, fuse_decl_t *fuses)
 	memset(config, 0, sizeof(config));
 	size_t file_size = sizeof(config);
 	if (handle->cmdopts->filename &&
-	    open_file(handle, (uint8_t *)config, &file_size))
+	    open_file(handle, (uint8_t *)config, 0, &file_size, NULL))
 		return EXIT_FAILURE;
 
 	if (minipro_begin_transaction(handle))
@@ -2519,6 +2987,181 @@ char *get_default_filename(const char *filename)
 	return default_filename;
 }
 
+/* Run a page or fuse action on every image section selected with -c.
+ * Sections the chip doesn't have are skipped, as are sections missing
+ * from a loaded image. */
+static int image_sections(minipro_handle_t *handle,
+			  int (*page_func)(minipro_handle_t *, uint8_t, size_t),
+			  int (*fuse_func)(minipro_handle_t *, fuse_decl_t *))
+{
+	static const uint8_t pages[] = { CODE, DATA, USER, CONFIG };
+	static const uint8_t types[] = { MP_CODE, MP_DATA, MP_USER, 0 };
+	device_t *device = handle->device;
+	size_t sizes[] = { device->code_memory_size, device->data_memory_size,
+			   device->data_memory2_size, device->config != NULL };
+	uint8_t page = handle->cmdopts->page;
+	int i, ret = EXIT_SUCCESS;
+
+	for (i = 0; i < IMAGE_SECTIONS && !ret; i++) {
+		if (page != UNSPECIFIED && page != pages[i])
+			continue;
+		if (!sizes[i] ||
+		    (image->buffer && !image->sections[i].data)) {
+			if (page == UNSPECIFIED)
+				continue;
+			fprintf(stderr, "No %s section found.\n",
+				image_section_name(i));
+			ret = EXIT_FAILURE;
+			break;
+		}
+		image_section = i;
+		if (i == IMAGE_CONFIG)
+			ret = fuse_func(handle, device->config);
+		else
+			ret = page_func(handle, types[i], sizes[i]);
+		image_section = -1;
+	}
+	return ret;
+}
+
+/* Load and check an image file */
+static int open_image(minipro_handle_t *handle)
+{
+	device_t *device = handle->device;
+	size_t size = image_max_size(device->code_memory_size +
+				     device->data_memory_size +
+				     device->data_memory2_size + 1024);
+	uint8_t *buffer = malloc(size);
+	if (!buffer) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	size_t file_size = size;
+	if (open_file(handle, buffer, 0, &file_size, NULL)) {
+		free(buffer);
+		return EXIT_FAILURE;
+	}
+	if (file_size > size) {
+		fprintf(stderr, "Image file too large.\n");
+		free(buffer);
+		return EXIT_FAILURE;
+	}
+	image = image_parse(buffer, file_size);
+	if (!image)
+		return EXIT_FAILURE;
+	fprintf(stderr, "Found image file for %s.\n", image->device_name);
+	if (strcasecmp(image->device_name, device->name))
+		fprintf(stderr,
+			"\nWarning! Image file doesn't match the selected device!\n");
+	return EXIT_SUCCESS;
+}
+
+static void close_image(void)
+{
+	image_free(image);
+	image = NULL;
+}
+
+/* Read all sections into one image file */
+static int read_image(minipro_handle_t *handle)
+{
+	image = image_new(handle->device->name);
+	if (!image)
+		return EXIT_FAILURE;
+	int ret = image_sections(handle, read_page_file, read_fuses);
+	if (!ret) {
+		FILE *file = get_file(handle);
+		if (!file)
+			ret = EXIT_FAILURE;
+		else {
+			ret = image_write(file, image);
+			if (close_file(file))
+				ret = EXIT_FAILURE;
+		}
+	}
+	close_image();
+	return ret;
+}
+
+/* The chip is erased only before the first section */
+static int write_image_page(minipro_handle_t *handle, uint8_t type,
+			    size_t size)
+{
+	int ret = write_page_file(handle, type, size);
+	handle->cmdopts->no_erase = 1;
+	return ret;
+}
+
+static int write_image(minipro_handle_t *handle)
+{
+	if (open_image(handle))
+		return EXIT_FAILURE;
+	uint8_t no_erase = handle->cmdopts->no_erase;
+	int ret = image_sections(handle, write_image_page, write_fuses);
+	handle->cmdopts->no_erase = no_erase;
+	close_image();
+	return ret;
+}
+
+static int verify_image_page(minipro_handle_t *handle, uint8_t type,
+			     size_t size)
+{
+	if (minipro_begin_transaction(handle))
+		return EXIT_FAILURE;
+	return verify_page_file(handle, type, size);
+}
+
+static int verify_image(minipro_handle_t *handle)
+{
+	if (open_image(handle))
+		return EXIT_FAILURE;
+	int ret = image_sections(handle, verify_image_page, verify_fuses);
+	close_image();
+	return ret;
+}
+
+/* Check if an image file is used, its magic is peeked from plain files */
+static int check_image(minipro_handle_t *handle)
+{
+	cmdopts_t *cmdopts = handle->cmdopts;
+	if (!cmdopts->filename || (cmdopts->action != READ &&
+				   cmdopts->action != WRITE &&
+				   cmdopts->action != VERIFY)) {
+		if (cmdopts->format == IMAGE)
+			cmdopts->format = NO_FORMAT;
+		return EXIT_SUCCESS;
+	}
+	if (!cmdopts->format && !cmdopts->is_pipe &&
+	    cmdopts->action != READ) {
+		uint8_t magic[8];
+		FILE *file = fopen(cmdopts->filename, "rb");
+		if (file) {
+			size_t n = fread(magic, 1, sizeof(magic), file);
+			if (is_image(magic, n))
+				cmdopts->format = IMAGE;
+			fclose(file);
+		}
+	}
+	if (cmdopts->format != IMAGE)
+		return EXIT_SUCCESS;
+
+	if (handle->device->chip_type == MP_PLD) {
+		fprintf(stderr, "Image files can't be used with PLD devices.\n");
+		return EXIT_FAILURE;
+	}
+	if (cmdopts->page == CALIBRATION) {
+		fprintf(stderr,
+			"Calibration bytes can't be stored in an image file.\n");
+		return EXIT_FAILURE;
+	}
+	if (cmdopts->offset || cmdopts->length || cmdopts->journal_path) {
+		fprintf(stderr,
+			"An image file can't be used with --offset, --length or --journal.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 /* Higher-level logic */
 int action_read(minipro_handle_t *handle)
 {
@@ -2531,12 +3174,10 @@ int action_read(minipro_handle_t *handle)
 			fprintf(stderr, "Unknown fuse size!\n");
 			return EXIT_FAILURE;
 		}
-		jedec.fuses = malloc(jedec.QF);
-		if (!jedec.fuses) {
+		if (jedec_alloc_fuses(&jedec, 0)) {
 			fprintf(stderr, "Out of memory\n");
 			return EXIT_FAILURE;
 		}
-		memset(jedec.fuses, 0, jedec.QF);
 		jedec.F = 0;
 		jedec.G = 0;
 		jedec.QP = handle->device->package_details.pin_count;
@@ -2551,11 +3192,14 @@ int action_read(minipro_handle_t *handle)
 			return EXIT_FAILURE;
 		if (write_jedec_file(file, &jedec)) {
 			free(jedec.fuses);
-			fclose(file);
+			close_file(file);
 			return EXIT_FAILURE;
 		}
 		free(jedec.fuses);
-		fclose(file);
+		if (close_file(file))
+			return EXIT_FAILURE;
+	} else if (handle->cmdopts->format == IMAGE) {
+		return read_image(handle);
 	} else {
 		/* No GAL device */
 		char *data_filename = handle->cmdopts->filename;
@@ -2688,6 +3332,10 @@ int action_read(minipro_handle_t *handle)
 			goto cleanup;
 		}
 
+		/* All pages are read, the journals aren't needed anymore */
+		if (handle->cmdopts->journal_path)
+			journal_remove(handle->cmdopts->journal_path);
+
 cleanup:
 		free(default_data_filename);
 		free(default_user_filename);
@@ -2728,8 +3376,7 @@ int action_write(minipro_handle_t *handle)
 		if (handle->cmdopts->no_verify == 0) {
 			rjedec.QF = handle->device->code_memory_size;
 			rjedec.F = wjedec.F;
-			rjedec.fuses = malloc(rjedec.QF);
-			if (!rjedec.fuses) {
+			if (jedec_alloc_fuses(&rjedec, 0)) {
 				free(wjedec.fuses);
 				return EXIT_FAILURE;
 			}
@@ -2749,9 +3396,8 @@ int action_write(minipro_handle_t *handle)
 				free(rjedec.fuses);
 				return EXIT_FAILURE;
 			}
-			ret = compare_memory(0x01, wjedec.fuses, rjedec.fuses,
-					     wjedec.QF, rjedec.QF, &address,
-					     &c1, &c2);
+			ret = jedec_compare(&wjedec, &rjedec, &address, &c1,
+					    &c2);
 
 			/* The error output is delayed until the security
 			 * fuse has been written to avoid a 99% correctly
@@ -2795,48 +3441,60 @@ int action_write(minipro_handle_t *handle)
 		/* No GAL devices */
 		if (minipro_begin_transaction(handle))
 			return EXIT_FAILURE;
-		switch (handle->cmdopts->page) {
-		case UNSPECIFIED:
-		case CODE:
-			if (write_page_file(handle, MP_CODE,
-					    handle->device->code_memory_size))
-				return EXIT_FAILURE;
-			break;
-		case DATA:
-			if (handle->cmdopts->page == DATA &&
-			    !handle->device->data_memory_size) {
-				fprintf(stderr, "No data section found.\n");
+		if (handle->cmdopts->format == IMAGE) {
+			if (write_image(handle))
 				return EXIT_FAILURE;
-			}
-			if (write_page_file(handle, MP_DATA,
+		} else
+			switch (handle->cmdopts->page) {
+			case UNSPECIFIED:
+			case CODE:
+				if (write_page_file(
+					    handle, MP_CODE,
+					    handle->device->code_memory_size))
+					return EXIT_FAILURE;
+				break;
+			case DATA:
+				if (handle->cmdopts->page == DATA &&
+				    !handle->device->data_memory_size) {
+					fprintf(stderr,
+						"No data section found.\n");
+					return EXIT_FAILURE;
+				}
+				if (write_page_file(
+					    handle, MP_DATA,
 					    handle->device->data_memory_size))
-				return EXIT_FAILURE;
-			break;
-		case USER:
-			if (handle->cmdopts->page == USER &&
-			    !handle->device->data_memory2_size) {
-				fprintf(stderr, "No user section found.\n");
-				return EXIT_FAILURE;
-			}
-			if (write_page_file(handle, MP_USER,
+					return EXIT_FAILURE;
+				break;
+			case USER:
+				if (handle->cmdopts->page == USER &&
+				    !handle->device->data_memory2_size) {
+					fprintf(stderr,
+						"No user section found.\n");
+					return EXIT_FAILURE;
+				}
+				if (write_page_file(
+					    handle, MP_USER,
 					    handle->device->data_memory2_size))
-				return EXIT_FAILURE;
-			break;
-		case CONFIG:
-			if (handle->cmdopts->page == CONFIG &&
-			    !handle->device->config) {
-				fprintf(stderr, "No config section found.\n");
-				return EXIT_FAILURE;
-			}
-			if (handle->device->config) {
-				if (write_fuses(handle, handle->device->config))
 					return EXIT_FAILURE;
+				break;
+			case CONFIG:
+				if (handle->cmdopts->page == CONFIG &&
+				    !handle->device->config) {
+					fprintf(stderr,
+						"No config section found.\n");
+					return EXIT_FAILURE;
+				}
+				if (handle->device->config) {
+					if (write_fuses(handle,
+							handle->device->config))
+						return EXIT_FAILURE;
+				}
+				break;
+			case CALIBRATION:
+				fprintf(stderr,
+					"Calibration bytes are read only.\n");
+				return EXIT_FAILURE;
 			}
-			break;
-		case CALIBRATION:
-			fprintf(stderr, "Calibration bytes are read only.\n");
-			return EXIT_FAILURE;
-		}
 		if (handle->cmdopts->protect_on &&
 		    handle->device->flags.protect_after) {
 			fprintf(stderr, "Protect on...");
@@ -2863,8 +3521,10 @@ int action_verify(minipro_handle_t *handle)
 		else {
 			wjedec.QF = handle->device->code_memory_size;
 			wjedec.F = 0x01;
-			wjedec.fuses = malloc(wjedec.QF);
-			memset(wjedec.fuses, 0x01, wjedec.QF);
+			if (jedec_alloc_fuses(&wjedec, 1)) {
+				fprintf(stderr, "Out of memory!\n");
+				return EXIT_FAILURE;
+			}
 		}
 
 		if (minipro_begin_transaction(handle)) {
@@ -2874,8 +3534,7 @@ int action_verify(minipro_handle_t *handle)
 
 		rjedec.QF = handle->device->code_memory_size;
 		rjedec.F = wjedec.F;
-		rjedec.fuses = malloc(rjedec.QF);
-		if (!rjedec.fuses) {
+		if (jedec_alloc_fuses(&rjedec, 0)) {
 			free(wjedec.fuses);
 			return EXIT_FAILURE;
 		}
@@ -2898,8 +3557,7 @@ int action_verify(minipro_handle_t *handle)
 		uint8_t c1, c2;
 		uint32_t address;
 
-		if (compare_memory(0x01, wjedec.fuses, rjedec.fuses, wjedec.QF,
-				   rjedec.QF, &address, &c1, &c2)) {
+		if (jedec_compare(&wjedec, &rjedec, &address, &c1, &c2)) {
 			if (handle->cmdopts->filename) {
 				fprintf(stderr,
 					"Verification failed at address 0x%04X: File=0x%02X, "
@@ -2919,6 +3577,8 @@ int action_verify(minipro_handle_t *handle)
 		}
 		free(rjedec.fuses);
 		free(wjedec.fuses);
+	} else if (handle->cmdopts->format == IMAGE) {
+		ret = verify_image(handle);
 	} else {
 		/* No GAL devices */
 
@@ -3272,6 +3932,18 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	/* Keep the job alive across USB errors if requested */
+	if (cmdopts.reconnect && !session_open(handle, cmdopts.reconnect)) {
+		minipro_close(handle);
+		return EXIT_FAILURE;
+	}
+
+	/* Check the image file restrictions */
+	if (check_image(handle)) {
+		minipro_close(handle);
+		return EXIT_FAILURE;
+	}
+
 	/* Performing requested action */
 	int ret;
 	switch (cmdopts.action) {
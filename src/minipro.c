@@ -28,6 +28,7 @@
 #include "tl866iiplus.h"
 #include "t48.h"
 #include "t56.h"
+#include "session.h"
 #include "usb.h"
 
 #define TL866A_RESET	  0xFF
@@ -77,74 +78,6 @@ uint32_t crc_32(uint8_t *data, size_t size, uint32_t initial)
 	return crc;
 }
 
-/* Write out results of a logic test. Instead of checking test
- * results they are just written out to a file. Any expected
- * L, H or Z values in the vector are replaced with the read
- * logic state
- */
-
-int write_logic_file(minipro_handle_t *handle, uint8_t *first_step,
-				uint8_t *second_step)
-{
-	FILE *out;
-	uint8_t *pfirst = first_step;
-	uint8_t *psecond = second_step;
-	uint8_t *pvec = handle->device->vectors;
-	char *device_name = handle->cmdopts->device_name;
-	int pin_count = handle->device->package_details.pin_count;
-	int vector_count = handle->device->vector_count;
-	static const char pst[] = "01LHCZXGV";
-	static const char *vcc_table[] = {"5V", "3V3", "2V5", "1V8"};
-
-	const char *vcc = vcc_table[handle->device->voltages.vcc];
-
-	/* Must have enough space for max pins (48) + spaces between each character */
-	char linebuf[100];
-
-	out = fopen(handle->cmdopts->logicic_out, "w");
-	if (out == NULL)
-		return EXIT_FAILURE;
-	fputs("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n", out);
-	fputs("<logicic>\n", out);
-	fputs("  <database device=\"LOGIC\">\n", out);
-	fputs("    <manufacturer name=\"Logic Ic\">\n", out);
-	fprintf(out, "      <ic name=\"%s\" type=\"5\" voltage=\"%s\" pins=\"%d\">\n",
-		device_name, vcc, pin_count);
-	for (int i = 0; i < vector_count; i++) {
-		char *p = linebuf;
-		for (int j = 0; j < pin_count; j++) {
-			/* If vector doesn't require a test just copy existing value */
-			if (*pvec != LOGIC_L && *pvec != LOGIC_H && *pvec != LOGIC_Z)
-				*p = pst[*pvec];
-			/* Pulled high: H */
-			else if (*pfirst && *psecond)
-				*p = 'H';
-			/* Pulled low: L */
-			else if (!*pfirst && !*psecond)
-				*p = 'L';
-			/* Not pulled at all: Z */
-			else if (*pfirst && !*psecond)
-				*p = 'Z';
-			else
-			/* Should be impossible */
-				*p = '?';
-			pfirst++;
-			psecond++;
-			pvec++;
-			*++p = ' ';
-			p++;
-		}
-		*p = 0;
-		fprintf(out, "        <vector id=\"%02d\"> %s</vector>\n", i, linebuf);
-	}
-	fputs("      </ic>\n", out);
-	fputs("    </manufacturer>\n", out);
-	fputs("  </database>\n", out);
-	fputs("</logicic>\n", out);
-	fclose(out);
-	return EXIT_SUCCESS;
-}
-
 static int minipro_get_system_info(minipro_handle_t *handle)
 {
 	uint8_t msg[80];
@@ -358,6 +291,8 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_spi_autodetect = tl866iiplus_spi_autodetect;
 		handle->minipro_read_block = tl866iiplus_read_block;
 		handle->minipro_write_block = tl866iiplus_write_block;
+		handle->minipro_read_block_async = tl866iiplus_read_block_async;
+		handle->minipro_write_block_async = tl866iiplus_write_block_async;
 		handle->minipro_protect_off = tl866iiplus_protect_off;
 		handle->minipro_protect_on = tl866iiplus_protect_on;
 		handle->minipro_erase = tl866iiplus_erase;
@@ -372,11 +307,14 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_firmware_update = tl866iiplus_firmware_update;
 		handle->minipro_pin_test = tl866iiplus_pin_test;
 		handle->minipro_logic_ic_test = tl866iiplus_logic_ic_test;
+		handle->minipro_logic_ic_identify =
+			tl866iiplus_logic_ic_identify;
 		handle->minipro_reset_state = tl866iiplus_reset_state;
 		handle->minipro_set_zif_direction =
 			tl866iiplus_set_zif_direction;
 		handle->minipro_set_zif_state = tl866iiplus_set_zif_state;
 		handle->minipro_get_zif_state = tl866iiplus_get_zif_state;
+		handle->minipro_run_zif_queue = tl866iiplus_run_zif_queue;
 		handle->minipro_set_pin_drivers = tl866iiplus_set_pin_drivers;
 		handle->minipro_set_voltages = tl866iiplus_set_voltages;
 		break;
@@ -387,6 +325,8 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_spi_autodetect = t48_spi_autodetect;
 		handle->minipro_read_block = t48_read_block;
 		handle->minipro_write_block = t48_write_block;
+		handle->minipro_read_block_async = t48_read_block_async;
+		handle->minipro_write_block_async = t48_write_block_async;
 		handle->minipro_protect_off = t48_protect_off;
 		handle->minipro_protect_on = t48_protect_on;
 		handle->minipro_erase = t48_erase;
@@ -397,10 +337,12 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_write_jedec_row = t48_write_jedec_row;
 		handle->minipro_firmware_update = t48_firmware_update;
 		handle->minipro_logic_ic_test = t48_logic_ic_test;
+		handle->minipro_logic_ic_identify = t48_logic_ic_identify;
 		handle->minipro_reset_state = t48_reset_state;
 		handle->minipro_set_zif_direction = t48_set_zif_direction;
 		handle->minipro_set_zif_state = t48_set_zif_state;
 		handle->minipro_get_zif_state = t48_get_zif_state;
+		handle->minipro_run_zif_queue = t48_run_zif_queue;
 		handle->minipro_set_pin_drivers = t48_set_pin_drivers;
 		handle->minipro_set_voltages = t48_set_voltages;
 		handle->minipro_hardware_check = t48_hardware_check;
@@ -412,6 +354,8 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_spi_autodetect = t56_spi_autodetect;
 		handle->minipro_read_block = t56_read_block;
 		handle->minipro_write_block = t56_write_block;
+		handle->minipro_read_block_async = t56_read_block_async;
+		handle->minipro_write_block_async = t56_write_block_async;
 		handle->minipro_protect_off = t56_protect_off;
 		handle->minipro_protect_on = t56_protect_on;
 		handle->minipro_erase = t56_erase;
@@ -423,13 +367,50 @@ minipro_handle_t *minipro_open(uint8_t verbose)
 		handle->minipro_write_jedec_row = t56_write_jedec_row;
 		handle->minipro_firmware_update = t56_firmware_update;
 		handle->minipro_logic_ic_test = t56_logic_ic_test;
+		handle->minipro_logic_ic_identify = t56_logic_ic_identify;
 		break;
 	}
 	return handle;
 }
 
+/* Reopen the USB connection of an existing handle, e.g. after the
+ * programmer was reset or replugged. The device and options are kept.
+ * Every programmer on the bus is tried, fails if none of them has the
+ * same serial number. */
+int minipro_reconnect(minipro_handle_t *handle)
+{
+	minipro_handle_t tmp;
+	assert(handle != NULL);
+
+	if (handle->usb_handle) {
+		usb_close(handle->usb_handle);
+		handle->usb_handle = NULL;
+	}
+
+	int count = minipro_get_devices_count(MP_TL866A) +
+		    minipro_get_devices_count(MP_TL866IIPLUS);
+	for (int index = 0; index < count; index++) {
+		memset(&tmp, 0, sizeof(tmp));
+		tmp.usb_handle = usb_open_index(NO_VERBOSE, index);
+		if (!tmp.usb_handle)
+			continue; /* Busy, e.g. used by another process */
+		if (!minipro_get_system_info(&tmp) &&
+		    tmp.version == handle->version &&
+		    tmp.status == MP_STATUS_NORMAL &&
+		    !memcmp(tmp.serial_number, handle->serial_number,
+			    sizeof(tmp.serial_number))) {
+			handle->usb_handle = tmp.usb_handle;
+			return EXIT_SUCCESS;
+		}
+		usb_close(tmp.usb_handle);
+	}
+	return EXIT_FAILURE;
+}
+
 void minipro_close(minipro_handle_t *handle)
 {
+	if (handle && handle->session)
+		session_close(handle->session);
 	if (handle && handle->usb_handle)
 		usb_close(handle->usb_handle);
 	if (handle && handle->device) {
@@ -598,6 +579,10 @@ int minipro_begin_transaction(minipro_handle_t *handle)
 int minipro_end_transaction(minipro_handle_t *handle)
 {
 	assert(handle != NULL);
+
+	/* The programmer is gone if a reconnect failed */
+	if (!handle->usb_handle)
+		return EXIT_FAILURE;
 	if (handle->minipro_end_transaction) {
 		return handle->minipro_end_transaction(handle);
 	} else {
@@ -686,6 +671,64 @@ int minipro_write_block(minipro_handle_t *handle, uint8_t type, uint32_t addr,
 	return EXIT_FAILURE;
 }
 
+int minipro_read_block_async(minipro_handle_t *handle, uint8_t type,
+			     uint32_t addr, uint8_t *buffer, size_t len,
+			     minipro_callback_t callback, void *user_data,
+			     minipro_cancel_t *cancel)
+{
+	assert(handle != NULL);
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	if (handle->minipro_read_block_async && handle->device &&
+	    !handle->device->flags.custom_protocol) {
+		return handle->minipro_read_block_async(handle, type, addr,
+							buffer, len, callback,
+							user_data, cancel);
+	}
+
+	/* Fall back to the synchronous version */
+	if (!handle->minipro_read_block) {
+		fprintf(stderr, "%s: read_block not implemented\n",
+			handle->model);
+		return EXIT_FAILURE;
+	}
+	callback(handle->minipro_read_block(handle, type, addr, buffer, len),
+		 user_data);
+	return EXIT_SUCCESS;
+}
+
+int minipro_write_block_async(minipro_handle_t *handle, uint8_t type,
+			      uint32_t addr, uint8_t *buffer, size_t len,
+			      minipro_callback_t callback, void *user_data,
+			      minipro_cancel_t *cancel)
+{
+	assert(handle != NULL);
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	if (handle->minipro_write_block_async && handle->device &&
+	    !handle->device->flags.custom_protocol) {
+		return handle->minipro_write_block_async(handle, type, addr,
+							 buffer, len, callback,
+							 user_data, cancel);
+	}
+
+	/* Fall back to the synchronous version */
+	if (!handle->minipro_write_block) {
+		fprintf(stderr, "%s: write_block not implemented\n",
+			handle->model);
+		return EXIT_FAILURE;
+	}
+	callback(handle->minipro_write_block(handle, type, addr, buffer, len),
+		 user_data);
+	return EXIT_SUCCESS;
+}
+
+void minipro_cancel(minipro_handle_t *handle, minipro_cancel_t *cancel)
+{
+	assert(handle != NULL);
+	usb_cancel(handle->usb_handle, cancel);
+}
+
 /* Model-specific ID, e.g. AVR Device ID (not longer than 4 bytes) */
 int minipro_get_chip_id(minipro_handle_t *handle, uint8_t *type,
 			uint32_t *device_id)
@@ -845,6 +888,18 @@ int minipro_logic_ic_test(minipro_handle_t *handle)
 	return EXIT_FAILURE;
 }
 
+int minipro_logic_ic_identify(minipro_handle_t *handle,
+			      struct logic_list *list)
+{
+	assert(handle != NULL);
+	if (handle->minipro_logic_ic_identify) {
+		return handle->minipro_logic_ic_identify(handle, list);
+	}
+	fprintf(stderr, "%s: logic IC identification not implemented\n",
+		handle->model);
+	return EXIT_FAILURE;
+}
+
 int minipro_set_zif_direction(minipro_handle_t *handle, uint8_t *zif_dir)
 {
 	assert(handle != NULL);
@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "usb.h"
 
 #define MP_TL866A			   1
 #define MP_TL866CS			   2
@@ -93,6 +94,9 @@
 
 /* Custom chip protocols */
 #define CP_PROM				   0x01
+#define CP_SPI				   0x02
+#define CP_I2C				   0x03
+#define CP_MICROWIRE			   0x04
 
 /* Adapters */
 #define TSOP48_ADAPTER			   0x00000001
@@ -213,12 +217,17 @@ typedef struct minipro_status {
 	uint32_t c2;
 } minipro_status_t;
 
+/* Completion callback and cancellation token of the async API */
+typedef usb_callback_t minipro_callback_t;
+typedef usb_cancel_t minipro_cancel_t;
+
 typedef struct cmdopts_s {
 	char *filename;
 	char *infoic_path;
 	char *logicic_path;
 	char *logicic_out;
 	char *algo_path;
+	char *journal_path;
 	char *device_name;
 	enum {
 		UNSPECIFIED = 0,
@@ -240,7 +249,8 @@ typedef struct cmdopts_s {
 	enum {
 		NO_FORMAT = 0,
 		IHEX,
-		SREC
+		SREC,
+		IMAGE
 	} format;
 	enum {
 		V_1V8 = 0,
@@ -260,11 +270,25 @@ typedef struct cmdopts_s {
 	uint8_t is_pipe;
 	uint8_t version;
 	uint8_t force_erase;
+	uint8_t blank_gaps;
+	int reconnect;
+	int record_length; /* Hex file data bytes per line, 0 for default */
+	int compress_level; /* Gzip output level 1-9, 0 for default */
+	uint8_t logic_pins; /* Package of an unknown logic IC */
+	uint8_t logic_gnd; /* Its power pins, counted from 0 */
+	uint8_t logic_vcc;
+	uint32_t soak_passes; /* Logic test repeats, 0 to use soak_seconds */
+	uint32_t soak_seconds;
+	uint32_t offset; /* Address range, length 0 means up to the end */
+	uint32_t length;
 	int filter_fuses;
 	int filter_locks;
 	int filter_uid;
 } cmdopts_t;
 
+struct logic_list;
+struct zif_queue;
+
 typedef struct minipro_handle {
 	char *model;
 	char firmware_str[16];
@@ -280,6 +304,8 @@ typedef struct minipro_handle {
 	device_t *device;
 	void *usb_handle;
 	cmdopts_t *cmdopts;
+	struct minipro_session *session; /* Automatic reconnect, may be NULL */
+	uint16_t prom_pattern; /* Mask PROM CE/CS pattern + 1, 0 if unknown */
 
 	int (*minipro_begin_transaction)(struct minipro_handle *);
 	int (*minipro_end_transaction)(struct minipro_handle *);
@@ -291,6 +317,14 @@ typedef struct minipro_handle {
 				  uint8_t *, size_t);
 	int (*minipro_write_block)(struct minipro_handle *, uint8_t, uint32_t,
 				   uint8_t *, size_t);
+	int (*minipro_read_block_async)(struct minipro_handle *, uint8_t,
+					uint32_t, uint8_t *, size_t,
+					minipro_callback_t, void *,
+					minipro_cancel_t *);
+	int (*minipro_write_block_async)(struct minipro_handle *, uint8_t,
+					 uint32_t, uint8_t *, size_t,
+					 minipro_callback_t, void *,
+					 minipro_cancel_t *);
 	int (*minipro_get_chip_id)(struct minipro_handle *, uint8_t *,
 				   uint32_t *);
 	int (*minipro_spi_autodetect)(struct minipro_handle *, uint8_t,
@@ -311,10 +345,14 @@ typedef struct minipro_handle {
 	int (*minipro_firmware_update)(struct minipro_handle *, const char *);
 	int (*minipro_pin_test)(struct minipro_handle *);
 	int (*minipro_logic_ic_test)(struct minipro_handle *);
+	int (*minipro_logic_ic_identify)(struct minipro_handle *,
+					 struct logic_list *);
 	int (*minipro_reset_state)(struct minipro_handle *);
 	int (*minipro_set_zif_direction)(struct minipro_handle *, uint8_t *);
 	int (*minipro_set_zif_state)(struct minipro_handle *, uint8_t *);
 	int (*minipro_get_zif_state)(struct minipro_handle *, uint8_t *);
+	int (*minipro_run_zif_queue)(struct minipro_handle *,
+				     struct zif_queue *);
 	int (*minipro_set_pin_drivers)(struct minipro_handle *,
 				       struct pin_driver *);
 	int (*minipro_set_voltages)(struct minipro_handle *, uint8_t, uint8_t);
@@ -326,8 +364,6 @@ uint64_t load_int(uint8_t *buffer, size_t size, uint8_t endianness);
 
 /* Helper functions */
 void minipro_print_system_info(minipro_handle_t *handle);
-int write_logic_file(minipro_handle_t *handle, uint8_t *first_step,
-		     uint8_t *second_step);
 uint32_t crc_32(uint8_t *data, size_t size, uint32_t initial);
 int minipro_reset(minipro_handle_t *handle);
 int minipro_get_devices_count(uint8_t version);
@@ -342,6 +378,7 @@ int minipro_get_devices_count(uint8_t version);
  */
 minipro_handle_t *minipro_open(uint8_t verbose);
 void minipro_close(minipro_handle_t *handle);
+int minipro_reconnect(minipro_handle_t *handle);
 int minipro_begin_transaction(minipro_handle_t *handle);
 int minipro_end_transaction(minipro_handle_t *handle);
 int minipro_protect_off(minipro_handle_t *handle);
@@ -372,10 +409,31 @@ int minipro_hardware_check(minipro_handle_t *handle);
 int minipro_firmware_update(minipro_handle_t *handle, const char *firmware);
 int minipro_pin_test(minipro_handle_t *handle);
 int minipro_logic_ic_test(minipro_handle_t *handle);
+int minipro_logic_ic_identify(minipro_handle_t *handle,
+			      struct logic_list *list);
 int minipro_set_zif_direction(minipro_handle_t *handle, uint8_t *zif_dir);
 int minipro_set_zif_state(minipro_handle_t *handle, uint8_t *zif_state);
 int minipro_get_zif_state(minipro_handle_t *handle, uint8_t *zif_state);
 int minipro_set_pin_drivers(minipro_handle_t *handle, pin_driver_t *pins);
 int minipro_set_voltages(minipro_handle_t *handle, uint8_t vcc, uint8_t vpp);
 int minipro_reset_state(minipro_handle_t *handle);
+
+/*
+ * Asynchronous block transfers. These return EXIT_FAILURE if the transfer
+ * could not be started, otherwise the callback is called exactly once
+ * with the transfer status, usually from the USB event thread.
+ * Programmers or devices without async support perform the transfer
+ * synchronously and call the callback before returning.
+ * A transfer can be aborted with minipro_cancel(); the programmer state
+ * is undefined afterwards and the transaction should be ended.
+ */
+int minipro_read_block_async(minipro_handle_t *handle, uint8_t type,
+			     uint32_t addr, uint8_t *buffer, size_t len,
+			     minipro_callback_t callback, void *user_data,
+			     minipro_cancel_t *cancel);
+int minipro_write_block_async(minipro_handle_t *handle, uint8_t type,
+			      uint32_t addr, uint8_t *buffer, size_t len,
+			      minipro_callback_t callback, void *user_data,
+			      minipro_cancel_t *cancel);
+void minipro_cancel(minipro_handle_t *handle, minipro_cancel_t *cancel);
 #endif
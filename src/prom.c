@@ -27,6 +27,7 @@
 #include "bitbang.h"
 
 #define HITACHI_MASK_PROM_MASK 0x80
+#define MASK_PROM_PROBES	16 /* Addresses read per CE/CS pattern */
 
 typedef struct prom {
 	uint8_t *gnd_pins;	/* GND pins list */
@@ -189,6 +190,26 @@ static mask_prom_t mask_prom_table[] = {
 static uint8_t zif_dir[40];
 static uint8_t zif_state[40];
 static pin_driver_t pin_drivers[40];
+static zif_queue_t queue; /* ZIF states of a block being read */
+
+/* Bus pins of the chip compiled for its package */
+static bb_pins_t addr_pins, data_pins, ce_pins, cs_pins;
+static bb_pins_t ce_lo_pins, ce_hi_pins;
+
+static void prom_enable(int enable)
+{
+	bb_set_pins(zif_state, &ce_lo_pins, !enable);
+	bb_set_pins(zif_state, &ce_hi_pins, !!enable);
+}
+
+static void compile_pins(uint8_t *addr, uint8_t *data, uint8_t *ce,
+			 uint8_t *cs, uint8_t pin_count)
+{
+	bb_compile_pins(&addr_pins, addr, pin_count);
+	bb_compile_pins(&data_pins, data, pin_count);
+	bb_compile_pins(&ce_pins, ce, pin_count);
+	bb_compile_pins(&cs_pins, cs, pin_count);
+}
 
 /* Set the initial state */
 static int mask_prom_init(minipro_handle_t *handle)
@@ -206,6 +227,11 @@ static int mask_prom_init(minipro_handle_t *handle)
 	/* Modify the compare mask according to the chip type */
 	handle->device->compare_mask = mask_prom_table[type].compare_mask;
 
+	compile_pins(mask_prom_table[type].addr_bus_pins,
+		     mask_prom_table[type].data_bus_pins,
+		     mask_prom_table[type].ce_pins,
+		     mask_prom_table[type].cs_pins, pin_count);
+
 	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(zif_dir));
 	memset(zif_state, 0x00, sizeof(zif_state));
 	memset(pin_drivers, 0x00, sizeof(pin_drivers));
@@ -264,6 +290,11 @@ int prom_init(minipro_handle_t *handle)
 	/* Modify the compare mask according to the chip type */
 	handle->device->compare_mask = prom_table[type].compare_mask;
 
+	compile_pins(prom_table[type].addr_bus_pins,
+		     prom_table[type].data_bus_pins, NULL, NULL, pin_count);
+	bb_compile_pins(&ce_lo_pins, prom_table[type].ce_lo_pins, pin_count);
+	bb_compile_pins(&ce_hi_pins, prom_table[type].ce_hi_pins, pin_count);
+
 	memset(zif_dir, MP_PIN_DIRECTION_IN, sizeof(zif_dir));
 	memset(zif_state, 0x00, sizeof(zif_state));
 	memset(pin_drivers, 0x00, sizeof(pin_drivers));
@@ -306,6 +337,7 @@ int prom_init(minipro_handle_t *handle)
 /* Reset all pin drivers and terminate current session */
 int prom_terminate(minipro_handle_t *handle)
 {
+	zif_queue_free(&queue);
 	return minipro_reset_state(handle);
 }
 
@@ -317,66 +349,125 @@ static int is_empty(uint8_t *buffer, size_t length)
 	return 1;
 }
 
-/* Read bytes from Hitachi mask PROMs */
-static int prom_read_mask_prom(minipro_handle_t *handle, uint32_t address,
-	                uint8_t *buffer, size_t length) {
-	static uint8_t zif[40];
-	uint8_t type = (uint8_t)handle->device->variant & ~HITACHI_MASK_PROM_MASK;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-	uint8_t ce_pin_count = strlen((const char *) mask_prom_table[type].ce_pins);
-	uint8_t cs_pin_count = strlen((const char *) mask_prom_table[type].cs_pins);
-
-	/* Set data bus direction to input with pull-up resistors */
-	set_io_pins(zif_dir, mask_prom_table[type].data_bus_pins,
-		    MP_PIN_DIRECTION_IN | MP_PIN_PULLUP, pin_count);
+/* Queue the read of one address with the given CE/CS pins pattern */
+static int queue_mask_prom_read(uint32_t address, uint8_t ce_bit_pattern,
+				uint8_t cs_bit_pattern)
+{
+	/* Set address value to zif pins */
+	bb_set_bits(zif_state, &addr_pins, address);
+	bb_set_bits(zif_state, &cs_pins, cs_bit_pattern);
+	if (zif_queue_set(&queue, zif_state))
+		return EXIT_FAILURE;
 
-	if (minipro_set_zif_direction(handle, zif_dir))
+	bb_set_bits(zif_state, &ce_pins, ce_bit_pattern);
+	if (zif_queue_set(&queue, zif_state))
 		return EXIT_FAILURE;
-	if (minipro_set_zif_state(handle, zif_state))
+
+	/* Now read the zif pins */
+	if (zif_queue_read(&queue))
 		return EXIT_FAILURE;
 
-	for (uint8_t ce_bit_pattern = 0; ce_bit_pattern < (1 << ce_pin_count);
-		 ce_bit_pattern++) {
-	  for (uint8_t cs_bit_pattern = 0; cs_bit_pattern < (1 << cs_pin_count);
-		   cs_bit_pattern++) {
-		/* Read length bytes */
-		for (int i = 0; i < length; i++) {
-			/* Set address value to zif pins */
-			set_bits(zif_state, mask_prom_table[type].addr_bus_pins,
-				 address + i, pin_count);
-			set_bits(zif_state, mask_prom_table[type].cs_pins,
-					 cs_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-				return EXIT_FAILURE;
+	bb_set_bits(zif_state, &ce_pins, (uint8_t)~ce_bit_pattern);
+	return zif_queue_set(&queue, zif_state);
+}
 
-			set_bits(zif_state, mask_prom_table[type].ce_pins,
-					 ce_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-			  return EXIT_FAILURE;
+/* Read length bytes with one CE/CS pins pattern, the pattern holds the
+ * CE bits above the CS bits */
+static int read_mask_prom_pattern(minipro_handle_t *handle, uint32_t address,
+				  uint8_t *buffer, size_t length,
+				  unsigned int pattern)
+{
+	uint8_t cs_pin_count = cs_pins.count;
 
-			/* Now read the zif pins */
-			if (minipro_get_zif_state(handle, zif))
-				return EXIT_FAILURE;
+	/* Queue the pin states of length bytes */
+	zif_queue_clear(&queue);
+	for (size_t i = 0; i < length; i++) {
+		if (queue_mask_prom_read(address + i, pattern >> cs_pin_count,
+					 pattern & ((1 << cs_pin_count) - 1)))
+			return EXIT_FAILURE;
+	}
+	if (zif_queue_run(handle, &queue))
+		return EXIT_FAILURE;
 
-			/* Convert zif data bus value and write it to buffer */
-			buffer[i] = get_bits(zif, mask_prom_table[type].data_bus_pins,
-					     pin_count);
+	/* Convert zif data bus values and write them to buffer */
+	for (size_t i = 0; i < length; i++)
+		buffer[i] = bb_get_bits(queue.results[i], &data_pins);
+	return EXIT_SUCCESS;
+}
 
-			set_bits(zif_state, mask_prom_table[type].ce_pins,
-					 ~ce_bit_pattern, pin_count);
-			if (minipro_set_zif_state(handle, zif_state))
-			  return EXIT_FAILURE;
+/* Find the CE/CS pattern the ROM was programmed with. A few addresses
+ * spread over the chip are read with every pattern in one batch, the
+ * first pattern reading anything but the pull-ups enables the chip.
+ * pattern is set to -1 if no pattern did. */
+static int probe_mask_prom(minipro_handle_t *handle, int *pattern)
+{
+	uint8_t cs_pin_count = cs_pins.count;
+	unsigned int patterns = 1 << (ce_pins.count + cs_pin_count);
+	uint32_t size = handle->device->code_memory_size;
+	unsigned int p, i;
+
+	zif_queue_clear(&queue);
+	for (p = 0; p < patterns; p++) {
+		for (i = 0; i < MASK_PROM_PROBES; i++) {
+			uint32_t address = (i * (size / MASK_PROM_PROBES) + i) %
+					   (size ? size : 1);
+			if (queue_mask_prom_read(address, p >> cs_pin_count,
+						 p & ((1 << cs_pin_count) - 1)))
+				return EXIT_FAILURE;
 		}
+	}
+	if (zif_queue_run(handle, &queue))
+		return EXIT_FAILURE;
 
-		/* Check if contents are read properly. Necessaray as CS
-		 * and CE are mask programmed, and may be active high or
-		 * active low */
-		if (is_empty(buffer, length) == 0) {
-		  return EXIT_SUCCESS;
+	*pattern = -1;
+	for (p = 0; p < patterns && *pattern < 0; p++) {
+		for (i = 0; i < MASK_PROM_PROBES; i++) {
+			uint8_t value = bb_get_bits(
+				queue.results[p * MASK_PROM_PROBES + i],
+				&data_pins);
+			if (value != 0xFF) {
+				*pattern = p;
+				break;
+			}
 		}
-	  }
 	}
+	return EXIT_SUCCESS;
+}
 
+/* Read bytes from Hitachi mask PROMs */
+static int prom_read_mask_prom(minipro_handle_t *handle, uint32_t address,
+	                uint8_t *buffer, size_t length) {
+	unsigned int patterns = 1 << (ce_pins.count + cs_pins.count);
+
+	/* Set data bus direction to input with pull-up resistors */
+	bb_set_pins(zif_dir, &data_pins, MP_PIN_DIRECTION_IN | MP_PIN_PULLUP);
+
+	if (minipro_set_zif_direction(handle, zif_dir))
+		return EXIT_FAILURE;
+	if (minipro_set_zif_state(handle, zif_state))
+		return EXIT_FAILURE;
+
+	/* CS and CE are mask programmed and may be active high or active
+	 * low. Find out once and keep it for the session. */
+	if (!handle->prom_pattern) {
+		int pattern;
+		if (probe_mask_prom(handle, &pattern))
+			return EXIT_FAILURE;
+		if (pattern >= 0)
+			handle->prom_pattern = pattern + 1;
+	}
+	if (handle->prom_pattern)
+		return read_mask_prom_pattern(handle, address, buffer, length,
+					      handle->prom_pattern - 1);
+
+	/* The probed addresses were all blank, try every pattern on this
+	 * block until one reads anything */
+	for (unsigned int p = 0; p < patterns; p++) {
+		if (read_mask_prom_pattern(handle, address, buffer, length, p))
+			return EXIT_FAILURE;
+		if (!is_empty(buffer, length))
+			break;
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -387,42 +478,37 @@ int prom_read(minipro_handle_t *handle, uint32_t address, uint8_t *buffer,
 	if ((uint8_t)handle->device->variant & HITACHI_MASK_PROM_MASK)
 		return prom_read_mask_prom(handle, address, buffer, lenght);
 
-	static uint8_t zif[40];
-	uint8_t type = (uint8_t)handle->device->variant;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
 	/* Set data bus direction to input with pull-up resistors */
-	set_io_pins(zif_dir, prom_table[type].data_bus_pins,
-		    MP_PIN_DIRECTION_IN | MP_PIN_PULLUP, pin_count);
+	bb_set_pins(zif_dir, &data_pins, MP_PIN_DIRECTION_IN | MP_PIN_PULLUP);
 
 	/* Set chip enable pins state to enabled */
-	set_io_pins(zif_state, prom_table[type].ce_lo_pins, 0, pin_count);
-	set_io_pins(zif_state, prom_table[type].ce_hi_pins, 1, pin_count);
+	prom_enable(1);
 
 	if (minipro_set_zif_direction(handle, zif_dir))
 		return EXIT_FAILURE;
 	if (minipro_set_zif_state(handle, zif_state))
 		return EXIT_FAILURE;
 
-	/* Read length bytes */
+	/* Queue the pin states of length bytes */
+	zif_queue_clear(&queue);
 	for (int i = 0; i < lenght; i++) {
 		/* Set address value to zif pins */
-		set_bits(zif_state, prom_table[type].addr_bus_pins, address + i,
-			 pin_count);
-		if (minipro_set_zif_state(handle, zif_state))
+		bb_set_bits(zif_state, &addr_pins, address + i);
+		if (zif_queue_set(&queue, zif_state))
 			return EXIT_FAILURE;
 
 		/* Now read the zif pins */
-		if (minipro_get_zif_state(handle, zif))
+		if (zif_queue_read(&queue))
 			return EXIT_FAILURE;
-
-		/* Convert zif data bus value and write it to buffer */
-		buffer[i] = get_bits(zif, prom_table[type].data_bus_pins,
-				     pin_count);
 	}
+	if (zif_queue_run(handle, &queue))
+		return EXIT_FAILURE;
+
+	/* Convert zif data bus values and write them to buffer */
+	for (int i = 0; i < lenght; i++)
+		buffer[i] = bb_get_bits(queue.results[i], &data_pins);
 
 	/* Set chip enable pins state to disabled */
-	set_io_pins(zif_state, prom_table[type].ce_lo_pins, 1, pin_count);
-	set_io_pins(zif_state, prom_table[type].ce_hi_pins, 0, pin_count);
+	prom_enable(0);
 	return minipro_set_zif_state(handle, zif_state);
 }
@@ -0,0 +1,918 @@
+/*
+ * serial.c - bit banged serial bus algorithms implementation
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "minipro.h"
+#include "bitbang.h"
+#include "serial.h"
+
+#define SPI_READ	  0x03
+#define SPI_WRITE	  0x02
+#define SPI_WRITE_ENABLE  0x06
+#define SPI_READ_STATUS	  0x05
+#define SPI_CHIP_ERASE	  0xc7
+#define SPI_STATUS_BUSY	  0x01
+#define SPI_READ_JEDEC_ID 0x9f
+#define SPI_READ_ID	  0x90 /* Manufacturer and device ID */
+#define SPI_READ_SIG	  0xab /* Electronic signature, also a wakeup */
+
+#define I2C_ADDRESS	  0xa0
+#define I2C_READ	  0x01
+#define I2C_STRETCH_DELAY 10 /* Initial SCL release time in microseconds */
+#define I2C_STRETCH_MAX	  10000
+
+#define MW_READ		  0x06 /* Start bit and opcode */
+#define MW_WRITE	  0x05
+#define MW_ERASE_ALL	  0x04 /* Followed by 10 */
+#define MW_WRITE_ENABLE	  0x04 /* Followed by 11 */
+#define MW_WRITE_DISABLE  0x04 /* Followed by 00 */
+
+#define NO_PIN		  0xff
+#define MIN(a, b)	  ((a) < (b) ? (a) : (b))
+
+#define POLL_DELAY	  500 /* Microseconds between busy polls */
+#define POLL_COUNT	  16 /* Busy polls queued at a time */
+#define WRITE_TIMEOUT	  200 /* Write busy polls before giving up */
+#define ERASE_TIMEOUT	  200000 /* Erase busy polls before giving up */
+#define POWER_UP_DELAY	  10000 /* Microseconds of power up time */
+#define WAKEUP_DELAY	  50 /* Microseconds after the signature command */
+
+typedef struct serial_pins {
+	uint8_t *gnd_pins;	/* GND pins list */
+	uint8_t *vcc_pins;	/* VCC pins list */
+	uint8_t *cs_pins;	/* chip select (SPI, Microwire) */
+	uint8_t *clk_pins;	/* SCK, SCL or CLK */
+	uint8_t *out_pins;	/* SI, SDA or DI, data to the chip */
+	uint8_t *in_pins;	/* SO, SDA or DO, data from the chip */
+	uint8_t *hi_pins;	/* pins held high */
+	uint8_t *lo_pins;	/* pins held low */
+	uint8_t *org_pins;	/* Microwire ORG, high for 16 bit words */
+} serial_pins_t;
+
+/* All supported serial pinouts table
+ * All pin lists must be zero terminated
+ */
+static serial_pins_t serial_table[] = {
+	/* Type 0; DIP8 SPI (25xx) */
+	{ .gnd_pins = (uint8_t[]){ 4, 0 },
+	  .vcc_pins = (uint8_t[]){ 8, 0 },
+	  .cs_pins = (uint8_t[]){ 1, 0 },
+	  .clk_pins = (uint8_t[]){ 6, 0 },
+	  .out_pins = (uint8_t[]){ 5, 0 },
+	  .in_pins = (uint8_t[]){ 2, 0 },
+	  .hi_pins = (uint8_t[]){ 3, 7, 0 } },
+
+	/* Type 1; DIP8 I2C (24xx) */
+	{ .gnd_pins = (uint8_t[]){ 4, 0 },
+	  .vcc_pins = (uint8_t[]){ 8, 0 },
+	  .clk_pins = (uint8_t[]){ 6, 0 },
+	  .out_pins = (uint8_t[]){ 5, 0 },
+	  .in_pins = (uint8_t[]){ 5, 0 },
+	  .lo_pins = (uint8_t[]){ 1, 2, 3, 7, 0 } },
+
+	/* Type 2; DIP8 Microwire (93Cxx) */
+	{ .gnd_pins = (uint8_t[]){ 5, 0 },
+	  .vcc_pins = (uint8_t[]){ 8, 0 },
+	  .cs_pins = (uint8_t[]){ 1, 0 },
+	  .clk_pins = (uint8_t[]){ 2, 0 },
+	  .out_pins = (uint8_t[]){ 3, 0 },
+	  .in_pins = (uint8_t[]){ 4, 0 },
+	  .org_pins = (uint8_t[]){ 6, 0 } },
+
+	/* Type 3; SOIC16 SPI (25xx) */
+	{ .gnd_pins = (uint8_t[]){ 10, 0 },
+	  .vcc_pins = (uint8_t[]){ 2, 0 },
+	  .cs_pins = (uint8_t[]){ 7, 0 },
+	  .clk_pins = (uint8_t[]){ 16, 0 },
+	  .out_pins = (uint8_t[]){ 15, 0 },
+	  .in_pins = (uint8_t[]){ 8, 0 },
+	  .hi_pins = (uint8_t[]){ 1, 9, 0 } },
+};
+
+/* SPI pinouts and packages tried by the autodetection */
+static const struct {
+	uint8_t type;
+	uint8_t pin_count;
+} spi_probes[] = { { 0, 8 }, { 3, 16 } };
+
+/* VCC voltages tried by the autodetection, 1.9V, 3.3V and 5V. A chip
+ * answering at a low voltage is never powered with a higher one. */
+static const uint8_t probe_vcc[] = { 0, 3, 9 };
+
+/* Persistent state */
+static struct {
+	zif_queue_t queue;
+	uint8_t zif[40];
+	uint8_t dir[40];
+	pin_driver_t drivers[40];
+	uint8_t cs, clk, out, in; /* ZIF indexes */
+	uint8_t i2c;
+	uint8_t cs_active;
+	uint8_t cpol, cpha;
+	uint8_t released; /* SDA is an input */
+	uint32_t stretch; /* SCL release time, 0 if SCL is driven */
+	uint8_t *data; /* Per read, 0 if it only checks SCL */
+	size_t data_size;
+	size_t reads;
+	size_t result; /* Next result to take a bit from */
+	int stretched; /* The chip held SCL low */
+} bus;
+
+/* Return the ZIF index of the first pin of a list, NO_PIN if none */
+static uint8_t zif_pin(uint8_t *pins, uint8_t pin_count)
+{
+	bb_pins_t compiled;
+	bb_compile_pins(&compiled, pins, pin_count);
+	return compiled.count ? compiled.index[0] : NO_PIN;
+}
+
+static int set_state(void)
+{
+	return zif_queue_set(&bus.queue, bus.zif);
+}
+
+/* Queue a read of all pins, data is 0 if no bit is taken from it */
+static int sample(int data)
+{
+	if (bus.reads == bus.data_size) {
+		size_t size = bus.data_size ? bus.data_size * 2 : 256;
+		uint8_t *p = realloc(bus.data, size);
+		if (!p) {
+			fprintf(stderr, "Out of memory!\n");
+			return EXIT_FAILURE;
+		}
+		bus.data = p;
+		bus.data_size = size;
+	}
+	bus.data[bus.reads++] = data;
+	return zif_queue_read(&bus.queue);
+}
+
+static int clock_idle(void)
+{
+	if (bus.i2c || bus.zif[bus.clk] == bus.cpol)
+		return EXIT_SUCCESS;
+	bus.zif[bus.clk] = bus.cpol;
+	return set_state();
+}
+
+int spi_select(int select)
+{
+	if (clock_idle())
+		return EXIT_FAILURE;
+	bus.zif[bus.cs] = select ? bus.cs_active : !bus.cs_active;
+	return set_state();
+}
+
+/* Shift bits of value out msb first, sampling the input if read is set.
+ * CPHA 0 sets the data with the trailing clock edge and samples before
+ * the leading one, CPHA 1 sets it with the leading edge and samples
+ * after the trailing one. */
+int spi_shift(uint32_t value, int bits, int read)
+{
+	while (bits--) {
+		bus.zif[bus.out] = (value >> bits) & 0x01;
+		bus.zif[bus.clk] = bus.cpha ? !bus.cpol : bus.cpol;
+		if (set_state())
+			return EXIT_FAILURE;
+		if (read && !bus.cpha && sample(1))
+			return EXIT_FAILURE;
+		bus.zif[bus.clk] = !bus.zif[bus.clk];
+		if (set_state())
+			return EXIT_FAILURE;
+		if (read && bus.cpha && sample(1))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* SCL high. A released SCL gets time to be stretched and is checked
+ * by every read while it is high. */
+static int scl_high(void)
+{
+	bus.zif[bus.clk] = 1;
+	if (!bus.stretch)
+		return set_state();
+	bus.dir[bus.clk] = MP_PIN_DIRECTION_IN | MP_PIN_PULLUP;
+	if (zif_queue_direction(&bus.queue, bus.dir) ||
+	    zif_queue_delay(&bus.queue, bus.stretch))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static int scl_low(void)
+{
+	bus.zif[bus.clk] = 0;
+	if (set_state())
+		return EXIT_FAILURE;
+	if (!bus.stretch)
+		return EXIT_SUCCESS;
+	bus.dir[bus.clk] = MP_PIN_DIRECTION_OUT;
+	return zif_queue_direction(&bus.queue, bus.dir);
+}
+
+/* Set SDA while SCL is low. The master drives its own bits and only
+ * releases SDA for the bits of the chip. */
+static int sda(int level)
+{
+	bus.zif[bus.out] = level;
+	if (set_state())
+		return EXIT_FAILURE;
+	if (!bus.released)
+		return EXIT_SUCCESS;
+	bus.released = 0;
+	bus.dir[bus.out] = MP_PIN_DIRECTION_OUT;
+	return zif_queue_direction(&bus.queue, bus.dir);
+}
+
+static int sda_release(void)
+{
+	if (bus.released)
+		return EXIT_SUCCESS;
+	bus.released = 1;
+	bus.dir[bus.out] = MP_PIN_DIRECTION_IN | MP_PIN_PULLUP;
+	return zif_queue_direction(&bus.queue, bus.dir);
+}
+
+/* Clock one bit, sampling SDA while SCL is high if read is set */
+static int i2c_clock(int read)
+{
+	if (scl_high())
+		return EXIT_FAILURE;
+	if ((read || bus.stretch) && sample(read))
+		return EXIT_FAILURE;
+	return scl_low();
+}
+
+/* A start condition, also a repeated one */
+int i2c_start(void)
+{
+	if (sda(1) || scl_high())
+		return EXIT_FAILURE;
+	if (bus.stretch && sample(0))
+		return EXIT_FAILURE;
+	bus.zif[bus.out] = 0;
+	if (set_state())
+		return EXIT_FAILURE;
+	return scl_low();
+}
+
+int i2c_stop(void)
+{
+	if (sda(0) || scl_high())
+		return EXIT_FAILURE;
+	if (bus.stretch && sample(0))
+		return EXIT_FAILURE;
+	bus.zif[bus.out] = 1;
+	return set_state();
+}
+
+/* Write a byte, the acknowledge bit is sampled */
+int i2c_write(uint8_t value)
+{
+	for (int bit = 7; bit >= 0; bit--) {
+		if (sda((value >> bit) & 0x01) || i2c_clock(0))
+			return EXIT_FAILURE;
+	}
+	if (sda_release())
+		return EXIT_FAILURE;
+	return i2c_clock(1);
+}
+
+/* Read a byte and acknowledge it if ack is set */
+int i2c_read(int ack)
+{
+	if (sda_release())
+		return EXIT_FAILURE;
+	for (int bit = 0; bit < 8; bit++) {
+		if (i2c_clock(1))
+			return EXIT_FAILURE;
+	}
+	if (sda(!ack))
+		return EXIT_FAILURE;
+	return i2c_clock(0);
+}
+
+int serial_delay(uint32_t delay)
+{
+	return zif_queue_delay(&bus.queue, delay);
+}
+
+/* Empty the queue for the next transfer */
+static void serial_clear(void)
+{
+	zif_queue_clear(&bus.queue);
+	bus.reads = 0;
+}
+
+/* Send the queued transfer. The bits read are then taken with
+ * serial_bits() until the next transfer is queued. */
+int serial_run(minipro_handle_t *handle)
+{
+	if (clock_idle() || zif_queue_run(handle, &bus.queue))
+		return EXIT_FAILURE;
+	bus.result = 0;
+	bus.stretched = 0;
+	if (bus.stretch) {
+		for (size_t i = 0; i < bus.queue.result_count; i++)
+			bus.stretched |= !bus.queue.results[i][bus.clk];
+	}
+	bus.queue.count = 0;
+	bus.reads = 0;
+	return EXIT_SUCCESS;
+}
+
+/* Take the next bits read, msb first */
+uint32_t serial_bits(int bits)
+{
+	uint32_t value = 0;
+	while (bits && bus.result < bus.queue.result_count) {
+		if (bus.data[bus.result]) {
+			value = (value << 1) |
+				!!bus.queue.results[bus.result][bus.in];
+			bits--;
+		}
+		bus.result++;
+	}
+	return value;
+}
+
+/* Take count acknowledge bits, return 1 if all of them were set low */
+static int acked(size_t count)
+{
+	int ack = 1;
+	while (count--)
+		ack &= !serial_bits(1);
+	return ack;
+}
+
+/* Set the initial state */
+int serial_init(minipro_handle_t *handle)
+{
+	uint8_t type = (uint8_t)handle->device->variant;
+	uint8_t protocol = handle->device->protocol_id;
+	size_t entries = sizeof(serial_table) / sizeof(serial_table[0]);
+
+	if (type >= entries) {
+		fprintf(stderr, "Unknown custom protocol 0x%02x\n", type);
+		return EXIT_FAILURE;
+	}
+
+	serial_pins_t *pins = &serial_table[type];
+	uint8_t pin_count = handle->device->package_details.pin_count;
+
+	handle->device->compare_mask =
+		handle->device->flags.word_size == 2 ? 0xffff : 0xff;
+
+	serial_clear();
+	bus.cs = zif_pin(pins->cs_pins, pin_count);
+	bus.clk = zif_pin(pins->clk_pins, pin_count);
+	bus.out = zif_pin(pins->out_pins, pin_count);
+	bus.in = zif_pin(pins->in_pins, pin_count);
+	bus.i2c = protocol == CP_I2C;
+	bus.cs_active = protocol == CP_MICROWIRE;
+
+	/* Microwire is SPI mode 0 with an active high chip select */
+	bus.cpol = 0;
+	bus.cpha = 0;
+	if (protocol == CP_SPI) {
+		bus.cpol = SERIAL_MODE(handle->device->variant) >> 1;
+		bus.cpha = SERIAL_MODE(handle->device->variant) & 0x01;
+	}
+	bus.released = 0;
+	bus.stretch = protocol == CP_I2C &&
+				      SERIAL_STRETCH(handle->device->variant) ?
+			      I2C_STRETCH_DELAY :
+			      0;
+
+	memset(bus.dir, MP_PIN_DIRECTION_IN, sizeof(bus.dir));
+	memset(bus.zif, 0x00, sizeof(bus.zif));
+	memset(bus.drivers, 0x00, sizeof(bus.drivers));
+
+	/* Set the bus pins direction to output */
+	set_io_pins(bus.dir, pins->cs_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	set_io_pins(bus.dir, pins->clk_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	set_io_pins(bus.dir, pins->out_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	set_io_pins(bus.dir, pins->hi_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	set_io_pins(bus.dir, pins->lo_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	set_io_pins(bus.dir, pins->org_pins, MP_PIN_DIRECTION_OUT, pin_count);
+	if (protocol != CP_I2C)
+		set_io_pins(bus.dir, pins->in_pins,
+			    MP_PIN_DIRECTION_IN | MP_PIN_PULLUP, pin_count);
+
+	/* Deselect the chip, I2C idles with SCL and SDA high */
+	if (bus.cs != NO_PIN)
+		bus.zif[bus.cs] = !bus.cs_active;
+	bus.zif[bus.clk] = bus.i2c ? 1 : bus.cpol;
+	bus.zif[bus.out] = bus.i2c;
+	set_io_pins(bus.zif, pins->hi_pins, 1, pin_count);
+	set_io_pins(bus.zif, pins->org_pins,
+		    handle->device->flags.word_size == 2, pin_count);
+
+	if (minipro_set_zif_direction(handle, bus.dir))
+		return EXIT_FAILURE;
+	if (minipro_set_zif_state(handle, bus.zif))
+		return EXIT_FAILURE;
+
+	/* Set all GND and VCC power pins */
+	set_pwr_pins(bus.drivers, pins->gnd_pins, 1, pin_count, GND_PIN);
+	set_pwr_pins(bus.drivers, pins->vcc_pins, 1, pin_count, VCC_PIN);
+
+	/* Now switch the power on. We need to set voltages after any
+	 * pin driver settings because the firmware will reset all
+	 * voltages to default. */
+	if (minipro_set_pin_drivers(handle, bus.drivers))
+		return EXIT_FAILURE;
+	/* Set VPP and VCC voltages */
+	return minipro_set_voltages(handle, handle->device->voltages.vcc,
+				    handle->device->voltages.vpp);
+}
+
+/* Reset all pin drivers and terminate current session */
+int serial_terminate(minipro_handle_t *handle)
+{
+	zif_queue_free(&bus.queue);
+	free(bus.data);
+	bus.data = NULL;
+	bus.data_size = 0;
+	return minipro_reset_state(handle);
+}
+
+/* Number of SPI or I2C address bytes */
+static int address_bytes(device_t *device)
+{
+	int bytes = SERIAL_ADDR_BYTES(device->variant);
+	if (bytes)
+		return bytes;
+	if (device->protocol_id == CP_I2C)
+		return device->code_memory_size > 2048 ? 2 : 1;
+	return device->code_memory_size > 0x10000 ? 3 : 2;
+}
+
+/* Number of Microwire address bits */
+static int address_bits(device_t *device)
+{
+	int bits = SERIAL_ADDR_BITS(device->variant);
+	if (bits)
+		return bits;
+	uint32_t words = device->code_memory_size / device->flags.word_size;
+	while ((1UL << bits) < words)
+		bits++;
+	return bits;
+}
+
+/* Select the chip and send the start bit, opcode and address bits of a
+ * Microwire command */
+static int mw_command(uint32_t opcode, uint32_t address, int bits)
+{
+	if (spi_select(1))
+		return EXIT_FAILURE;
+	return spi_shift((opcode << bits) | address, bits + 3, 0);
+}
+
+/* Queue busy polls, a poll reads the ready state */
+static int queue_polls(void)
+{
+	for (int i = 0; i < POLL_COUNT; i++) {
+		if (serial_delay(POLL_DELAY))
+			return EXIT_FAILURE;
+		if (bus.i2c) {
+			/* The chip acknowledges its address when ready */
+			if (i2c_start() || i2c_write(I2C_ADDRESS) ||
+			    i2c_stop())
+				return EXIT_FAILURE;
+		} else if (bus.cs_active) {
+			/* Microwire DO is high when ready while CS is high */
+			if (sample(1))
+				return EXIT_FAILURE;
+		} else if (spi_select(1) || spi_shift(SPI_READ_STATUS, 8, 0) ||
+			   spi_shift(0, 8, 1) || spi_select(0)) {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Take the poll results, return 1 if one of them found the chip ready */
+static int polls_ready(void)
+{
+	int ready = 0;
+	for (int i = 0; i < POLL_COUNT; i++) {
+		if (bus.i2c)
+			ready |= acked(1);
+		else if (bus.cs_active)
+			ready |= serial_bits(1);
+		else
+			ready |= !(serial_bits(8) & SPI_STATUS_BUSY);
+	}
+	return ready;
+}
+
+/* Poll until the chip is ready. The polls follow what is queued. */
+static int poll_ready(minipro_handle_t *handle, long timeout)
+{
+	long polls = 0;
+	do {
+		if (polls >= timeout) {
+			fprintf(stderr, "Timeout waiting for the chip.\n");
+			return EXIT_FAILURE;
+		}
+		if (queue_polls() || serial_run(handle))
+			return EXIT_FAILURE;
+		polls += POLL_COUNT;
+	} while (!polls_ready());
+	return EXIT_SUCCESS;
+}
+
+/* Queue an I2C transfer within one device address. A read if buffer is
+ * NULL, the number of acknowledge bits to check is returned in acks. */
+static int i2c_queue(device_t *device, uint32_t address, uint8_t *buffer,
+		     size_t length, size_t *acks)
+{
+	int bytes = address_bytes(device);
+	uint8_t dev = I2C_ADDRESS |
+		      (((address >> (8 * bytes)) & 0x07) << 1);
+	size_t i;
+
+	if (i2c_start() || i2c_write(dev))
+		return EXIT_FAILURE;
+	for (int byte = bytes; byte--;) {
+		if (i2c_write(address >> (8 * byte)))
+			return EXIT_FAILURE;
+	}
+	*acks = 1 + bytes;
+	if (buffer) {
+		for (i = 0; i < length; i++) {
+			if (i2c_write(buffer[i]))
+				return EXIT_FAILURE;
+		}
+		*acks += length;
+		return i2c_stop();
+	}
+
+	if (i2c_start() || i2c_write(dev | I2C_READ))
+		return EXIT_FAILURE;
+	*acks += 1;
+	for (i = 0; i < length; i++) {
+		if (i2c_read(i + 1 < length))
+			return EXIT_FAILURE;
+	}
+	return i2c_stop();
+}
+
+/* Run an I2C transfer and check its acknowledge bits. A chip holding
+ * SCL low gets the transfer queued again with a longer SCL high time. */
+static int i2c_run(minipro_handle_t *handle, uint32_t address,
+		   uint8_t *buffer, size_t length)
+{
+	size_t acks;
+	for (;;) {
+		serial_clear();
+		if (i2c_queue(handle->device, address, buffer, length, &acks) ||
+		    serial_run(handle))
+			return EXIT_FAILURE;
+		if (!bus.stretched)
+			break;
+		if (bus.stretch >= I2C_STRETCH_MAX) {
+			fprintf(stderr, "The chip holds SCL low.\n");
+			return EXIT_FAILURE;
+		}
+		bus.stretch *= 2;
+	}
+
+	/* The acknowledge bits of a read come before the data */
+	if (!acked(acks)) {
+		fprintf(stderr, "No acknowledge from the chip.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Read bytes from the chip */
+int serial_read(minipro_handle_t *handle, uint32_t address, uint8_t *buffer,
+		size_t length)
+{
+	device_t *device = handle->device;
+	size_t i;
+
+	serial_clear();
+	switch (device->protocol_id) {
+	case CP_SPI:
+		if (spi_select(1) || spi_shift(SPI_READ, 8, 0) ||
+		    spi_shift(address, 8 * address_bytes(device), 0))
+			return EXIT_FAILURE;
+		for (i = 0; i < length; i++) {
+			if (spi_shift(0, 8, 1))
+				return EXIT_FAILURE;
+		}
+		if (spi_select(0) || serial_run(handle))
+			return EXIT_FAILURE;
+		break;
+
+	case CP_I2C: {
+		/* The device address bits must stay the same */
+		uint32_t span = 1UL << (8 * address_bytes(device));
+		size_t first = MIN(length, span - address % span);
+		if (i2c_run(handle, address, NULL, first))
+			return EXIT_FAILURE;
+		for (i = 0; i < first; i++)
+			buffer[i] = serial_bits(8);
+		if (first < length)
+			return serial_read(handle, address + first,
+					   buffer + first, length - first);
+		return EXIT_SUCCESS;
+	}
+
+	case CP_MICROWIRE: {
+		/* A sequential read, the chip sends a dummy 0 before the
+		 * first word */
+		int word_bits = 8 * device->flags.word_size;
+		size_t words = (length + device->flags.word_size - 1) /
+			       device->flags.word_size;
+		if (mw_command(MW_READ, address / device->flags.word_size,
+			       address_bits(device)) ||
+		    spi_shift(0, 1, 1))
+			return EXIT_FAILURE;
+		for (i = 0; i < words; i++) {
+			if (spi_shift(0, word_bits, 1))
+				return EXIT_FAILURE;
+		}
+		if (spi_select(0) || serial_run(handle))
+			return EXIT_FAILURE;
+		serial_bits(1);
+		for (i = 0; i < length; i += device->flags.word_size) {
+			uint32_t word = serial_bits(word_bits);
+			buffer[i] = word;
+			if (word_bits == 16 && i + 1 < length)
+				buffer[i + 1] = word >> 8;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	default:
+		fprintf(stderr, "Unimplemented serial protocol 0x%02x\n",
+			device->protocol_id);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < length; i++)
+		buffer[i] = serial_bits(8);
+	return EXIT_SUCCESS;
+}
+
+/* Write one SPI or I2C page and wait for the write cycle */
+static int write_page(minipro_handle_t *handle, uint32_t address,
+		      uint8_t *buffer, size_t length)
+{
+	device_t *device = handle->device;
+	size_t i;
+
+	serial_clear();
+	if (bus.i2c) {
+		if (i2c_run(handle, address, buffer, length))
+			return EXIT_FAILURE;
+		return poll_ready(handle, WRITE_TIMEOUT);
+	}
+
+	if (spi_select(1) || spi_shift(SPI_WRITE_ENABLE, 8, 0) ||
+	    spi_select(0) || spi_select(1) || spi_shift(SPI_WRITE, 8, 0) ||
+	    spi_shift(address, 8 * address_bytes(device), 0))
+		return EXIT_FAILURE;
+	for (i = 0; i < length; i++) {
+		if (spi_shift(buffer[i], 8, 0))
+			return EXIT_FAILURE;
+	}
+	if (spi_select(0))
+		return EXIT_FAILURE;
+	return poll_ready(handle, WRITE_TIMEOUT);
+}
+
+/* Write bytes to the chip */
+int serial_write(minipro_handle_t *handle, uint32_t address, uint8_t *buffer,
+		 size_t length)
+{
+	device_t *device = handle->device;
+	size_t page = device->page_size ? device->page_size : 1;
+	size_t i, n;
+
+	switch (device->protocol_id) {
+	case CP_SPI:
+	case CP_I2C:
+		for (i = 0; i < length; i += n) {
+			/* A page wraps around, stop at its end */
+			n = MIN(length - i, page - (address + i) % page);
+			if (write_page(handle, address + i, buffer + i, n))
+				return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+
+	case CP_MICROWIRE: {
+		int bits = address_bits(device);
+		int word_bits = 8 * device->flags.word_size;
+
+		serial_clear();
+		if (mw_command(MW_WRITE_ENABLE, 0x03 << (bits - 2), bits) ||
+		    spi_select(0))
+			return EXIT_FAILURE;
+		for (i = 0; i < length; i += device->flags.word_size) {
+			uint32_t word = buffer[i];
+			if (word_bits == 16 && i + 1 < length)
+				word |= buffer[i + 1] << 8;
+			/* The chip is busy from the CS falling edge */
+			if (mw_command(MW_WRITE,
+				       (address + i) / device->flags.word_size,
+				       bits) ||
+			    spi_shift(word, word_bits, 0) || spi_select(0) ||
+			    spi_select(1) ||
+			    poll_ready(handle, WRITE_TIMEOUT) || spi_select(0))
+				return EXIT_FAILURE;
+		}
+		if (mw_command(MW_WRITE_DISABLE, 0, bits) || spi_select(0))
+			return EXIT_FAILURE;
+		return serial_run(handle);
+	}
+
+	default:
+		fprintf(stderr, "Unimplemented serial protocol 0x%02x\n",
+			device->protocol_id);
+		return EXIT_FAILURE;
+	}
+}
+
+/* Erase the whole chip */
+int serial_erase(minipro_handle_t *handle)
+{
+	device_t *device = handle->device;
+	int bits;
+
+	serial_clear();
+	switch (device->protocol_id) {
+	case CP_SPI:
+		if (spi_select(1) || spi_shift(SPI_WRITE_ENABLE, 8, 0) ||
+		    spi_select(0) || spi_select(1) ||
+		    spi_shift(SPI_CHIP_ERASE, 8, 0) || spi_select(0))
+			return EXIT_FAILURE;
+		return poll_ready(handle, ERASE_TIMEOUT);
+
+	case CP_MICROWIRE:
+		bits = address_bits(device);
+		if (mw_command(MW_WRITE_ENABLE, 0x03 << (bits - 2), bits) ||
+		    spi_select(0) ||
+		    mw_command(MW_ERASE_ALL, 0x02 << (bits - 2), bits) ||
+		    spi_select(0) || spi_select(1) ||
+		    poll_ready(handle, ERASE_TIMEOUT) || spi_select(0) ||
+		    mw_command(MW_WRITE_DISABLE, 0, bits) || spi_select(0))
+			return EXIT_FAILURE;
+		return serial_run(handle);
+
+	default:
+		fprintf(stderr, "Unimplemented serial erase\n");
+		return EXIT_FAILURE;
+	}
+}
+
+/* The three SPI ID reads, the signature read first as it also wakes
+ * a chip from deep power down */
+typedef struct spi_ids {
+	uint32_t signature; /* 1 byte */
+	uint32_t id; /* 2 bytes, manufacturer and device */
+	uint32_t jedec; /* 3 bytes */
+} spi_ids_t;
+
+static int queue_ids(void)
+{
+	if (spi_select(1) || spi_shift(SPI_READ_SIG, 8, 0) ||
+	    spi_shift(0, 24, 0) || spi_shift(0, 8, 1) || spi_select(0) ||
+	    serial_delay(WAKEUP_DELAY))
+		return EXIT_FAILURE;
+	if (spi_select(1) || spi_shift(SPI_READ_JEDEC_ID, 8, 0) ||
+	    spi_shift(0, 24, 1) || spi_select(0))
+		return EXIT_FAILURE;
+	if (spi_select(1) || spi_shift(SPI_READ_ID, 8, 0) ||
+	    spi_shift(0, 24, 0) || spi_shift(0, 16, 1) || spi_select(0))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static void take_ids(spi_ids_t *ids)
+{
+	ids->signature = serial_bits(8);
+	ids->jedec = serial_bits(24);
+	ids->id = serial_bits(16);
+}
+
+/* A floating or shorted data line reads all ones or all zeros */
+static int valid_id(uint32_t id, int bytes)
+{
+	return id && id != (0xffffffffUL >> (32 - 8 * bytes));
+}
+
+/* Read the chip ID, the command is chosen by the ID length */
+int serial_get_chip_id(minipro_handle_t *handle, uint8_t *type,
+		       uint32_t *device_id)
+{
+	spi_ids_t ids;
+
+	if (handle->device->protocol_id != CP_SPI) {
+		fprintf(stderr, "Unimplemented serial chip ID\n");
+		return EXIT_FAILURE;
+	}
+	serial_clear();
+	if (queue_ids() || serial_run(handle))
+		return EXIT_FAILURE;
+	take_ids(&ids);
+
+	switch (handle->device->chip_id_bytes_count) {
+	case 1:
+		*type = MP_ID_TYPE1;
+		*device_id = ids.signature;
+		break;
+	case 2:
+		*type = MP_ID_TYPE1;
+		*device_id = ids.id;
+		break;
+	default:
+		*type = MP_ID_TYPE5;
+		*device_id = ids.jedec;
+		break;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Probe a 25xx chip of the package type (0 for 8 pins, 1 for 16 pins)
+ * at each voltage. One probe is a single batch: power up and all three
+ * ID reads. The JEDEC ID is preferred, *device_id is 0 if none found.
+ * The TL866A can't set VCC and would probe every chip at 5V. */
+int serial_autodetect(minipro_handle_t *handle, uint8_t type,
+		      uint32_t *device_id)
+{
+	device_t *device = handle->device;
+	device_t probe;
+	spi_ids_t ids;
+	int ret = EXIT_SUCCESS;
+
+	if (handle->version == MP_TL866A) {
+		fprintf(stderr, "Bit banged autodetection needs a programmer "
+				"which can set VCC.\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&probe, 0, sizeof(probe));
+	probe.flags.custom_protocol = 1;
+	probe.flags.word_size = 1;
+	probe.protocol_id = CP_SPI;
+	handle->device = &probe;
+	*device_id = 0;
+
+	for (size_t i = 0; i < sizeof(spi_probes) / sizeof(spi_probes[0]);
+	     i++) {
+		if (spi_probes[i].pin_count != (type ? 16 : 8))
+			continue;
+		probe.variant = spi_probes[i].type;
+		probe.package_details.pin_count = spi_probes[i].pin_count;
+		for (size_t v = 0; v < sizeof(probe_vcc) && !*device_id; v++) {
+			probe.voltages.vcc = probe_vcc[v];
+			if (serial_init(handle) ||
+			    serial_delay(POWER_UP_DELAY) || queue_ids() ||
+			    serial_run(handle)) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+			take_ids(&ids);
+			if (valid_id(ids.jedec, 3))
+				*device_id = ids.jedec;
+			else if (valid_id(ids.id, 2))
+				*device_id = ids.id;
+			else if (valid_id(ids.signature, 1))
+				*device_id = ids.signature;
+			if (minipro_reset_state(handle)) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+		}
+		if (ret || *device_id)
+			break;
+	}
+
+	serial_terminate(handle);
+	handle->device = device;
+	return ret;
+}
@@ -0,0 +1,58 @@
+/*
+ * serial.h - bit banged serial bus algorithms definitions
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+/*
+ * The variant of a CP_SPI, CP_I2C or CP_MICROWIRE chip:
+ * bits 0-7	pinout index in serial_table
+ * bits 8-9	SPI mode
+ * bits 12-15	address bytes (SPI, I2C)
+ * bits 16-23	address bits, 0 to derive them from the size (Microwire)
+ * bit 24	I2C clock stretching, SCL is released instead of driven
+ */
+#define SERIAL_MODE(variant)	     (((variant) >> 8) & 0x03)
+#define SERIAL_ADDR_BYTES(variant)   (((variant) >> 12) & 0x0f)
+#define SERIAL_ADDR_BITS(variant)    (((variant) >> 16) & 0xff)
+#define SERIAL_STRETCH(variant)	     (((variant) >> 24) & 0x01)
+
+int serial_init(minipro_handle_t *);
+int serial_terminate(minipro_handle_t *);
+int serial_read(minipro_handle_t *, uint32_t, uint8_t *, size_t);
+int serial_write(minipro_handle_t *, uint32_t, uint8_t *, size_t);
+int serial_erase(minipro_handle_t *);
+int serial_get_chip_id(minipro_handle_t *, uint8_t *, uint32_t *);
+int serial_autodetect(minipro_handle_t *, uint8_t, uint32_t *);
+
+/*
+ * The bus engines. A transfer is queued as ZIF pin states, the whole
+ * queue is sent with serial_run() and the bits sampled from the chip
+ * are then taken in queue order with serial_bits(). SPI bits are
+ * shifted msb first.
+ */
+int spi_select(int);
+int spi_shift(uint32_t, int, int);
+int i2c_start(void);
+int i2c_stop(void);
+int i2c_write(uint8_t);
+int i2c_read(int);
+int serial_delay(uint32_t);
+int serial_run(minipro_handle_t *);
+uint32_t serial_bits(int);
+
+#endif /* SERIAL_H_ */
@@ -0,0 +1,114 @@
+/*
+ * session.c - Programmer session with automatic reconnect.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "minipro.h"
+#include "session.h"
+#include "usb.h"
+
+/* Called from the hotplug monitor thread. The serial number of a new
+ * programmer can only be read with a transfer, which can't be done on
+ * the event thread, so session_recover() checks it. Only the departure
+ * of our own programmer counts. */
+static void session_hotplug_cb(int arrived, int location, void *user_data)
+{
+	minipro_session_t *session = user_data;
+
+	if (arrived)
+		session->arrivals++;
+	else if (location == session->location)
+		session->departures++;
+}
+
+minipro_session_t *session_open(minipro_handle_t *handle, int retries)
+{
+	minipro_session_t *session = calloc(1, sizeof(minipro_session_t));
+	if (!session) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+	session->handle = handle;
+	session->retries = retries;
+	session->timeout = SESSION_RECONNECT_TIMEOUT;
+	session->location = usb_get_location(handle->usb_handle);
+
+	/* Without hotplug support we just poll for the programmer */
+	session->monitor = usb_hotplug_open(session_hotplug_cb, session);
+	handle->session = session;
+	return session;
+}
+
+void session_close(minipro_session_t *session)
+{
+	if (!session)
+		return;
+	usb_hotplug_close(session->monitor);
+	if (session->handle)
+		session->handle->session = NULL;
+	free(session);
+}
+
+/* Wait for the programmer, reopen it and restart the transaction.
+ * Returns EXIT_SUCCESS if the failed operation can be retried. */
+int session_recover(minipro_session_t *session)
+{
+	if (!session || !session->retries)
+		return EXIT_FAILURE;
+	session->retries--;
+
+	minipro_handle_t *handle = session->handle;
+	fprintf(stderr, "\nConnection lost, waiting for %s (serial %s)...\n",
+		handle->model, handle->serial_number);
+
+	/* Snapshot the hotplug counters, as long as the programmer is known
+	 * to be gone there is no point in trying to open it. A programmer
+	 * plugged in meanwhile is tried for a while, then given up if its
+	 * serial number doesn't match. */
+	int arrivals = session->arrivals;
+	int departures = session->departures;
+	uint32_t wait = session->timeout * 10, probe = 0;
+	do {
+		if (session->arrivals != arrivals) {
+			arrivals = session->arrivals;
+			probe = SESSION_PROBE_TIME * 10;
+		}
+		if (!session->monitor || probe ||
+		    session->departures == departures) {
+			if (!(wait % 5) && !minipro_reconnect(handle))
+				break;
+		}
+		if (probe)
+			probe--;
+		usleep(100000);
+	} while (--wait);
+
+	if (!wait) {
+		fprintf(stderr, "Programmer didn't come back, giving up.\n");
+		return EXIT_FAILURE;
+	}
+
+	session->location = usb_get_location(handle->usb_handle);
+	if (minipro_begin_transaction(handle))
+		return EXIT_FAILURE;
+	if (session->setup && session->setup(handle))
+		return EXIT_FAILURE;
+	fprintf(stderr, "Reconnected, resuming.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/*
+ * session.h - Programmer session with automatic reconnect declarations.
+ *
+ * This file is a part of Minipro.
+ *
+ * Minipro is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Minipro is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "minipro.h"
+
+/* Seconds to wait for the programmer to come back */
+#define SESSION_RECONNECT_TIMEOUT 30
+
+/* Seconds a newly plugged in programmer is tried for its serial number */
+#define SESSION_PROBE_TIME 3
+
+typedef struct minipro_session {
+	minipro_handle_t *handle;
+	void *monitor; /* Hotplug monitor, NULL if not supported */
+	atomic_int location; /* USB port of the programmer */
+	atomic_int arrivals; /* Programmers plugged in */
+	atomic_int departures; /* Departures from location */
+	int retries; /* Reconnect attempts left */
+	uint32_t timeout;
+	/* Re-run after the transaction is restarted, e.g. protect off */
+	int (*setup)(minipro_handle_t *handle);
+} minipro_session_t;
+
+/*
+ * Attach a session to an open handle. When a transfer fails the block
+ * loops call session_recover() which waits for the same programmer
+ * (identified by its serial number), reopens it and re-runs
+ * begin_transaction and the setup hook so the caller can retry the
+ * failed block.
+ */
+minipro_session_t *session_open(minipro_handle_t *handle, int retries);
+void session_close(minipro_session_t *session);
+int session_recover(minipro_session_t *session);
+
+#endif
@@ -23,7 +23,11 @@
 #include "srec.h"
 
 #define MIN_RECORD_SIZE 4
+#define MAX_LINE_SIZE	(MIN_RECORD_SIZE + 255 * 2 + 2)
 #define ROW_SIZE	16
+#define OUT_BUFFER_SIZE 16384
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 typedef enum {
 	S0 = 0,
@@ -51,6 +55,7 @@ typedef struct {
 	uint8_t count;
 	Rectype type;
 	Result result;
+	size_t length;
 	uint8_t data[255];
 } record_t;
 
@@ -68,7 +73,7 @@ static uint8_t hex(const char hex)
 }
 
 /* Parse a record */
-static record_t parse_record(uint8_t *record)
+static record_t parse_record(const uint8_t *record)
 {
 	record_t rec;
 	size_t i;
@@ -80,12 +85,14 @@ static record_t parse_record(uint8_t *record)
 	}
 
 	/* Check for valid characters */
-	for (i = 1; record[i] != '\r' && record[i] != '\n'; i++) {
+	for (i = 1; record[i] && record[i] != '\r' && record[i] != '\n';
+	     i++) {
 		if (hex(record[i]) > 0x0F) {
 			rec.result = BAD_FORMAT;
 			return rec;
 		}
 	}
+	rec.length = i;
 
 	/* Get the record type */
 	rec.type = (hex(record[1]));
@@ -164,11 +171,36 @@ static record_t parse_record(uint8_t *record)
 	return rec;
 }
 
+/* Output is collected here and written with large fwrite calls */
+typedef struct {
+	FILE *file;
+	size_t length;
+	int error;
+	char buffer[OUT_BUFFER_SIZE];
+} output_t;
+
+static void flush_output(output_t *out)
+{
+	if (out->length &&
+	    fwrite(out->buffer, 1, out->length, out->file) != out->length)
+		out->error = 1;
+	out->length = 0;
+}
+
+/* Encode a byte as two hex digits */
+static inline char *put_byte(char *p, uint8_t value)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	p[0] = digits[value >> 4];
+	p[1] = digits[value & 0x0f];
+	return p + 2;
+}
+
 /* Write a record */
-static int write_record(FILE *file, record_t *record)
+static void write_record(output_t *out, record_t *record)
 {
-	uint8_t *pData = record->data;
 	uint8_t fmt;
+	size_t i;
 	switch (record->type) {
 	case S2:
 	case S6:
@@ -187,123 +219,200 @@ static int write_record(FILE *file, record_t *record)
 			   (record->address >> 24) + (record->address >> 16) +
 			   (record->address >> 8) + (record->address & 0xff);
 
-	fprintf(file, "S%01X%02X%0*X", record->type,
-		record->count + 1 + fmt / 2, fmt, record->address);
-	while (record->count--) {
-		fprintf(file, "%02X", *pData);
-		checksum += *pData;
-		pData++;
+	if (out->length + MAX_LINE_SIZE > OUT_BUFFER_SIZE)
+		flush_output(out);
+	char *p = &out->buffer[out->length];
+	*p++ = 'S';
+	*p++ = '0' + record->type;
+	p = put_byte(p, record->count + 1 + fmt / 2);
+	for (i = fmt / 2; i > 0; i--)
+		p = put_byte(p, record->address >> ((i - 1) * 8));
+	for (i = 0; i < record->count; i++) {
+		p = put_byte(p, record->data[i]);
+		checksum += record->data[i];
 	}
-	checksum = ~checksum;
-	fprintf(file, "%02X\r\n", checksum);
-	return EXIT_SUCCESS;
+	p = put_byte(p, ~checksum);
+	*p++ = '\r';
+	*p++ = '\n';
+	out->length = p - out->buffer;
 }
 
-/* Read a Motorola S-Record file */
-int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size)
+/* Copy the part of a record which falls inside the
+ * base..base + size window */
+static int copy_record(record_t *rec, uint8_t *data, uint32_t base,
+		       size_t size, extents_t *extents)
+{
+	size_t first = rec->address < base ? base - rec->address : 0;
+	if (first >= rec->count || rec->address + first - base >= size)
+		return EXIT_SUCCESS;
+	size_t count = rec->count - first;
+	if (rec->address + first - base + count > size)
+		count = size - (rec->address + first - base);
+	memcpy(&data[rec->address + first - base], &rec->data[first], count);
+	return extents ? extents_add(extents, rec->address + first - base,
+				     count) :
+			 EXIT_SUCCESS;
+}
+
+void srec_reader_init(srec_reader_t *reader, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents)
+{
+	memset(reader, 0, sizeof(srec_reader_t));
+	reader->data = data;
+	reader->base = base;
+	reader->size = size;
+	reader->file_size = size;
+	reader->extents = extents;
+}
+
+/* Check if a record looks like an S-Record without loading anything */
+int srec_probe(const uint8_t *record)
+{
+	return parse_record(record).result == NO_ERROR ? SREC_FORMAT :
+							 NOT_SREC;
+}
+
+/* Parse one record. record points to the start code and the record
+ * must be followed by a line end. */
+int srec_reader_record(srec_reader_t *reader, const uint8_t *record)
 {
-	uint32_t line = 0;
 	record_t rec;
-	size_t s0 = 0;
-	size_t chip_size = *size;
+	uint32_t line = ++reader->line;
+
+	reader->last_count = 0;
+	rec = parse_record(record);
+	reader->length = rec.length;
+	switch (rec.result) {
+	case BAD_FORMAT:
+		return NOT_SREC;
+	case BAD_RECORD:
+		fprintf(stderr, "Error on line %u: bad record type.\n", line);
+		return EXIT_FAILURE;
+	case BAD_COUNT:
+		fprintf(stderr, "Error on line %u: bad count.\n", line);
+		return EXIT_FAILURE;
+	case BAD_CKECKSUM:
+		fprintf(stderr, "Error on line %u: bad checksum.\n", line);
+		return EXIT_FAILURE;
+	default:
+		switch (rec.type) {
+		case S0:
+			reader->s0++;
+			fprintf(stderr, "%s\n", rec.data);
+			break;
+		case S1:
+		case S2:
+		case S3:
+			/* If file data size is bigger than chip size
+			 * update the new size. Data outside of an
+			 * address range (base != 0) is ignored. */
+			if (copy_record(&rec, reader->data, reader->base,
+					reader->size, reader->extents)) {
+				fprintf(stderr, "Out of memory!\n");
+				return EXIT_FAILURE;
+			}
+			if (!reader->base &&
+			    reader->size < rec.address + rec.count)
+				reader->file_size = (rec.address + rec.count);
+			reader->last_address = (int64_t)rec.address -
+					       reader->base;
+			reader->last_count = rec.count;
+			break;
+		case S5:
+		case S6:
+			if (rec.address != line - 1 - reader->s0) {
+				fprintf(stderr, "Error: wrong record count.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case S7:
+		case S8:
+		case S9:
+			break;
+		default:
+			fprintf(stderr, "Error on line %u: unknown record type.\n",
+				line);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Read a Motorola S-Record file.
+ * Only data at base..base + size is loaded, relative to base.
+ * The loaded address ranges are added to extents if not NULL. */
+int read_srec_file(uint8_t *buffer, uint8_t *data, uint32_t base,
+		   size_t *size, extents_t *extents)
+{
+	srec_reader_t reader;
+	int ret;
 
+	srec_reader_init(&reader, data, base, *size, extents);
 	while (buffer) {
 		/* Skip empty lines */
-		line++;
 		if (*buffer == '\r' || *buffer == '\n') {
 			buffer++;
 			continue;
 		}
 
-		rec = parse_record(buffer);
-		switch (rec.result) {
-		case BAD_FORMAT:
-			return NOT_SREC;
-		case BAD_RECORD:
-			fprintf(stderr, "Error on line %u: bad record type.\n",
-				line);
-			return EXIT_FAILURE;
-		case BAD_COUNT:
-			fprintf(stderr, "Error on line %u: bad count.\n", line);
-			return EXIT_FAILURE;
-		case BAD_CKECKSUM:
-			fprintf(stderr, "Error on line %u: bad checksum.\n",
-				line);
-			return EXIT_FAILURE;
-		default:
-			switch (rec.type) {
-			case S0:
-				s0++;
-				fprintf(stderr, "%s\n", rec.data);
-				break;
-			case S1:
-			case S2:
-			case S3:
-				/* If file data size is bigger than chip size
-				 * update the new size */
-				if (chip_size >= rec.address + rec.count)
-					/* copy record data */
-					memcpy(&(data[rec.address]), rec.data,
-					       rec.count);
-				else
-					*size = (rec.address + rec.count);
-				break;
-			case S5:
-			case S6:
-				if (rec.address != line - 1 - s0) {
-					fprintf(stderr,
-						"Error: wrong record count.\n");
-					return EXIT_FAILURE;
-				}
-				break;
-			case S7:
-			case S8:
-			case S9:
-				break;
-			default:
-				fprintf(stderr,
-					"Error on line %u: unknown record type.\n",
-					line);
-				return EXIT_FAILURE;
-			}
-		}
-		buffer = (uint8_t *)strchr((char *)++buffer, 'S');
+		if ((ret = srec_reader_record(&reader, buffer)))
+			return ret;
+		buffer += reader.length;
+		buffer = (uint8_t *)strchr((char *)buffer, 'S');
 	}
+	*size = reader.file_size;
 	return SREC_FORMAT;
 }
 
-/* Write an S-Record file */
+/* Write an S-Record file.
+ * Data records hold up to row_size bytes, 0 selects the default of 16.
+ * Records are limited to 255 bytes including address and checksum. */
 int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
-		    int write_rec_count)
+		    size_t row_size, int write_rec_count)
 {
 	record_t rec;
-	size_t len;
+	size_t len, max;
 	uint8_t type;
 	static size_t line = 0;
 
+	output_t *out = malloc(sizeof(output_t));
+	if (!out) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+	out->file = file;
+	out->length = 0;
+	out->error = 0;
+	if (!row_size)
+		row_size = ROW_SIZE;
+
 	char *header = "Written by Minipro open source software";
 	memcpy(rec.data, header, strlen(header));
 	rec.type = S0;
 	rec.count = strlen(header);
 	rec.address = 0x00;
-	write_record(file, &rec);
+	write_record(out, &rec);
 
 	while (size) {
-		if (address < 65536)
+		if (address < 65536) {
 			type = S1;
-		else if (address < 16777216)
+			max = 252;
+		} else if (address < 16777216) {
 			type = S2;
-		else
+			max = 251;
+		} else {
 			type = S3;
-		len = (size > ROW_SIZE ? ROW_SIZE : size);
+			max = 250;
+		}
+		len = MIN(MIN(size, row_size), max);
 		rec.type = type;
 		rec.count = len;
 		rec.address = address;
 		memcpy(rec.data, data, len);
-		write_record(file, &rec);
-		data += ROW_SIZE;
+		write_record(out, &rec);
+		data += len;
 		size -= len;
-		address += ROW_SIZE;
+		address += len;
 		line++;
 	}
 	/* Write record count */
@@ -312,7 +421,15 @@ int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
 		rec.count = 0x00;
 		rec.address = line;
 		line = 0;
-		write_record(file, &rec);
+		write_record(out, &rec);
+	}
+
+	flush_output(out);
+	int error = out->error;
+	free(out);
+	if (error) {
+		fprintf(stderr, "File write error!\n");
+		return EXIT_FAILURE;
 	}
 	return EXIT_SUCCESS;
 }
@@ -20,12 +20,33 @@
 #define SREC_H_
 
 #include <stdint.h>
+#include "extent.h"
 
 #define SREC_FORMAT 0
 #define NOT_SREC    -1
 
-int read_srec_file(uint8_t *buffer, uint8_t *data, size_t *size);
+/* Incremental S-Record reader, fed one record at a time */
+typedef struct srec_reader {
+	uint8_t *data; /* Load window, data[0] is at address base */
+	uint32_t base;
+	size_t size;
+	size_t file_size; /* Grows if data is found past the window */
+	extents_t *extents; /* Loaded address ranges, may be NULL */
+	uint32_t line;
+	size_t s0;
+	size_t length; /* Characters of the last record */
+	int64_t last_address; /* Last data record, relative to base */
+	uint8_t last_count; /* Zero if the last record had no data */
+} srec_reader_t;
+
+void srec_reader_init(srec_reader_t *reader, uint8_t *data, uint32_t base,
+		      size_t size, extents_t *extents);
+int srec_probe(const uint8_t *record);
+int srec_reader_record(srec_reader_t *reader, const uint8_t *record);
+
+int read_srec_file(uint8_t *buffer, uint8_t *data, uint32_t base,
+		   size_t *size, extents_t *extents);
 int write_srec_file(FILE *file, uint8_t *data, uint32_t address, size_t size,
-		    int write_rec_count);
+		    size_t row_size, int write_rec_count);
 
 #endif
@@ -28,6 +28,14 @@ int t48_read_block(minipro_handle_t *handle, uint8_t type,
 			   uint32_t addr, uint8_t *buffer, size_t len);
 int t48_write_block(minipro_handle_t *handle, uint8_t type,
 			    uint32_t addr, uint8_t *buffer, size_t len);
+int t48_read_block_async(minipro_handle_t *handle, uint8_t type,
+			uint32_t addr, uint8_t *buffer, size_t len,
+			minipro_callback_t callback, void *user_data,
+			minipro_cancel_t *cancel);
+int t48_write_block_async(minipro_handle_t *handle, uint8_t type,
+			 uint32_t addr, uint8_t *buffer, size_t len,
+			 minipro_callback_t callback, void *user_data,
+			 minipro_cancel_t *cancel);
 int t48_get_ovc_status(minipro_handle_t *handle,
 			       minipro_status_t *status, uint8_t *ovc);
 int t48_get_chip_id(minipro_handle_t *handle, uint8_t *type,
@@ -46,12 +54,14 @@ int t48_write_jedec_row(minipro_handle_t *handle, uint8_t *buffer, uint8_t row,
 int t48_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 			       uint8_t row, uint8_t flags, size_t size);
 int t48_logic_ic_test(minipro_handle_t *handle);
+int t48_logic_ic_identify(minipro_handle_t *handle, logic_list_t *list);
 int t48_firmware_update(minipro_handle_t *handle, const char *firmware);
 
 int t48_reset_state(minipro_handle_t *handle);
 int t48_set_zif_direction(minipro_handle_t *handle, uint8_t *zif);
 int t48_set_zif_state(minipro_handle_t *handle, uint8_t *zif);
 int t48_get_zif_state(minipro_handle_t *handle, uint8_t *zif);
+int t48_run_zif_queue(minipro_handle_t *handle, struct zif_queue *queue);
 int t48_set_pin_drivers(minipro_handle_t *handle, pin_driver_t *pins);
 int t48_set_voltages(minipro_handle_t *handle, uint8_t vcc, uint8_t vpp);
 
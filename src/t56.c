@@ -26,6 +26,7 @@
 #include <time.h>
 
 #include "database.h"
+#include "logic.h"
 #include "minipro.h"
 #include "t56.h"
 #include "bitbang.h"
@@ -238,12 +239,10 @@ int t56_end_transaction(minipro_handle_t *handle)
 	return EXIT_SUCCESS;
 }
 
-int t56_read_block(minipro_handle_t *handle, uint8_t type,
-			   uint32_t addr, uint8_t *buf, size_t len)
+/* Translate the block type and send the read command header */
+static int read_block_header(minipro_handle_t *handle, uint8_t type,
+			     uint32_t addr, size_t len)
 {
-	if (handle->device->flags.custom_protocol) {
-		return bb_read_block(handle, type, addr, buf, len);
-	}
 	uint8_t msg[64];
 
 	if (type == MP_CODE) {
@@ -262,21 +261,13 @@ int t56_read_block(minipro_handle_t *handle, uint8_t type,
 	/* msg[1] = 1; */
 	format_int(&(msg[2]), len, 2, MP_LITTLE_ENDIAN);
 	format_int(&(msg[4]), addr, 4, MP_LITTLE_ENDIAN);
-	if (msg_send(handle->usb_handle, msg, 8))
-		return EXIT_FAILURE;
-
-	/* T56 off by one firmware bug bug
-	 * Pass a larger buffer, otherwise libusb will overflow.
-	 */
-	return msg_recv(handle->usb_handle, buf, len + 16);
+	return msg_send(handle->usb_handle, msg, 8);
 }
 
-int t56_write_block(minipro_handle_t *handle, uint8_t type,
-			    uint32_t addr, uint8_t *buf, size_t len)
+/* Translate the block type and send the write command header */
+static int write_block_header(minipro_handle_t *handle, uint8_t type,
+			      uint32_t addr, size_t len)
 {
-	if (handle->device->flags.custom_protocol) {
-		return bb_write_block(handle, type, addr, buf, len);
-	}
 	uint8_t msg[64];
 
 	if (type == MP_CODE) {
@@ -294,15 +285,66 @@ int t56_write_block(minipro_handle_t *handle, uint8_t type,
 	msg[0] = type;
 	format_int(&(msg[2]), len, 2, MP_LITTLE_ENDIAN);
 	format_int(&(msg[4]), addr, 4, MP_LITTLE_ENDIAN);
-	if (msg_send(handle->usb_handle, msg, 8))
+	return msg_send(handle->usb_handle, msg, 8);
+}
+
+int t56_read_block(minipro_handle_t *handle, uint8_t type,
+			   uint32_t addr, uint8_t *buf, size_t len)
+{
+	if (handle->device->flags.custom_protocol) {
+		return bb_read_block(handle, type, addr, buf, len);
+	}
+
+	if (read_block_header(handle, type, addr, len))
 		return EXIT_FAILURE;
 
+	/* T56 off by one firmware bug bug
+	 * Pass a larger buffer, otherwise libusb will overflow.
+	 */
+	return msg_recv(handle->usb_handle, buf, len + 16);
+}
+
+int t56_write_block(minipro_handle_t *handle, uint8_t type,
+			    uint32_t addr, uint8_t *buf, size_t len)
+{
+	if (handle->device->flags.custom_protocol) {
+		return bb_write_block(handle, type, addr, buf, len);
+	}
+
+	if (write_block_header(handle, type, addr, len))
+		return EXIT_FAILURE;
 	if (msg_send(handle->usb_handle, buf,
 				handle->device->write_buffer_size))
 		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
 
+/* The command header is sent synchronously, only the payload
+ * transfer is asynchronous. */
+int t56_read_block_async(minipro_handle_t *handle, uint8_t type,
+			 uint32_t addr, uint8_t *buf, size_t len,
+			 minipro_callback_t callback, void *user_data,
+			 minipro_cancel_t *cancel)
+{
+	if (read_block_header(handle, type, addr, len))
+		return EXIT_FAILURE;
+	/* Same firmware bug as in t56_read_block */
+	return msg_recv_async(handle->usb_handle, buf, len + 16, callback,
+			      user_data, cancel);
+}
+
+int t56_write_block_async(minipro_handle_t *handle, uint8_t type,
+			  uint32_t addr, uint8_t *buf, size_t len,
+			  minipro_callback_t callback, void *user_data,
+			  minipro_cancel_t *cancel)
+{
+	if (write_block_header(handle, type, addr, len))
+		return EXIT_FAILURE;
+	return msg_send_async(handle->usb_handle, buf,
+			      handle->device->write_buffer_size, callback,
+			      user_data, cancel);
+}
+
 int t56_read_fuses(minipro_handle_t *handle, uint8_t type,
 			   size_t length, uint8_t items_count, uint8_t *buffer)
 {
@@ -386,7 +428,7 @@ int t56_get_chip_id(minipro_handle_t *handle, uint8_t *type,
 		uint32_t *device_id)
 {
 	if (handle->device->flags.custom_protocol) {
-		return bb_get_chip_id(handle, device_id);
+		return bb_get_chip_id(handle, type, device_id);
 	}
 	uint8_t msg[32], format, id_length;
 	memset(msg, 0x00, sizeof(msg));
@@ -554,157 +596,32 @@ int t56_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 	return EXIT_SUCCESS;
 }
 
-/* Pull: 0=Pull-up, 1=Pull-down */
-static uint8_t *do_ic_test(minipro_handle_t *handle, int pull)
-{
-	uint8_t *vector = handle->device->vectors;
-	uint8_t msg[32];
-	uint8_t *result;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
-	result = calloc(pin_count, handle->device->vector_count);
-	if (!result)
-		return NULL;
-
-	uint8_t *out = result;
-	int n;
-	for (n = 0; n < handle->device->vector_count; n++) {
-		memset(msg, 0xff, 32);
-
-		msg[0] = T56_LOGIC_IC_TEST_VECTOR;
-		msg[1] = handle->device->voltages.vcc;
-		msg[1] |= pull << 7; /* Set the pull-up/pull-down */
-		format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
-		format_int(&msg[4], n, 4, MP_LITTLE_ENDIAN);
-
-		int i;
-		/* Pack the vector to 2 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count;
-		     i++) {
-			if (i & 1)
-				msg[8 + i / 2] |= *vector << 4;
-			else
-				msg[8 + i / 2] = *vector;
-			vector++;
-		}
-
-		/* Send the test vector and read the pin status */
-		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-
-		if (msg[1]) {
-			fprintf(stderr, "Overcurrent protection!\007\n");
-			free(result);
-			return NULL;
-		}
-
-		/* Unpack the result from 2 pin/byte to 1 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count; i++)
-			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
-	}
-
-	return result;
-}
-
-/* Performing a logic test. This is accomplished in two steps.
- * The first step will set a pull-up resistor on all chip outputs (L, H, Z).
- * The second step will set a pull-down resistor on all chip outputs.
- * According to the vector table then each output is compared against the two
- * result array. Considering the weak pull-up/pull-down resistors we can detect
- * L(low) state as 0 in both steps, H(high) state as 1 in both steps and
- * Z(high impedance) state as 1 in step 1 when the pull-up is activated and
- * 0 in step 2 when the pull-down is activated.
- * While for chips with open collector/open drain output we need to perform
- * these two steps to detect the Z state, for chips with totem-pole outputs
- * this is not really necessary but, sometimes internal issues can be
- * detected this way like burned H side or L side output transistors.
- * The C (clock) state is performed in firmware by first pulsing the pin
- * marked as C and then all pins are read back.
- * The X (don't care) state will leave the pin unconnected.
- * The V (VCC) and G (Ground) state will designate the power supply pins.
- */
-
+/* Performing a logic test, see logic.c */
 int t56_logic_ic_test(minipro_handle_t *handle)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t *first_step = NULL;
-	uint8_t *second_step = NULL;
-	int ret = EXIT_FAILURE;
-
 	/* Set the FPGA before testing */
 	if (t56_send_bitstream(handle)){
 		fprintf(stderr, "An error occurred while sending bitstream.\n");
 		return EXIT_FAILURE;
 	}
 
-	if (!(first_step = do_ic_test(handle, 0))) { /* Pull-up active */
-		fprintf(stderr,
-			"Error running the first step of logic test.\n");
-	} else if (!(second_step = do_ic_test(handle, 1))) { /* Pull-down active */
-		fprintf(stderr,
-			"Error running the second step of logic test.\n");
-	} else if (handle->cmdopts->logicic_out) {
-		ret = write_logic_file(handle, first_step, second_step);
-	} else {
-		int errors = 0, err;
-		static const char pst[] = "01LHCZXGV";
-		size_t n = 0;
-
-		printf("      ");
-		for (int pin = 1;
-		     pin <= handle->device->package_details.pin_count; pin++)
-			printf("%-3d", pin);
-		putchar('\n');
-
-		for (int i = 0; i < handle->device->vector_count; i++) {
-			printf("%04d: ", i);
-			for (int pin = 0;
-			     pin < handle->device->package_details.pin_count;
-			     pin++) {
-				err = 0;
-				switch (vector[n]) {
-				case LOGIC_L: /* Pin must be 0 in both steps */
-					if (first_step[n] || second_step[n])
-						err = 1;
-					break;
-				case LOGIC_H: /* Pin must be 1 in both steps */
-					if (!first_step[n] || !second_step[n])
-						err = 1;
-					break;
-				case LOGIC_Z: /* Pin must be 1 in step 1 and 0 in step 2 */
-					if (!first_step[n] || second_step[n])
-						err = 1;
-					break;
-				}
-				printf("%s%c%c ", err ? "\e[0;91m" : "\e[0m",
-				       pst[vector[n]], err ? '-' : ' ');
-				errors += err;
-				n++;
-			}
-			printf("\e[0m\n");
-		}
+	int ret = logic_ic_test(handle, T56_LOGIC_IC_TEST_VECTOR);
+	if (t56_end_transaction(handle))
+		return EXIT_FAILURE;
+	return ret;
+}
 
-		if (errors) {
-			fprintf(stderr,
-				"Logic test failed: %d errors encountered.\n",
-				errors);
-		} else {
-			fprintf(stderr, "Logic test successful.\n");
-			ret = EXIT_SUCCESS;
-		}
+/* Identify an unknown logic IC, see logic.c */
+int t56_logic_ic_identify(minipro_handle_t *handle, logic_list_t *list)
+{
+	if (t56_send_bitstream(handle)) {
+		fprintf(stderr, "An error occurred while sending bitstream.\n");
+		return EXIT_FAILURE;
 	}
 
-	free(second_step);
-	free(first_step);
+	int ret = logic_identify(handle, T56_LOGIC_IC_TEST_VECTOR, list);
 	if (t56_end_transaction(handle))
 		return EXIT_FAILURE;
-
 	return ret;
 }
 
@@ -32,6 +32,14 @@ int t56_read_block(minipro_handle_t *handle, uint8_t type,
 			   uint32_t addr, uint8_t *buffer, size_t len);
 int t56_write_block(minipro_handle_t *handle, uint8_t type,
 			    uint32_t addr, uint8_t *buffer, size_t len);
+int t56_read_block_async(minipro_handle_t *handle, uint8_t type,
+			uint32_t addr, uint8_t *buffer, size_t len,
+			minipro_callback_t callback, void *user_data,
+			minipro_cancel_t *cancel);
+int t56_write_block_async(minipro_handle_t *handle, uint8_t type,
+			 uint32_t addr, uint8_t *buffer, size_t len,
+			 minipro_callback_t callback, void *user_data,
+			 minipro_cancel_t *cancel);
 int t56_spi_autodetect(minipro_handle_t *handle, uint8_t type,
 			       uint32_t *device_id);
 int t56_read_fuses(minipro_handle_t *handle, uint8_t type, size_t size,
@@ -48,5 +56,6 @@ int t56_read_jedec_row(minipro_handle_t *handle, uint8_t *buffer,
 int t56_protect_off(minipro_handle_t *handle);
 int t56_protect_on(minipro_handle_t *handle);
 int t56_logic_ic_test(minipro_handle_t *handle);
+int t56_logic_ic_identify(minipro_handle_t *handle, logic_list_t *list);
 int t56_firmware_update(minipro_handle_t *handle, const char *firmware);
 #endif
@@ -26,6 +26,7 @@
 #include <assert.h>
 
 #include "database.h"
+#include "logic.h"
 #include "minipro.h"
 #include "tl866a.h"
 #include "bitbang.h"
@@ -424,6 +425,9 @@ int tl866a_read_calibration(minipro_handle_t *handle, uint8_t *buffer,
 int tl866a_get_chip_id(minipro_handle_t *handle, uint8_t *type,
 		       uint32_t *device_id)
 {
+	if (handle->device->flags.custom_protocol) {
+		return bb_get_chip_id(handle, type, device_id);
+	}
 	uint8_t msg[64], format, id_length;
 	msg_init(handle, TL866A_GET_CHIP_ID, msg, sizeof(msg));
 	if (msg_send(handle->usb_handle, msg, 8))
@@ -1305,21 +1309,11 @@ static int pwr_init(minipro_handle_t *handle, uint8_t *vector, size_t pin_count)
 	return msg_send(handle->usb_handle, pwr, sizeof(pwr));
 }
 
-static uint8_t *do_ic_test(minipro_handle_t *handle)
+/* Run all vectors once, the power pins must be set up already */
+static int do_ic_test(void *ctx, uint64_t *result)
 {
+	minipro_handle_t *handle = ctx;
 	uint8_t pin_count = handle->device->package_details.pin_count;
-	uint8_t *result = calloc(pin_count, handle->device->vector_count);
-
-	if (!result)
-		return NULL;
-
-	if (handle->device->vector_count == 0) {
-		return NULL;
-	}
-
-	if (pwr_init(handle, handle->device->vectors, pin_count)) {
-		return NULL;
-	}
 
 	uint8_t msg[47], dir[47], out[47];
 	memset(msg, 0x00, sizeof(msg));
@@ -1330,7 +1324,6 @@ static uint8_t *do_ic_test(minipro_handle_t *handle)
 	dir[0] = TL866A_SET_DIR;
 	out[0] = TL866A_SET_OUT;
 
-	uint8_t *vout = result;
 	uint8_t value;
 	int zif_pin, pin, v, sm;
 	for (v = 0; v < handle->device->vector_count; v++) {
@@ -1365,14 +1358,12 @@ static uint8_t *do_ic_test(minipro_handle_t *handle)
 					/* Set pin state */
 					if (msg_send(handle->usb_handle, out,
 						     sizeof(out))) {
-						free(result);
-						return NULL;
+						return EXIT_FAILURE;
 					}
 					/* Set pin direction */
 					if (msg_send(handle->usb_handle, dir,
 						     sizeof(dir))) {
-						free(result);
-						return NULL;
+						return EXIT_FAILURE;
 					}
 				} else {
 					/* State machine 2 and 3;
@@ -1384,8 +1375,7 @@ static uint8_t *do_ic_test(minipro_handle_t *handle)
 						if (msg_send(handle->usb_handle,
 							     out,
 							     sizeof(out))) {
-							free(result);
-							return NULL;
+							return EXIT_FAILURE;
 						}
 					}
 				}
@@ -1395,28 +1385,27 @@ static uint8_t *do_ic_test(minipro_handle_t *handle)
 		/* Read back all pins */
 		msg[0] = TL866A_READ_ZIF_PINS;
 		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
+			return EXIT_FAILURE;
 		}
 
 		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
+			return EXIT_FAILURE;
 		}
 
 		/* Save the result to the result vector */
+		result[v] = 0;
 		for (pin = 0; pin < pin_count; pin++) {
-			*vout++ = msg[PIN(pin, pin_count) + 7];
+			if (msg[PIN(pin, pin_count) + 7])
+				result[v] |= 1ULL << pin;
 		}
 	}
 
-	return result;
+	return EXIT_SUCCESS;
 }
 
 int tl866a_logic_ic_test(minipro_handle_t *handle)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t *result = NULL;
+	uint64_t *result = NULL;
 	int ret = EXIT_FAILURE;
 
 	/* Check for invalid pin count */
@@ -1425,58 +1414,30 @@ int tl866a_logic_ic_test(minipro_handle_t *handle)
 		return ret;
 	}
 
+	if (!handle->device->vector_count) {
+		fprintf(stderr, "Error running logic test.\n");
+		return ret;
+	}
+
 	/* reset the programmer state */
 	if (tl866a_end_transaction(handle))
 		return EXIT_FAILURE;
 
-	if (!(result = do_ic_test(handle))) {
+	if (pwr_init(handle, handle->device->vectors,
+		     handle->device->package_details.pin_count)) {
+		fprintf(stderr, "Error running logic test.\n");
+	} else if (handle->cmdopts->soak_passes ||
+		   handle->cmdopts->soak_seconds) {
+		ret = logic_soak(handle, do_ic_test, handle, 0);
+	} else if (!(result = calloc(handle->device->vector_count + 1,
+				     sizeof(uint64_t)))) {
+		fprintf(stderr, "Out of memory!\n");
+	} else if (do_ic_test(handle, result)) {
 		fprintf(stderr, "Error running logic test.\n");
 	} else if (handle->cmdopts->logicic_out) {
 		ret = write_logic_file(handle, result, result);
 	} else {
-		int errors = 0, err;
-		static const char pst[] = "01LHCZXGV";
-		size_t n = 0;
-
-		printf("      ");
-		for (int pin = 1;
-		     pin <= handle->device->package_details.pin_count; pin++)
-			printf("%-3d", pin);
-		putchar('\n');
-
-		for (int i = 0; i < handle->device->vector_count; i++) {
-			printf("%04d: ", i);
-			for (int pin = 0;
-			     pin < handle->device->package_details.pin_count;
-			     pin++) {
-				err = 0;
-				switch (vector[n]) {
-				case LOGIC_L: /* Pin must be 0 */
-					if (result[n])
-						err = 1;
-					break;
-				case LOGIC_H:
-				case LOGIC_Z: /* Pin must be 1 */
-					if (!result[n])
-						err = 1;
-					break;
-				}
-				printf("%s%c%c ", err ? "\e[0;91m" : "\e[0m",
-				       pst[vector[n]], err ? '-' : ' ');
-				errors += err;
-				n++;
-			}
-			printf("\e[0m\n");
-		}
-
-		if (errors) {
-			fprintf(stderr,
-				"Logic test failed: %d errors encountered.\n",
-				errors);
-		} else {
-			fprintf(stderr, "Logic test successful.\n");
-			ret = EXIT_SUCCESS;
-		}
+		ret = logic_check(handle, result, NULL);
 	}
 
 	free(result);
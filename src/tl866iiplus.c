@@ -25,6 +25,7 @@
 #include <time.h>
 
 #include "database.h"
+#include "logic.h"
 #include "minipro.h"
 #include "tl866iiplus.h"
 #include "bitbang.h"
@@ -287,30 +288,60 @@ int tl866iiplus_end_transaction(minipro_handle_t *handle)
 	return msg_send(handle->usb_handle, msg, sizeof(msg));
 }
 
-int tl866iiplus_read_block(minipro_handle_t *handle, uint8_t type,
-			   uint32_t addr, uint8_t *buf, size_t len)
+/* Translate the block type and send the read command header */
+static int read_block_header(minipro_handle_t *handle, uint8_t *type,
+			     uint32_t addr, size_t len)
 {
-	if (handle->device->flags.custom_protocol) {
-		return bb_read_block(handle, type, addr, buf, len);
-	}
 	uint8_t msg[64];
 
+	if (*type == MP_CODE) {
+		*type = TL866IIPLUS_READ_CODE;
+	} else if (*type == MP_DATA) {
+		*type = TL866IIPLUS_READ_DATA;
+	} else if (*type == MP_USER) {
+		*type = TL866IIPLUS_READ_USER_DATA;
+	} else {
+		fprintf(stderr, "Unknown type for read_block (%d)\n", *type);
+		return EXIT_FAILURE;
+	}
+
+	memset(msg, 0x00, sizeof(msg));
+	msg[0] = *type;
+	format_int(&(msg[2]), len, 2, MP_LITTLE_ENDIAN);
+	format_int(&(msg[4]), addr, 4, MP_LITTLE_ENDIAN);
+	return msg_send(handle->usb_handle, msg, 8);
+}
+
+/* Translate the block type and build the write command header */
+static int write_block_header(uint8_t *msg, uint8_t type, uint32_t addr,
+			      size_t len)
+{
 	if (type == MP_CODE) {
-		type = TL866IIPLUS_READ_CODE;
+		type = TL866IIPLUS_WRITE_CODE;
 	} else if (type == MP_DATA) {
-		type = TL866IIPLUS_READ_DATA;
+		type = TL866IIPLUS_WRITE_DATA;
 	} else if (type == MP_USER) {
-		type = TL866IIPLUS_READ_USER_DATA;
+		type = TL866IIPLUS_WRITE_USER_DATA;
 	} else {
-		fprintf(stderr, "Unknown type for read_block (%d)\n", type);
+		fprintf(stderr, "Unknown type for write_block (%d)\n", type);
 		return EXIT_FAILURE;
 	}
 
-	memset(msg, 0x00, sizeof(msg));
+	memset(msg, 0x00, 64);
 	msg[0] = type;
 	format_int(&(msg[2]), len, 2, MP_LITTLE_ENDIAN);
 	format_int(&(msg[4]), addr, 4, MP_LITTLE_ENDIAN);
-	if (msg_send(handle->usb_handle, msg, 8))
+	return EXIT_SUCCESS;
+}
+
+int tl866iiplus_read_block(minipro_handle_t *handle, uint8_t type,
+			   uint32_t addr, uint8_t *buf, size_t len)
+{
+	if (handle->device->flags.custom_protocol) {
+		return bb_read_block(handle, type, addr, buf, len);
+	}
+
+	if (read_block_header(handle, &type, addr, len))
 		return EXIT_FAILURE;
 
 	/* data_memory2 page is always read over endpoint 1 */
@@ -327,21 +358,8 @@ int tl866iiplus_write_block(minipro_handle_t *handle, uint8_t type,
 	}
 	uint8_t msg[64];
 
-	if (type == MP_CODE) {
-		type = TL866IIPLUS_WRITE_CODE;
-	} else if (type == MP_DATA) {
-		type = TL866IIPLUS_WRITE_DATA;
-	} else if (type == MP_USER) {
-		type = TL866IIPLUS_WRITE_USER_DATA;
-	} else {
-		fprintf(stderr, "Unknown type for write_block (%d)\n", type);
+	if (write_block_header(msg, type, addr, len))
 		return EXIT_FAILURE;
-	}
-
-	memset(msg, 0x00, sizeof(msg));
-	msg[0] = type;
-	format_int(&(msg[2]), len, 2, MP_LITTLE_ENDIAN);
-	format_int(&(msg[4]), addr, 4, MP_LITTLE_ENDIAN);
 	if (len < 57) { /* If the header + payload is up to 64 bytes */
 		memcpy(&(msg[8]), buf,
 		       len); /* Send the message over the endpoint 1 */
@@ -357,6 +375,45 @@ int tl866iiplus_write_block(minipro_handle_t *handle, uint8_t type,
 	return EXIT_SUCCESS;
 }
 
+/* The command header is sent synchronously, only the payload
+ * transfer is asynchronous. */
+int tl866iiplus_read_block_async(minipro_handle_t *handle, uint8_t type,
+				 uint32_t addr, uint8_t *buf, size_t len,
+				 minipro_callback_t callback, void *user_data,
+				 minipro_cancel_t *cancel)
+{
+	if (read_block_header(handle, &type, addr, len))
+		return EXIT_FAILURE;
+
+	if (type == TL866IIPLUS_READ_USER_DATA)
+		return msg_recv_async(handle->usb_handle, buf, len, callback,
+				      user_data, cancel);
+	return read_payload2_async(handle->usb_handle, buf, len, 64, callback,
+				   user_data, cancel);
+}
+
+int tl866iiplus_write_block_async(minipro_handle_t *handle, uint8_t type,
+				  uint32_t addr, uint8_t *buf, size_t len,
+				  minipro_callback_t callback, void *user_data,
+				  minipro_cancel_t *cancel)
+{
+	uint8_t msg[64];
+
+	/* Small blocks fit in a single endpoint 1 message */
+	if (len < 57) {
+		callback(tl866iiplus_write_block(handle, type, addr, buf, len),
+			 user_data);
+		return EXIT_SUCCESS;
+	}
+
+	if (write_block_header(msg, type, addr, len) ||
+	    msg_send(handle->usb_handle, msg, 8))
+		return EXIT_FAILURE;
+	return write_payload2_async(handle->usb_handle, buf,
+				    handle->device->write_buffer_size, 64,
+				    callback, user_data, cancel);
+}
+
 int tl866iiplus_read_fuses(minipro_handle_t *handle, uint8_t type,
 			   size_t length, uint8_t items_count, uint8_t *buffer)
 {
@@ -440,7 +497,7 @@ int tl866iiplus_get_chip_id(minipro_handle_t *handle, uint8_t *type,
 			    uint32_t *device_id)
 {
 	if (handle->device->flags.custom_protocol) {
-		return bb_get_chip_id(handle, device_id);
+		return bb_get_chip_id(handle, type, device_id);
 	}
 	uint8_t msg[8], format, id_length;
 	memset(msg, 0x00, sizeof(msg));
@@ -1105,151 +1162,22 @@ cleanup:
 	return ret;
 }
 
-/* Pull: 0=Pull-up, 1=Pull-down */
-static uint8_t *do_ic_test(minipro_handle_t *handle, int pull)
+/* Performing a logic test, see logic.c */
+int tl866iiplus_logic_ic_test(minipro_handle_t *handle)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t msg[32];
-	uint8_t *result;
-	uint8_t pin_count = handle->device->package_details.pin_count;
-
-	result = calloc(pin_count, handle->device->vector_count);
-	if (!result)
-		return NULL;
-
-	uint8_t *out = result;
-	int n;
-	for (n = 0; n < handle->device->vector_count; n++) {
-		memset(msg, 0xff, sizeof(msg));
-
-		msg[0] = TL866IIPLUS_LOGIC_IC_TEST_VECTOR;
-		msg[1] = handle->device->voltages.vcc;
-		msg[1] |= pull << 7; /* Set the pull-up/pull-down */
-		format_int(&msg[2], pin_count, 2, MP_LITTLE_ENDIAN);
-		format_int(&msg[4], n, 4, MP_LITTLE_ENDIAN);
-
-		int i;
-		/* Pack the vector to 2 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count;
-		     i++) {
-			if (i & 1)
-				msg[8 + i / 2] |= *vector << 4;
-			else
-				msg[8 + i / 2] = *vector;
-			vector++;
-		}
-
-		/* Send the test vector and read the pin status */
-		if (msg_send(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-		if (msg_recv(handle->usb_handle, msg, sizeof(msg))) {
-			free(result);
-			return NULL;
-		}
-
-		if (msg[1]) {
-			fprintf(stderr, "Overcurrent protection!\007\n");
-			free(result);
-			return NULL;
-		}
-
-		/* Unpack the result from 2 pin/byte to 1 pin/byte */
-		for (i = 0; i < handle->device->package_details.pin_count; i++)
-			*out++ = (msg[8 + i / 2] >> (4 * (i & 1))) & 0xf;
-	}
-
-	return result;
+	int ret = logic_ic_test(handle, TL866IIPLUS_LOGIC_IC_TEST_VECTOR);
+	if (tl866iiplus_end_transaction(handle))
+		return EXIT_FAILURE;
+	return ret;
 }
 
-/* Performing a logic test. This is accomplished in two steps.
- * The first step will set a pull-up resistor on all chip outputs (L, H, Z).
- * The second step will set a pull-down resistor on all chip outputs.
- * According to the vector table then each output is compared against the two
- * result array. Considering the weak pull-up/pull-down resistors we can detect
- * L(low) state as 0 in both steps, H(high) state as 1 in both steps and
- * Z(high impedance) state as 1 in step 1 when the pull-up is activated and
- * 0 in step 2 when the pull-down is activated.
- * While for chips with open collector/open drain output we need to perform
- * these two steps to detect the Z state, for chips with totem-pole outputs
- * this is not really necessary but, sometimes internal issues can be
- * detected this way like burned H side or L side output transistors.
- * The C (clock) state is performed in firmware by first pulsing the pin
- * marked as C and then all pins are read back.
- * The X (don't care) state will leave the pin unconnected.
- * The V (VCC) and G (Ground) state will designate the power supply pins.
- */
-
-int tl866iiplus_logic_ic_test(minipro_handle_t *handle)
+/* Identify an unknown logic IC, see logic.c */
+int tl866iiplus_logic_ic_identify(minipro_handle_t *handle, logic_list_t *list)
 {
-	uint8_t *vector = handle->device->vectors;
-	uint8_t *first_step = NULL;
-	uint8_t *second_step = NULL;
-	int ret = EXIT_FAILURE;
-
-	if (!(first_step = do_ic_test(handle, 0))) { /* Pull-up active */
-		fprintf(stderr,
-			"Error running the first step of logic test.\n");
-	} else if (!(second_step = do_ic_test(handle, 1))) { /* Pull-down active */
-		fprintf(stderr,
-			"Error running the second step of logic test.\n");
-	} else if (handle->cmdopts->logicic_out) {
-		ret = write_logic_file(handle, first_step, second_step);
-	} else {
-		int errors = 0, err;
-		static const char pst[] = "01LHCZXGV";
-		size_t n = 0;
-
-		printf("      ");
-		for (int pin = 1;
-		     pin <= handle->device->package_details.pin_count; pin++)
-			printf("%-3d", pin);
-		putchar('\n');
-
-		for (int i = 0; i < handle->device->vector_count; i++) {
-			printf("%04d: ", i);
-			for (int pin = 0;
-			     pin < handle->device->package_details.pin_count;
-			     pin++) {
-				err = 0;
-				switch (vector[n]) {
-				case LOGIC_L: /* Pin must be 0 in both steps */
-					if (first_step[n] || second_step[n])
-						err = 1;
-					break;
-				case LOGIC_H: /* Pin must be 1 in both steps */
-					if (!first_step[n] || !second_step[n])
-						err = 1;
-					break;
-				case LOGIC_Z: /* Pin must be 1 in step 1 and 0 in step 2 */
-					if (!first_step[n] || second_step[n])
-						err = 1;
-					break;
-				}
-				printf("%s%c%c ", err ? "\e[0;91m" : "\e[0m",
-				       pst[vector[n]], err ? '-' : ' ');
-				errors += err;
-				n++;
-			}
-			printf("\e[0m\n");
-		}
-
-		if (errors) {
-			fprintf(stderr,
-				"Logic test failed: %d errors encountered.\n",
-				errors);
-		} else {
-			fprintf(stderr, "Logic test successful.\n");
-			ret = EXIT_SUCCESS;
-		}
-	}
-
-	free(second_step);
-	free(first_step);
+	int ret =
+		logic_identify(handle, TL866IIPLUS_LOGIC_IC_TEST_VECTOR, list);
 	if (tl866iiplus_end_transaction(handle))
 		return EXIT_FAILURE;
-
 	return ret;
 }
 
@@ -1571,6 +1499,52 @@ int tl866iiplus_get_zif_state(minipro_handle_t *handle, uint8_t *zif)
 	return EXIT_SUCCESS;
 }
 
+/* Send all queued pin states and reads back to back */
+int tl866iiplus_run_zif_queue(minipro_handle_t *handle, zif_queue_t *queue)
+{
+	bb_batch_t batch;
+	uint8_t (*replies)[48] = NULL;
+	size_t i;
+	int ret = EXIT_FAILURE;
+
+	memset(&batch, 0, sizeof(batch));
+	for (i = 0; i < queue->count; i++) {
+		bb_msg_t *msg = bb_batch_add(&batch);
+		if (!msg)
+			goto cleanup;
+		if (queue->ops[i].type == ZIF_OP_READ) {
+			msg->data[0] = TL866IIPLUS_READ_PINS;
+			msg->length = 8;
+			msg->reply = 1;
+		} else {
+			msg->data[0] = TL866IIPLUS_SET_OUT;
+			memcpy(&msg->data[8], queue->ops[i].zif, 40);
+			msg->length = 48;
+		}
+	}
+
+	replies = malloc(queue->result_size * 48 + 1);
+	if (!replies) {
+		fprintf(stderr, "Out of memory!\n");
+		goto cleanup;
+	}
+	if (bb_batch_send(handle, &batch, replies))
+		goto cleanup;
+	for (i = 0; i < queue->count; i++) {
+		if (queue->ops[i].type == ZIF_OP_READ) {
+			memcpy(queue->results[queue->result_count],
+			       &replies[queue->result_count][8], 40);
+			queue->result_count++;
+		}
+	}
+	ret = EXIT_SUCCESS;
+
+cleanup:
+	free(batch.msgs);
+	free(replies);
+	return ret;
+}
+
 int tl866iiplus_set_pin_drivers(minipro_handle_t *handle, pin_driver_t *pins)
 {
 	uint8_t msg[48];
@@ -91,6 +91,14 @@ int tl866iiplus_read_block(minipro_handle_t *handle, uint8_t type,
 			   uint32_t addr, uint8_t *buffer, size_t len);
 int tl866iiplus_write_block(minipro_handle_t *handle, uint8_t type,
 			    uint32_t addr, uint8_t *buffer, size_t len);
+int tl866iiplus_read_block_async(minipro_handle_t *handle, uint8_t type,
+			uint32_t addr, uint8_t *buffer, size_t len,
+			minipro_callback_t callback, void *user_data,
+			minipro_cancel_t *cancel);
+int tl866iiplus_write_block_async(minipro_handle_t *handle, uint8_t type,
+			 uint32_t addr, uint8_t *buffer, size_t len,
+			 minipro_callback_t callback, void *user_data,
+			 minipro_cancel_t *cancel);
 int tl866iiplus_protect_off(minipro_handle_t *handle);
 int tl866iiplus_protect_on(minipro_handle_t *handle);
 int tl866iiplus_get_ovc_status(minipro_handle_t *handle,
@@ -115,10 +123,13 @@ int tl866iiplus_hardware_check(minipro_handle_t *handle);
 int tl866iiplus_firmware_update(minipro_handle_t *handle, const char *firmware);
 int tl866iiplus_pin_test(minipro_handle_t *handle);
 int tl866iiplus_logic_ic_test(minipro_handle_t *handle);
+int tl866iiplus_logic_ic_identify(minipro_handle_t *handle,
+				  logic_list_t *list);
 int tl866iiplus_reset_state(minipro_handle_t *);
 int tl866iiplus_set_zif_direction(struct minipro_handle *, uint8_t *);
 int tl866iiplus_set_zif_state(struct minipro_handle *, uint8_t *);
 int tl866iiplus_get_zif_state(struct minipro_handle *, uint8_t *);
+int tl866iiplus_run_zif_queue(struct minipro_handle *, struct zif_queue *);
 int tl866iiplus_set_pin_drivers(struct minipro_handle *, pin_driver_t *);
 int tl866iiplus_set_voltages(struct minipro_handle *, uint8_t, uint8_t);
 #endif
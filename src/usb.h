@@ -19,8 +19,20 @@
 #define USB_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+/* Async transfer completion callback, status is EXIT_SUCCESS or EXIT_FAILURE */
+typedef void (*usb_callback_t)(int status, void *user_data);
+
+/* Cancellation token for async transfers. Zero initialize it before use. */
+typedef struct usb_cancel {
+	volatile int cancelled;
+	void *pending; /* Transfer in flight, private to the usb layer */
+} usb_cancel_t;
 
 void *usb_open(uint8_t verbose);
+/* Open the index-th programmer, counting the TL866A/CS ones first */
+void *usb_open_index(uint8_t verbose, int index);
 int usb_close(void *usb_handle);
 int minipro_get_devices_count(uint8_t version);
 
@@ -36,4 +48,33 @@ static inline int read_payload(void *handle, uint8_t *buffer, size_t length)
 {
 	return read_payload2(handle, buffer, length, 64);
 }
+
+/* Asynchronous versions of the above. These return EXIT_SUCCESS if the
+ * transfer was submitted, in which case the callback is called exactly
+ * once when the transfer is done, failed or was cancelled. The cancel
+ * token may be NULL. The buffer must stay valid until the callback.
+ */
+int msg_send_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel);
+int msg_recv_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel);
+int write_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit, usb_callback_t callback,
+			 void *user_data, usb_cancel_t *cancel);
+int read_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			size_t limit, usb_callback_t callback, void *user_data,
+			usb_cancel_t *cancel);
+void usb_cancel(void *handle, usb_cancel_t *cancel);
+
+/* Hotplug monitor, arrived is 1 when a programmer was plugged in and 0
+ * when it was removed. location is the USB port of the programmer as
+ * returned by usb_get_location. usb_hotplug_open returns NULL if hotplug
+ * events are not supported. */
+typedef void (*usb_hotplug_callback_t)(int arrived, int location,
+				       void *user_data);
+void *usb_hotplug_open(usb_hotplug_callback_t callback, void *user_data);
+void usb_hotplug_close(void *monitor);
+int usb_get_location(void *handle);
 #endif
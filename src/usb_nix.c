@@ -16,6 +16,8 @@
  */
 
 #include <libusb.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,61 +34,282 @@
 #define MP_USBTIMEOUT	    5000
 #define MP_USB_READ_TIMEOUT 360000
 
+/* Opaque structure used externally as handle.
+ * Each open programmer gets its own libusb context and a thread which
+ * does nothing else than dispatching libusb events for that context.
+ * Async transfer callbacks are therefore always called from the event
+ * thread and the submitter just sleeps on the condition variable until
+ * its transfers are done.
+ */
+typedef struct usb_handle {
+	libusb_context *ctx;
+	libusb_device_handle *dev;
+	pthread_t event_thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	atomic_int running;
+} usb_handle_t;
+
+/* Completion token used to wait for an async transfer */
+typedef struct usb_completion {
+	usb_handle_t *usb;
+	int completed;
+	int status;
+} usb_completion_t;
+
+static void *event_thread_func(void *arg)
+{
+	usb_handle_t *usb = arg;
+
+	while (usb->running) {
+		/* Don't bail out on errors here, somebody may still wait
+		 * for a transfer which libusb will eventually time out. */
+		libusb_handle_events(usb->ctx);
+	}
+	return NULL;
+}
+
+/* Open the index-th programmer on the bus, TL866A/CS ones first */
+static libusb_device_handle *open_device(libusb_context *ctx, int index)
+{
+	static const uint16_t ids[][2] = {
+		{ MP_TL866_VID, MP_TL866_PID },
+		{ MP_TL866II_VID, MP_TL866II_PID },
+	};
+	libusb_device **devs;
+	libusb_device_handle *dev = NULL;
+
+	ssize_t count = libusb_get_device_list(ctx, &devs);
+	if (count < 0)
+		return NULL;
+	for (size_t id = 0; id < sizeof(ids) / sizeof(ids[0]); id++) {
+		for (ssize_t i = 0; i < count; i++) {
+			struct libusb_device_descriptor desc;
+			if (libusb_get_device_descriptor(devs[i], &desc) ||
+			    desc.idVendor != ids[id][0] ||
+			    desc.idProduct != ids[id][1])
+				continue;
+			if (!index--) {
+				if (libusb_open(devs[i], &dev))
+					dev = NULL;
+				libusb_free_device_list(devs, 1);
+				return dev;
+			}
+		}
+	}
+	libusb_free_device_list(devs, 1);
+	return NULL;
+}
+
 /* Open usb device */
 void *usb_open(uint8_t verbose)
 {
-	int ret = libusb_init(NULL);
+	return usb_open_index(verbose, 0);
+}
+
+void *usb_open_index(uint8_t verbose, int index)
+{
+	usb_handle_t *usb = calloc(1, sizeof(usb_handle_t));
+	if (!usb) {
+		if (verbose)
+			fprintf(stderr, "Out of memory!\n");
+		return NULL;
+	}
+
+	int ret = libusb_init(&usb->ctx);
 	if (ret < 0) {
 		if (verbose)
 			fprintf(stderr, "Error initializing libusb: %s\n",
 				libusb_error_name(ret));
+		free(usb);
 		return NULL;
 	}
 
-	void *usb_handle = libusb_open_device_with_vid_pid(NULL, MP_TL866_VID,
-							   MP_TL866_PID);
-	if (usb_handle == NULL) {
-		/* We didn't match the vid / pid of the "original" TL866.
-		 * So try the new TL866II+ */
-		usb_handle = libusb_open_device_with_vid_pid(
-			NULL, MP_TL866II_VID, MP_TL866II_PID);
-
-		/* If we don't get that either report error in connecting */
-		if (usb_handle == NULL) {
-			libusb_exit(NULL);
-			if (verbose)
-				fprintf(stderr, "No programmer found.\n");
-			return NULL;
-		}
+	usb->dev = open_device(usb->ctx, index);
+	if (usb->dev == NULL) {
+		libusb_exit(usb->ctx);
+		free(usb);
+		if (verbose)
+			fprintf(stderr, "No programmer found.\n");
+		return NULL;
 	}
 
-	ret = libusb_claim_interface(usb_handle, 0);
+	ret = libusb_claim_interface(usb->dev, 0);
 	if (ret != 0) {
 		if (verbose)
 			fprintf(stderr, "\nIO error: claim_interface: %s\n",
 				libusb_error_name(ret));
-		libusb_close(usb_handle);
-		libusb_exit(NULL);
+		libusb_close(usb->dev);
+		libusb_exit(usb->ctx);
+		free(usb);
 		return NULL;
 	}
-	return usb_handle;
+
+	/* Start the event thread */
+	pthread_mutex_init(&usb->lock, NULL);
+	pthread_cond_init(&usb->cond, NULL);
+	usb->running = 1;
+	if (pthread_create(&usb->event_thread, NULL, event_thread_func, usb)) {
+		if (verbose)
+			fprintf(stderr, "Can't create the USB event thread.\n");
+		pthread_cond_destroy(&usb->cond);
+		pthread_mutex_destroy(&usb->lock);
+		libusb_release_interface(usb->dev, 0);
+		libusb_close(usb->dev);
+		libusb_exit(usb->ctx);
+		free(usb);
+		return NULL;
+	}
+	return usb;
 }
 
 /* Close usb device */
-int usb_close(void *usb_handle)
+int usb_close(void *handle)
 {
+	usb_handle_t *usb = handle;
 	int ret = EXIT_SUCCESS;
-	ret = libusb_release_interface(usb_handle, 0);
+	ret = libusb_release_interface(usb->dev, 0);
 	if (ret != 0 && ret != LIBUSB_ERROR_NO_DEVICE) {
 		fprintf(stderr, "\nIO error: release_interface: %s\n",
 			libusb_error_name(ret));
 		ret = EXIT_FAILURE;
 	}
-	libusb_close(usb_handle);
-	libusb_exit(NULL);
+
+	/* Wake up libusb_handle_events() so the event thread sees the
+	 * running flag cleared, even if it tested the flag just before. */
+	usb->running = 0;
+	libusb_interrupt_event_handler(usb->ctx);
+	libusb_close(usb->dev);
+	pthread_join(usb->event_thread, NULL);
+	pthread_cond_destroy(&usb->cond);
+	pthread_mutex_destroy(&usb->lock);
+	libusb_exit(usb->ctx);
+	free(usb);
 	return ret;
 }
 
+/* Hotplug monitor, it has its own libusb context and event thread
+ * because it must outlive the device handles. */
+typedef struct usb_monitor {
+	libusb_context *ctx;
+	libusb_hotplug_callback_handle hotplug[2];
+	pthread_t event_thread;
+	atomic_int running;
+	usb_hotplug_callback_t callback;
+	void *user_data;
+} usb_monitor_t;
+
+/* The bus and port path of a device, it stays the same when the
+ * programmer is reset or replugged into the same port */
+static int device_location(libusb_device *dev)
+{
+	uint8_t ports[7];
+	int count = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	int location = libusb_get_bus_number(dev);
+
+	for (int i = 0; i < count; i++)
+		location = location * 31 + ports[i];
+	return location;
+}
+
+int usb_get_location(void *handle)
+{
+	if (!handle)
+		return -1;
+	return device_location(
+		libusb_get_device(((usb_handle_t *)handle)->dev));
+}
+
+static int hotplug_cb(libusb_context *ctx, libusb_device *dev,
+		      libusb_hotplug_event event, void *user_data)
+{
+	usb_monitor_t *monitor = user_data;
+
+	monitor->callback(event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+			  device_location(dev), monitor->user_data);
+	return 0;
+}
+
+static void *monitor_thread_func(void *arg)
+{
+	usb_monitor_t *monitor = arg;
+
+	while (monitor->running)
+		libusb_handle_events(monitor->ctx);
+	return NULL;
+}
+
+/* Start watching for programmers being plugged in or out.
+ * Returns NULL if hotplug is not supported on this platform. */
+void *usb_hotplug_open(usb_hotplug_callback_t callback, void *user_data)
+{
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return NULL;
+
+	usb_monitor_t *monitor = calloc(1, sizeof(usb_monitor_t));
+	if (!monitor)
+		return NULL;
+	monitor->callback = callback;
+	monitor->user_data = user_data;
+
+	if (libusb_init(&monitor->ctx) < 0) {
+		free(monitor);
+		return NULL;
+	}
+
+	int events = LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+		     LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+	if (libusb_hotplug_register_callback(
+		    monitor->ctx, events, LIBUSB_HOTPLUG_NO_FLAGS, MP_TL866_VID,
+		    MP_TL866_PID, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_cb, monitor,
+		    &monitor->hotplug[0]) != LIBUSB_SUCCESS) {
+		libusb_exit(monitor->ctx);
+		free(monitor);
+		return NULL;
+	}
+	if (libusb_hotplug_register_callback(
+		    monitor->ctx, events, LIBUSB_HOTPLUG_NO_FLAGS,
+		    MP_TL866II_VID, MP_TL866II_PID, LIBUSB_HOTPLUG_MATCH_ANY,
+		    hotplug_cb, monitor,
+		    &monitor->hotplug[1]) != LIBUSB_SUCCESS) {
+		libusb_hotplug_deregister_callback(monitor->ctx,
+						   monitor->hotplug[0]);
+		libusb_exit(monitor->ctx);
+		free(monitor);
+		return NULL;
+	}
+
+	monitor->running = 1;
+	if (pthread_create(&monitor->event_thread, NULL, monitor_thread_func,
+			   monitor)) {
+		libusb_hotplug_deregister_callback(monitor->ctx,
+						   monitor->hotplug[0]);
+		libusb_hotplug_deregister_callback(monitor->ctx,
+						   monitor->hotplug[1]);
+		libusb_exit(monitor->ctx);
+		free(monitor);
+		return NULL;
+	}
+	return monitor;
+}
+
+void usb_hotplug_close(void *handle)
+{
+	usb_monitor_t *monitor = handle;
+
+	if (!monitor)
+		return;
+
+	/* Wake up libusb_handle_events() as in usb_close() */
+	monitor->running = 0;
+	libusb_interrupt_event_handler(monitor->ctx);
+	libusb_hotplug_deregister_callback(monitor->ctx, monitor->hotplug[0]);
+	libusb_hotplug_deregister_callback(monitor->ctx, monitor->hotplug[1]);
+	pthread_join(monitor->event_thread, NULL);
+	libusb_exit(monitor->ctx);
+	free(monitor);
+}
+
 /* Get no. of devices connected */
 int minipro_get_devices_count(uint8_t version)
 {
@@ -135,117 +358,264 @@ int minipro_get_devices_count(uint8_t version)
 	return devices;
 }
 
-static void payload_transfer_cb(struct libusb_transfer *transfer)
+/* Async transfer descriptor. One or two urbs (EP2+EP3) are in flight,
+ * the last completing urb finishes the whole operation. */
+typedef struct usb_async {
+	usb_handle_t *usb;
+	struct libusb_transfer *urb[2];
+	int count;
+	int pending;
+	int status;
+	uint8_t *buffer; /* Caller's buffer */
+	uint8_t *data; /* Bounce buffer, NULL if the caller's buffer is used */
+	size_t length;
+	usb_cancel_t *cancel;
+	usb_callback_t callback;
+	void *user_data;
+} usb_async_t;
+
+/* Translate a libusb transfer status to the corresponding error code */
+static int transfer_error(struct libusb_transfer *urb)
 {
-	int *completed = transfer->user_data;
-	if (completed != NULL) {
-		*completed = 1;
+	switch (urb->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return LIBUSB_SUCCESS;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_CANCELLED:
+		return LIBUSB_ERROR_INTERRUPTED;
+	case LIBUSB_TRANSFER_STALL:
+		return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		return LIBUSB_ERROR_OVERFLOW;
+	default:
+		return LIBUSB_ERROR_IO;
 	}
 }
 
-static int msg_transfer(void *handle, uint8_t *buffer, size_t size,
-			uint8_t direction, uint8_t endpoint,
-			int *bytes_transferred, uint32_t timeout)
+static void free_async(usb_async_t *async)
 {
-	int ret = libusb_bulk_transfer(handle, (endpoint | direction), buffer,
-				       size, bytes_transferred, timeout);
-
-	if (ret != LIBUSB_SUCCESS)
-		fprintf(stderr, "\nIO error: bulk_transfer: %s\n",
-			libusb_error_name(ret));
-	return ret;
+	libusb_free_transfer(async->urb[0]);
+	libusb_free_transfer(async->urb[1]);
+	free(async->data);
+	free(async);
 }
 
-static int payload_transfer(void *handle, uint8_t direction,
-			    uint8_t *ep2_buffer, size_t ep2_length,
-			    uint8_t *ep3_buffer, size_t ep3_length)
+/* Called from the event thread */
+static void async_transfer_cb(struct libusb_transfer *urb)
 {
-	struct libusb_transfer *ep2_urb;
-	struct libusb_transfer *ep3_urb;
-	int ret;
-	int ep2_completed = 0;
-	int ep3_completed = 0;
-
-	ep2_urb = libusb_alloc_transfer(0);
-	ep3_urb = libusb_alloc_transfer(0);
-	if (!ep2_urb || !ep3_urb) {
-		fprintf(stderr, "Out of memory!\n");
-		return EXIT_FAILURE;
+	usb_async_t *async = urb->user_data;
+	int done = 0, i;
+
+	int status = transfer_error(urb);
+	if (status == LIBUSB_SUCCESS && !(urb->endpoint & LIBUSB_ENDPOINT_IN) &&
+	    urb->actual_length != urb->length) {
+		fprintf(stderr, "%s: short write %d/%d\n", __func__,
+			urb->actual_length, urb->length);
+		status = LIBUSB_ERROR_IO;
 	}
 
-	libusb_fill_bulk_transfer(ep2_urb, handle, (0x02 | direction),
-				  ep2_buffer, ep2_length, payload_transfer_cb,
-				  &ep2_completed, MP_USBTIMEOUT);
-	libusb_fill_bulk_transfer(ep3_urb, handle, (0x03 | direction),
-				  ep3_buffer, ep3_length, payload_transfer_cb,
-				  &ep3_completed, MP_USBTIMEOUT);
-
-	ret = libusb_submit_transfer(ep2_urb);
-	if (ret < 0) {
-		fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-			libusb_error_name(ret));
-		return EXIT_FAILURE;
+	pthread_mutex_lock(&async->usb->lock);
+	if (status != LIBUSB_SUCCESS && async->status == LIBUSB_SUCCESS)
+		async->status = status;
+	if (!--async->pending) {
+		if (async->cancel && async->cancel->pending == async)
+			async->cancel->pending = NULL;
+		done = 1;
 	}
-	ret = libusb_submit_transfer(ep3_urb);
-	if (ret < 0) {
-		fprintf(stderr, "\nIO error: submit_transfer: %s\n",
-			libusb_error_name(ret));
-		return EXIT_FAILURE;
+	pthread_mutex_unlock(&async->usb->lock);
+	if (!done)
+		return;
+
+	if (async->status != LIBUSB_SUCCESS) {
+		if (async->status != LIBUSB_ERROR_INTERRUPTED)
+			fprintf(stderr,
+				"\nIO Error: Async transfer failed: %s\n",
+				libusb_error_name(async->status));
+	} else if (async->data && async->count == 2) {
+		/* Deinterlacing the buffers */
+		size_t blocks = async->length / 64;
+		for (i = 0; i < blocks; ++i) {
+			uint8_t *ep_buf;
+			if (i % 2 == 0) {
+				ep_buf = async->data;
+			} else {
+				ep_buf = async->data + async->length / 2;
+			}
+			memcpy(async->buffer + (i * 64),
+			       ep_buf + ((i / 2) * 64), 64);
+		}
+	} else if (async->data) {
+		memcpy(async->buffer, async->data, async->length);
 	}
 
-	while (!ep2_completed) {
-		ret = libusb_handle_events_completed(NULL, &ep2_completed);
-		if (ret < 0) {
-			if (ret == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(ep2_urb);
-			libusb_cancel_transfer(ep3_urb);
-			continue;
+	async->callback(async->status == LIBUSB_SUCCESS ? EXIT_SUCCESS :
+							  EXIT_FAILURE,
+			async->user_data);
+	free_async(async);
+}
+
+/* Submit one or two bulk transfers. On success the callback will be
+ * called exactly once from the event thread. On failure nothing
+ * was submitted and the callback is never called. */
+static int submit_async(usb_async_t *async, uint8_t direction,
+			uint8_t *ep2_buffer, size_t ep2_length,
+			uint8_t *ep3_buffer, size_t ep3_length,
+			uint8_t endpoint, uint32_t timeout)
+{
+	usb_handle_t *usb = async->usb;
+	int i, ret;
+
+	async->count = ep3_buffer ? 2 : 1;
+	async->status = LIBUSB_SUCCESS;
+	for (i = 0; i < async->count; i++) {
+		async->urb[i] = libusb_alloc_transfer(0);
+		if (!async->urb[i]) {
+			fprintf(stderr, "Out of memory!\n");
+			free_async(async);
+			return EXIT_FAILURE;
 		}
 	}
-	while (!ep3_completed) {
-		ret = libusb_handle_events_completed(NULL, &ep3_completed);
+
+	libusb_fill_bulk_transfer(async->urb[0], usb->dev, (endpoint | direction),
+				  ep2_buffer, ep2_length, async_transfer_cb,
+				  async, timeout);
+	if (async->count == 2)
+		libusb_fill_bulk_transfer(async->urb[1], usb->dev,
+					  (0x03 | direction), ep3_buffer,
+					  ep3_length, async_transfer_cb, async,
+					  timeout);
+
+	pthread_mutex_lock(&usb->lock);
+	if (async->cancel && async->cancel->cancelled) {
+		pthread_mutex_unlock(&usb->lock);
+		free_async(async);
+		return EXIT_FAILURE;
+	}
+	async->pending = async->count;
+	for (i = 0; i < async->count; i++) {
+		ret = libusb_submit_transfer(async->urb[i]);
 		if (ret < 0) {
-			if (ret == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(ep2_urb);
-			libusb_cancel_transfer(ep3_urb);
-			continue;
+			fprintf(stderr, "\nIO error: submit_transfer: %s\n",
+				libusb_error_name(ret));
+			if (!i) {
+				pthread_mutex_unlock(&usb->lock);
+				free_async(async);
+				return EXIT_FAILURE;
+			}
+			/* The first urb is already in flight, let it finish
+			 * the job and report the failure. */
+			async->pending--;
+			async->status = ret;
+			libusb_cancel_transfer(async->urb[0]);
+			break;
 		}
 	}
+	if (async->cancel)
+		async->cancel->pending = async;
+	pthread_mutex_unlock(&usb->lock);
+	return EXIT_SUCCESS;
+}
 
-	if (ep2_urb->status != 0 || ep3_urb->status != 0) {
-		fprintf(stderr, "\nIO Error: Async transfer failed: %s\n",
-			libusb_error_name(ep2_urb->status ? ep2_urb->status :
-							    ep3_urb->status));
-		libusb_free_transfer(ep2_urb);
-		libusb_free_transfer(ep3_urb);
-		return EXIT_FAILURE;
+static usb_async_t *new_async(void *handle, uint8_t *buffer, size_t length,
+			      usb_callback_t callback, void *user_data,
+			      usb_cancel_t *cancel)
+{
+	if (!handle)
+		return NULL;
+	usb_async_t *async = calloc(1, sizeof(usb_async_t));
+	if (!async) {
+		fprintf(stderr, "Out of memory!\n");
+		return NULL;
 	}
+	async->usb = handle;
+	async->buffer = buffer;
+	async->length = length;
+	async->callback = callback;
+	async->user_data = user_data;
+	async->cancel = cancel;
+	return async;
+}
 
-	libusb_free_transfer(ep2_urb);
-	libusb_free_transfer(ep3_urb);
-	return EXIT_SUCCESS;
+/* Abort the transfer associated with the cancellation token (if any).
+ * Further async submissions using this token will fail. */
+void usb_cancel(void *handle, usb_cancel_t *cancel)
+{
+	usb_handle_t *usb = handle;
+
+	pthread_mutex_lock(&usb->lock);
+	cancel->cancelled = 1;
+	usb_async_t *async = cancel->pending;
+	if (async) {
+		int i;
+		for (i = 0; i < async->count; i++)
+			libusb_cancel_transfer(async->urb[i]);
+	}
+	pthread_mutex_unlock(&usb->lock);
 }
 
-int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+/* Completion callback used by the synchronous wrappers */
+static void sync_transfer_cb(int status, void *user_data)
+{
+	usb_completion_t *completion = user_data;
+
+	pthread_mutex_lock(&completion->usb->lock);
+	completion->status = status;
+	completion->completed = 1;
+	pthread_cond_broadcast(&completion->usb->cond);
+	pthread_mutex_unlock(&completion->usb->lock);
+}
+
+/* Sleep until the event thread has completed the transfer */
+static int wait_for_completion(usb_completion_t *completion)
+{
+	pthread_mutex_lock(&completion->usb->lock);
+	while (!completion->completed)
+		pthread_cond_wait(&completion->usb->cond,
+				  &completion->usb->lock);
+	pthread_mutex_unlock(&completion->usb->lock);
+	return completion->status;
+}
+
+static int msg_transfer(void *handle, uint8_t *buffer, size_t size,
+			uint8_t direction, uint8_t endpoint,
+			int *bytes_transferred, uint32_t timeout)
+{
+	/* No device after a failed reconnect */
+	if (!handle) {
+		*bytes_transferred = 0;
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+
+	int ret = libusb_bulk_transfer(((usb_handle_t *)handle)->dev,
+				       (endpoint | direction), buffer,
+				       size, bytes_transferred, timeout);
+
+	if (ret != LIBUSB_SUCCESS)
+		fprintf(stderr, "\nIO error: bulk_transfer: %s\n",
+			libusb_error_name(ret));
+	return ret;
+}
+
+int write_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit, usb_callback_t callback,
+			 void *user_data, usb_cancel_t *cancel)
 {
 	uint32_t ep2_length;
 	uint32_t ep3_length;
-	int status;
-	int bytes_transferred;
+
+	usb_async_t *async = new_async(handle, buffer, length, callback,
+				       user_data, cancel);
+	if (!async)
+		return EXIT_FAILURE;
 
 	/* If the payload length is exactly 64 bytes send it over the
 	 * endpoint2 only */
-	if (!limit || length <= limit) {
-		status = msg_transfer(handle, buffer, length, LIBUSB_ENDPOINT_OUT,
-				    0x02, &bytes_transferred, MP_USBTIMEOUT);
-		if (bytes_transferred == length)
-			return status;
-
-		fprintf(stderr, "%s: short write %d/%lu\n", __func__, bytes_transferred, length);
-		return EXIT_FAILURE;
-	}
+	if (!limit || length <= limit)
+		return submit_async(async, LIBUSB_ENDPOINT_OUT, buffer, length,
+				    NULL, 0, 0x02, MP_USBTIMEOUT);
 
 	/* This  is from XgPro */
 	uint32_t j = length % 128;
@@ -263,59 +633,97 @@ int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
 		ep2_length = ep3_length;
 	}
 
-	return payload_transfer(handle, LIBUSB_ENDPOINT_OUT, buffer, ep2_length,
-				buffer + ep2_length, ep3_length);
+	return submit_async(async, LIBUSB_ENDPOINT_OUT, buffer, ep2_length,
+			    buffer + ep2_length, ep3_length, 0x02,
+			    MP_USBTIMEOUT);
 }
 
-int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+int read_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			size_t limit, usb_callback_t callback, void *user_data,
+			usb_cancel_t *cancel)
 {
+	usb_async_t *async = new_async(handle, buffer, length, callback,
+				       user_data, cancel);
+	if (!async)
+		return EXIT_FAILURE;
+
 	/* If the payload length is less than 64 bytes increase the
 	 * buffer to 64 bytes and read it over the endpoint2 only.
 	 * Submitting a buffer less than 64 bytes will cause an libusb
 	 * overflow.
 	 */
-	int i, bytes_transferred;
 	if (length < 64) {
-		uint8_t data[64];
-		if (msg_transfer(handle, data, sizeof(data), LIBUSB_ENDPOINT_IN,
-				 0x02, &bytes_transferred, MP_USBTIMEOUT))
+		async->data = malloc(64);
+		if (!async->data) {
+			fprintf(stderr, "\nOut of memory\n");
+			free_async(async);
 			return EXIT_FAILURE;
-		memcpy(buffer, data, length);
-		return EXIT_SUCCESS;
+		}
+		return submit_async(async, LIBUSB_ENDPOINT_IN, async->data, 64,
+				    NULL, 0, 0x02, MP_USBTIMEOUT);
 	}
 
 	/* If the payload length < limit bytes read it over the endpoint2 only */
 	if (length == 64 || !limit || length < limit)
-		return msg_transfer(handle, buffer, length, LIBUSB_ENDPOINT_IN,
-				    0x02, &bytes_transferred, MP_USBTIMEOUT);
+		return submit_async(async, LIBUSB_ENDPOINT_IN, buffer, length,
+				    NULL, 0, 0x02, MP_USBTIMEOUT);
 
 	/* More than limit bytes */
-	uint8_t *data = malloc(length);
-	if (!data) {
+	async->data = malloc(length);
+	if (!async->data) {
 		fprintf(stderr, "\nOut of memory\n");
+		free_async(async);
 		return EXIT_FAILURE;
 	}
 
-	/* Async read of endpoints 2 and 3 */
-	if (payload_transfer(handle, LIBUSB_ENDPOINT_IN, data, length / 2,
-			     data + length / 2, length / 2)) {
-		free(data);
+	/* Async read of endpoints 2 and 3, deinterlaced on completion */
+	return submit_async(async, LIBUSB_ENDPOINT_IN, async->data, length / 2,
+			    async->data + length / 2, length / 2, 0x02,
+			    MP_USBTIMEOUT);
+}
+
+int msg_send_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel)
+{
+	usb_async_t *async = new_async(handle, buffer, size, callback,
+				       user_data, cancel);
+	if (!async)
 		return EXIT_FAILURE;
-	}
+	return submit_async(async, LIBUSB_ENDPOINT_OUT, buffer, size, NULL, 0,
+			    0x01, MP_USBTIMEOUT);
+}
 
-	/* Deinterlacing the buffers */
-	size_t blocks = length / 64;
-	for (i = 0; i < blocks; ++i) {
-		uint8_t *ep_buf;
-		if (i % 2 == 0) {
-			ep_buf = data;
-		} else {
-			ep_buf = data + length / 2;
-		}
-		memcpy(buffer + (i * 64), ep_buf + ((i / 2) * 64), 64);
-	}
-	free(data);
-	return EXIT_SUCCESS;
+int msg_recv_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel)
+{
+	usb_async_t *async = new_async(handle, buffer, size, callback,
+				       user_data, cancel);
+	if (!async)
+		return EXIT_FAILURE;
+	return submit_async(async, LIBUSB_ENDPOINT_IN, buffer, size, NULL, 0,
+			    0x01, MP_USB_READ_TIMEOUT);
+}
+
+int write_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+{
+	usb_completion_t completion = { handle, 0, EXIT_FAILURE };
+
+	if (write_payload2_async(handle, buffer, length, limit,
+				 sync_transfer_cb, &completion, NULL))
+		return EXIT_FAILURE;
+	return wait_for_completion(&completion);
+}
+
+int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
+{
+	usb_completion_t completion = { handle, 0, EXIT_FAILURE };
+
+	if (read_payload2_async(handle, buffer, length, limit,
+				sync_transfer_cb, &completion, NULL))
+		return EXIT_FAILURE;
+	return wait_for_completion(&completion);
 }
 
 int msg_send(void *handle, uint8_t *buffer, size_t size)
@@ -49,7 +49,7 @@
 	}
 
 /* Internaly used functions prototypes */
-static int search_devices(uint8_t, char **);
+static int search_devices(uint8_t, char **, int);
 static int usb_write(void *, uint8_t *, size_t, uint8_t);
 static int usb_read(void *, uint8_t *, size_t, uint8_t);
 static int payload_transfer(void *, uint8_t, uint8_t *, size_t, uint8_t *,
@@ -64,7 +64,12 @@ typedef struct usb_handle {
 /* Open usb device */
 void *usb_open(uint8_t verbose)
 {
-	char *device_path;
+	return usb_open_index(verbose, 0);
+}
+
+void *usb_open_index(uint8_t verbose, int index)
+{
+	char *device_path = NULL;
 
 	/* Alocate memory for the usb handle structure */
 	usb_handle_t *handle = malloc(sizeof(usb_handle_t));
@@ -78,8 +83,8 @@ void *usb_open(uint8_t verbose)
 	handle->InterfaceHandle = NULL;
 
 	/* First search for TL866A/CS */
-	int count = search_devices(MP_TL866A, &device_path);
-	if (count) {
+	int count = search_devices(MP_TL866A, &device_path, index);
+	if (count > index) {
 		handle->DeviceHandle =
 			CreateFileA(device_path, GENERIC_READ | GENERIC_WRITE,
 				    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
@@ -95,8 +100,9 @@ void *usb_open(uint8_t verbose)
 	}
 
 	/* Then search for TL866II+ */
-	count = search_devices(MP_TL866IIPLUS, &device_path);
-	if (count) {
+	index -= count;
+	count = search_devices(MP_TL866IIPLUS, &device_path, index);
+	if (count > index) {
 		handle->DeviceHandle =
 			CreateFileA(device_path, GENERIC_READ | GENERIC_WRITE,
 				    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
@@ -141,7 +147,7 @@ int usb_close(void *handle)
 /* Get number of devices connected */
 int minipro_get_devices_count(uint8_t version)
 {
-	return search_devices(version, NULL);
+	return search_devices(version, NULL, 0);
 }
 
 /* synchronously message send */
@@ -238,6 +244,69 @@ int read_payload2(void *handle, uint8_t *buffer, size_t length, size_t limit)
 	return EXIT_SUCCESS;
 }
 
+/* There is no event thread on Windows. The async variants just perform
+ * the transfer synchronously and call the completion callback before
+ * returning. */
+int msg_send_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel)
+{
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	callback(msg_send(handle, buffer, size), user_data);
+	return EXIT_SUCCESS;
+}
+
+int msg_recv_async(void *handle, uint8_t *buffer, size_t size,
+		   usb_callback_t callback, void *user_data,
+		   usb_cancel_t *cancel)
+{
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	callback(msg_recv(handle, buffer, size), user_data);
+	return EXIT_SUCCESS;
+}
+
+int write_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			 size_t limit, usb_callback_t callback,
+			 void *user_data, usb_cancel_t *cancel)
+{
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	callback(write_payload2(handle, buffer, length, limit), user_data);
+	return EXIT_SUCCESS;
+}
+
+int read_payload2_async(void *handle, uint8_t *buffer, size_t length,
+			size_t limit, usb_callback_t callback, void *user_data,
+			usb_cancel_t *cancel)
+{
+	if (cancel && cancel->cancelled)
+		return EXIT_FAILURE;
+	callback(read_payload2(handle, buffer, length, limit), user_data);
+	return EXIT_SUCCESS;
+}
+
+void usb_cancel(void *handle, usb_cancel_t *cancel)
+{
+	cancel->cancelled = 1;
+}
+
+/* Hotplug notifications are not implemented on Windows */
+void *usb_hotplug_open(usb_hotplug_callback_t callback, void *user_data)
+{
+	return NULL;
+}
+
+void usb_hotplug_close(void *monitor)
+{
+}
+
+int usb_get_location(void *handle)
+{
+	return -1;
+}
+
 
 /************************************
  * Kitchen functions
@@ -317,6 +386,8 @@ static int usb_write(void *handle, uint8_t *buffer, size_t size,
 	BOOL ret;
 
 	/* Check the device handle first */
+	if (!handle)
+		return EXIT_FAILURE;
 	if (((usb_handle_t *)handle)->DeviceHandle == INVALID_HANDLE_VALUE)
 		return 0;
 
@@ -349,6 +420,8 @@ static int usb_read(void *handle, uint8_t *buffer, size_t size,
 	BOOL ret;
 
 	/* Check the device handle first */
+	if (!handle)
+		return EXIT_FAILURE;
 	if (((usb_handle_t *)handle)->DeviceHandle == INVALID_HANDLE_VALUE)
 		return 0;
 
@@ -374,10 +447,10 @@ static int usb_read(void *handle, uint8_t *buffer, size_t size,
 
 /* This function will scan for connected devices.
  *  If the device_path is not null then this function will
- *  return here the path of the first device found.
+ *  return here the path of the index-th device found.
  *  Don't forget to call free(device_path) to free the allocated memory.
  */
-static int search_devices(uint8_t version, char **device_path)
+static int search_devices(uint8_t version, char **device_path, int index)
 {
 	uint32_t idx = 0;
 	uint32_t devices = 0;
@@ -433,7 +506,7 @@ static int search_devices(uint8_t version, char **device_path)
 				    handle, &deviceinterfacedata,
 				    deviceinterfacedetaildata, datasize, &size,
 				    NULL)) {
-				if (!devices && device_path) {
+				if (devices == index && device_path) {
 					*device_path =
 						strdup(deviceinterfacedetaildata
 							       ->DevicePath);